@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "batch.h"
+#include "model.h"
+#include "texture.h"
+#include "threadpool.h"
+#include "profile.h"
+#include "shader.h"
+
+namespace {
+
+// LRU of loaded assets by path. A miss puts a future in the cache right away
+// and loads outside the lock: jobs after the same asset wait for that one
+// load, jobs after other assets don't wait at all.
+template<class T> class AssetCache {
+public:
+	typedef std::shared_ptr<T> Ptr;
+
+	explicit AssetCache(size_t capacity) : capacity_(capacity ? capacity : 1) {}
+
+	template<class Load> Ptr get(const std::string &key, Load load) {
+		std::promise<Ptr> promise;
+		std::shared_future<Ptr> future;
+		{
+			std::lock_guard<std::mutex> guard(lock_);
+			typename Index::iterator it = index_.find(key);
+			if (it!=index_.end()) {
+				lru_.splice(lru_.begin(), lru_, it->second);
+				future = it->second->second;
+			} else {
+				lru_.push_front(Entry(key, promise.get_future().share()));
+				index_[key] = lru_.begin();
+				while (lru_.size()>capacity_) {
+					index_.erase(lru_.back().first);
+					lru_.pop_back();
+				}
+			}
+		}
+		if (future.valid()) return future.get();
+
+		Ptr value = load(key);
+		promise.set_value(value);
+		if (!value) {
+			// failures are not kept, the file may be there next time
+			std::lock_guard<std::mutex> guard(lock_);
+			typename Index::iterator it = index_.find(key);
+			if (it!=index_.end() && it->second->second.wait_for(std::chrono::seconds(0))==std::future_status::ready
+					&& !it->second->second.get()) {
+				lru_.erase(it->second);
+				index_.erase(it);
+			}
+		}
+		return value;
+	}
+
+private:
+	typedef std::pair<std::string, std::shared_future<Ptr> > Entry;
+	typedef std::unordered_map<std::string, typename std::list<Entry>::iterator> Index;
+
+	size_t capacity_;
+	std::mutex lock_;
+	std::list<Entry> lru_; // most recently used first
+	Index index_;
+};
+
+// Framebuffers not in use, most recently released last. Only the last few are
+// kept, a job list switching sizes all the time would pile them up otherwise.
+class FramePool {
+public:
+	FramePool(ThreadPool *pool, size_t keep) : pool_(pool), keep_(keep) {}
+
+	~FramePool() {
+		for (size_t i=0; i<free_.size(); i++) delete free_[i];
+	}
+
+	FrameBuffer *acquire(int width, int height) {
+		{
+			std::lock_guard<std::mutex> guard(lock_);
+			for (size_t i=free_.size(); i--; ) {
+				FrameBuffer *frame = free_[i];
+				if (frame->get_width()==width && frame->get_height()==height) {
+					free_.erase(free_.begin()+i);
+					return frame;
+				}
+			}
+		}
+		return new FrameBuffer(width, height, pool_);
+	}
+
+	void release(FrameBuffer *frame) {
+		FrameBuffer *evicted = NULL;
+		{
+			std::lock_guard<std::mutex> guard(lock_);
+			free_.push_back(frame);
+			if (free_.size()>keep_) {
+				evicted = free_.front();
+				free_.erase(free_.begin());
+			}
+		}
+		delete evicted;
+	}
+
+private:
+	FramePool(const FramePool &);
+	FramePool & operator =(const FramePool &);
+
+	ThreadPool *pool_;
+	size_t keep_;
+	std::mutex lock_;
+	std::vector<FrameBuffer *> free_;
+};
+
+std::shared_ptr<LodModel> load_model(const std::string &path) {
+	std::shared_ptr<LodModel> model(new LodModel(path.c_str()));
+	if (!model->level(0).nfaces()) return std::shared_ptr<LodModel>();
+	return model;
+}
+
+std::shared_ptr<Texture> load_texture(const std::string &path) {
+	TGAImage image;
+	if (!image.read_tga_file(path.c_str())) return std::shared_ptr<Texture>();
+	return std::shared_ptr<Texture>(new Texture(image));
+}
+
+bool parse_floats(const std::string &s, float *v, int n) {
+	const char *p = s.c_str();
+	for (int i=0; i<n; i++) {
+		char *end;
+		v[i] = strtof(p, &end);
+		if (end==p || (i<n-1 ? *end!=',' : *end!=0)) return false;
+		p = end+1;
+	}
+	return true;
+}
+
+// true if key is one of the camera keys, ok tells whether its value was good
+bool camera_key(const std::string &key, const std::string &value, Camera &camera, bool &ok) {
+	float v[3];
+	if (key=="eye")         { ok = parse_floats(value, v, 3); camera.eye    = Vec3f(v[0], v[1], v[2]); }
+	else if (key=="center") { ok = parse_floats(value, v, 3); camera.center = Vec3f(v[0], v[1], v[2]); }
+	else if (key=="up")     { ok = parse_floats(value, v, 3); camera.up     = Vec3f(v[0], v[1], v[2]); }
+	else if (key=="persp") camera.perspective = value!="0";
+	else return false;
+	return true;
+}
+
+} // namespace
+
+bool parse_camera(const std::string &line, Camera &camera, std::string &error) {
+	camera = Camera();
+	std::istringstream in(line);
+	std::string token;
+	while (in >> token) {
+		size_t eq = token.find('=');
+		if (eq==std::string::npos) {
+			error = "expected key=value, got " + token;
+			return false;
+		}
+		std::string key = token.substr(0, eq), value = token.substr(eq+1);
+		bool ok = true;
+		if (!camera_key(key, value, camera, ok)) {
+			error = "unknown key " + key;
+			return false;
+		}
+		if (!ok) {
+			error = "bad value for " + key + ": " + value;
+			return false;
+		}
+	}
+	return true;
+}
+
+RenderJob::RenderJob() : model(), texture(), output(), camera(), width(1000), height(1000), shading(FORWARD),
+		lod_pixels(LOD_PIXELS), light(0, 0, -1), shadows(0), zprepass(false), samples(1), strip(0) {
+}
+
+bool parse_job(const std::string &line, RenderJob &job, std::string &error) {
+	job = RenderJob();
+	std::istringstream in(line);
+	std::string token;
+	while (in >> token) {
+		size_t eq = token.find('=');
+		if (eq==std::string::npos) {
+			error = "expected key=value, got " + token;
+			return false;
+		}
+		std::string key = token.substr(0, eq), value = token.substr(eq+1);
+		bool ok = true;
+		if (key=="model") job.model = value;
+		else if (key=="texture") job.texture = value;
+		else if (key=="out") job.output = value;
+		else if (key=="size") ok = sscanf(value.c_str(), "%dx%d", &job.width, &job.height)==2 && job.width>0 && job.height>0;
+		else if (key=="lod") ok = sscanf(value.c_str(), "%f", &job.lod_pixels)==1;
+		else if (key=="light") {
+			float v[3];
+			ok = parse_floats(value, v, 3);
+			job.light = Vec3f(v[0], v[1], v[2]);
+		}
+		else if (key=="shadows") ok = sscanf(value.c_str(), "%d", &job.shadows)==1 && job.shadows>=0;
+		else if (key=="zprepass") job.zprepass = value!="0";
+		else if (key=="strip") ok = sscanf(value.c_str(), "%d", &job.strip)==1 && job.strip>=0;
+		else if (key=="msaa") ok = sscanf(value.c_str(), "%d", &job.samples)==1 && (job.samples==1 || MsaaBuffer::supported(job.samples));
+		else if (key=="shading") {
+			ok = value=="forward" || value=="deferred";
+			job.shading = value=="deferred" ? DEFERRED : FORWARD;
+		}
+		else if (!camera_key(key, value, job.camera, ok)) {
+			error = "unknown key " + key;
+			return false;
+		}
+		if (!ok) {
+			error = "bad value for " + key + ": " + value;
+			return false;
+		}
+	}
+	if (job.model.empty() || job.output.empty()) {
+		error = "model and out are required";
+		return false;
+	}
+	return true;
+}
+
+BatchOptions::BatchOptions() : threads(0), max_jobs(0), cache_size(8), profile(NULL), trace(NULL) {
+}
+
+int run_batch(std::istream &in, const BatchOptions &options) {
+	ThreadPool pool(options.threads);
+	// every job in flight sits on a worker, its tiles go to whoever is free
+	int max_jobs = options.max_jobs>0 ? options.max_jobs : pool.size();
+	AssetCache<LodModel> models(options.cache_size);
+	AssetCache<Texture> textures(options.cache_size);
+	FramePool frames(&pool, max_jobs);
+	std::shared_ptr<Texture> no_texture(new Texture());
+
+	std::mutex lock;
+	std::condition_variable done_cv;
+	int inflight = 0, jobs = 0, failed = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if (options.trace) begin_trace(*options.trace);
+
+	std::string line;
+	for (int lineno=1; std::getline(in, line); lineno++) {
+		size_t first = line.find_first_not_of(" \t\r");
+		if (first==std::string::npos || line[first]=='#') continue;
+		RenderJob job;
+		std::string error;
+		jobs++;
+		if (!parse_job(line, job, error)) {
+			std::lock_guard<std::mutex> guard(lock);
+			std::cerr << "job list line " << lineno << ": " << error << "\n";
+			failed++;
+			continue;
+		}
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			done_cv.wait(guard, [&] { return inflight<max_jobs; });
+			inflight++;
+		}
+		pool.submit([&, job] {
+			Profile profile(options.trace!=NULL);
+			std::shared_ptr<LodModel> model;
+			std::shared_ptr<Texture> texture;
+			{
+				PROFILE_SCOPE(&profile, STAGE_LOAD);
+				model = models.get(job.model, load_model);
+				texture = job.texture.empty() ? no_texture : textures.get(job.texture, load_texture);
+			}
+			bool ok = model && texture;
+			if (ok) {
+				// strips start on the tiles of the whole frame, see render_model_strips()
+				const int tile = TiledRasterizer::TILE_SIZE;
+				int rows = (std::min(job.strip, job.height)+tile-1)/tile*tile;
+				bool strips = rows>0 && rows<job.height;
+				FrameBuffer *frame = frames.acquire(job.width, strips ? rows : job.height);
+				frame->set_shading(job.shading);
+				frame->set_shadows(job.shadows);
+				frame->set_zprepass(job.zprepass);
+				frame->set_samples(job.samples);
+				frame->set_profile(&profile);
+				TGAWriter out;
+				ok = out.open(job.output.c_str(), job.width, job.height, TGAImage::RGB);
+				if (ok) {
+					if (job.texture.empty() && strips) render_untextured_strips(*model, job.camera, job.light, job.height, *frame, out,
+						job.lod_pixels);
+					else if (job.texture.empty()) render_untextured(*model, job.camera, job.light, *frame, &out, job.lod_pixels);
+					else if (strips) render_model_strips(*model, *texture, job.camera, job.light, job.height, *frame, out, job.lod_pixels);
+					else render_model(*model, *texture, job.camera, job.light, *frame, &out, job.lod_pixels);
+					PROFILE_SCOPE(&profile, STAGE_WRITE);
+					ok = out.close();
+				}
+				frame->set_profile(NULL);
+				frames.release(frame);
+			}
+			std::lock_guard<std::mutex> guard(lock);
+			if (!model) std::cerr << "can't load model " << job.model << "\n";
+			else if (!texture) std::cerr << "can't load texture " << job.texture << "\n";
+			// one line per finished job on stdout, for whoever feeds the list
+			std::cout << (ok ? "done " : "failed ") << job.output << std::endl;
+			if (!ok) failed++;
+			if (options.profile) profile.write_json(*options.profile, job.output);
+			if (options.trace) profile.write_trace_events(*options.trace, job.output);
+			inflight--;
+			done_cv.notify_one();
+		});
+	}
+	pool.wait();
+	if (options.trace) end_trace(*options.trace);
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+	std::cerr << "# batch: " << jobs << " jobs, " << failed << " failed, " << seconds << " s" << std::endl;
+	return failed;
+}
@@ -0,0 +1,58 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <string>
+#include <istream>
+#include <ostream>
+#include "renderer.h"
+
+// One line of a job list: whitespace separated key=value pairs, for instance
+//   model=obj/african_head.obj texture=obj/african_head_diffuse.tga size=800x800
+//   eye=1,1,3 center=0,0,0 up=0,1,0 persp=1 shading=deferred lod=0.5 out=frame0001.tga
+// model and out are required, a model without texture is Gouraud shaded (see
+// render_untextured()). lod is how many pixels a simplified level of the
+// model may be off on screen, 0 always draws the model itself. light=x,y,z is
+// the direction the light goes, shadows=2048 gives it a shadow map that many
+// texels wide, zprepass=1 draws the depth before forward shading, msaa=4
+// takes 4 samples per pixel (2, 4 or 8) with forward shading, strip=256 draws
+// the frame 256 rows at a time, rounded up to a multiple of 64 (see
+// render_model_strips()). Empty lines and lines starting with # are skipped.
+struct RenderJob {
+	std::string model, texture, output;
+	Camera camera;
+	int width, height;
+	Shading shading;
+	float lod_pixels;
+	Vec3f light;
+	int shadows; // shadow map size, 0 for none
+	bool zprepass;
+	int samples; // per pixel, 1 for no multisampling
+	int strip;   // rows per strip, 0 for the whole frame at once
+
+	RenderJob();
+};
+
+// false with a message in error if the line is not a valid job
+bool parse_job(const std::string &line, RenderJob &job, std::string &error);
+// just the eye, center, up and persp keys of a job line, the ones not given
+// are the default camera's
+bool parse_camera(const std::string &line, Camera &camera, std::string &error);
+
+struct BatchOptions {
+	int threads;       // 0: one per hardware thread
+	int max_jobs;      // jobs in flight at once, 0: one per thread
+	size_t cache_size; // models and textures kept loaded, each
+	// with a build made with PROFILE=1: one JSON line of stage times and
+	// counters per job, and a Chrome trace of all the jobs, NULL for none
+	std::ostream *profile, *trace;
+
+	BatchOptions();
+};
+
+// Renders every job of the list as it is read. Models and textures live in
+// LRU caches shared by all jobs, framebuffers go back to a pool once their
+// image is written and are handed to the next job of the same size.
+// Returns the number of failed jobs.
+int run_batch(std::istream &in, const BatchOptions &options);
+
+#endif //__BATCH_H__
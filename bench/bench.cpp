@@ -0,0 +1,403 @@
+// Benchmarks of the hot paths on their own and of whole frames over a sweep
+// of procedural mesh sizes and resolutions.
+//   bench [--full] [--threads n] [--time s] [--commit id] [-o results.json]
+//         [--baseline old.json]
+// Every result is one line of the json file, with the time per iteration
+// and the throughput. With --baseline the results are compared to an earlier
+// file line by line, and the exit status is 1 if anything got slower by more
+// than 10%.
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "model.h"
+#include "objloader.h"
+#include "meshcache.h"
+#include "texture.h"
+#include "raster.h"
+#include "renderer.h"
+#include "shader.h"
+#include "threadpool.h"
+#include "zbuffer.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Result {
+	std::string name;
+	std::string params;
+	long iterations;
+	double seconds; // per iteration
+	double tris, pixels, bytes; // per iteration, 0 when it doesn't apply
+};
+
+std::vector<Result> results;
+double min_time = .2;
+volatile float sink;
+
+double since(Clock::time_point start) {
+	return std::chrono::duration<double>(Clock::now()-start).count();
+}
+
+// Seconds per call of f. The first call warms up and only counts when it
+// alone takes longer than min_time, then f runs until min_time went by.
+template<class F> double measure(F f, long &iterations) {
+	Clock::time_point start = Clock::now();
+	f();
+	double first = since(start);
+	iterations = 1;
+	if (first>=min_time) return first;
+	iterations = 0;
+	start = Clock::now();
+	double elapsed;
+	do {
+		f();
+		iterations++;
+		elapsed = since(start);
+	} while (elapsed<min_time);
+	return elapsed/iterations;
+}
+
+// the loaders and the tga reader talk on std::cerr at every call
+struct Quiet {
+	Quiet() { std::cerr.setstate(std::ios::failbit); }
+	~Quiet() { std::cerr.clear(); }
+};
+
+template<class F> void run(const std::string &name, const std::string &params, double tris, double pixels, double bytes, F f) {
+	Result r;
+	r.name = name;
+	r.params = params;
+	r.tris = tris;
+	r.pixels = pixels;
+	r.bytes = bytes;
+	{
+		Quiet quiet;
+		r.seconds = measure(f, r.iterations);
+	}
+	results.push_back(r);
+	char line[256];
+	snprintf(line, sizeof(line), "%-14s %-22s %12.0f ns", name.c_str(), params.c_str(), r.seconds*1e9);
+	std::cout << line;
+	if (tris)   std::cout << "  " << tris/r.seconds/1e6 << " Mtri/s";
+	if (pixels) std::cout << "  " << pixels/r.seconds/1e6 << " Mpx/s";
+	if (bytes)  std::cout << "  " << bytes/r.seconds/1e6 << " MB/s";
+	std::cout << std::endl;
+}
+
+std::string param(const char *fmt, long a, long b=0) {
+	char buf[64];
+	snprintf(buf, sizeof(buf), fmt, a, b);
+	return buf;
+}
+
+// Bumpy sphere of about ntris triangles on an n x n latitude/longitude grid.
+// It fits in [-1,1]^2 so the default camera sees all of it, and the bumps
+// give it some self occlusion.
+void make_sphere(long ntris, ObjMesh &m) {
+	int n = std::max(2, (int)std::sqrt(ntris/2.));
+	m = ObjMesh();
+	for (int j=0; j<=n; j++) {
+		for (int i=0; i<=n; i++) {
+			float u = i/(float)n, v = j/(float)n;
+			float phi = u*2*M_PI, theta = v*M_PI;
+			float r = .8f + .05f*std::sin(7*phi)*std::sin(5*theta);
+			float x = std::sin(theta)*std::cos(phi), y = std::cos(theta), z = std::sin(theta)*std::sin(phi);
+			m.vx.push_back(r*x); m.vy.push_back(r*y); m.vz.push_back(r*z);
+			m.nx.push_back(x);   m.ny.push_back(y);   m.nz.push_back(z);
+			m.tu.push_back(u);   m.tv.push_back(1-v);
+		}
+	}
+	for (int j=0; j<n; j++) {
+		for (int i=0; i<n; i++) {
+			uint32_t a = j*(n+1)+i, b = a+1, c = a+n+1, d = c+1;
+			uint32_t f[6] = { a, b, c, b, d, c };
+			for (int k=0; k<6; k++) {
+				m.faces.push_back(f[k]);
+				m.face_tex.push_back(f[k]);
+				m.face_norm.push_back(f[k]);
+			}
+		}
+	}
+}
+
+bool write_obj(const char *path, const ObjMesh &m) {
+	FILE *f = fopen(path, "w");
+	if (!f) return false;
+	for (size_t i=0; i<m.vx.size(); i++) fprintf(f, "v %.6f %.6f %.6f\n", m.vx[i], m.vy[i], m.vz[i]);
+	for (size_t i=0; i<m.tu.size(); i++) fprintf(f, "vt %.6f %.6f 0\n", m.tu[i], m.tv[i]);
+	for (size_t i=0; i<m.nx.size(); i++) fprintf(f, "vn %.4f %.4f %.4f\n", m.nx[i], m.ny[i], m.nz[i]);
+	for (size_t i=0; i<m.faces.size(); i+=3) {
+		fprintf(f, "f");
+		for (int k=0; k<3; k++) fprintf(f, " %u/%u/%u", m.faces[i+k]+1, m.face_tex[i+k]+1, m.face_norm[i+k]+1);
+		fprintf(f, "\n");
+	}
+	return fclose(f)==0;
+}
+
+long file_size(const char *path) {
+	std::ifstream in(path, std::ios::binary | std::ios::ate);
+	return in.is_open() ? (long)in.tellg() : 0;
+}
+
+void checker(TGAImage &img) {
+	RGBView view(img);
+	for (int y=0; y<view.get_height(); y++)
+		for (int x=0; x<view.get_width(); x++)
+			view.set(x, y, ((x>>4)^(y>>4))&1 ? PixelRGB(230, 200, 120) : PixelRGB(60, 90, 160));
+}
+
+void bench_barycentric() {
+	int sizes[] = { 4, 16, 64, 256 };
+	for (int s : sizes) {
+		Vec3f pts[3] = { Vec3f(0, 0, 0), Vec3f(s, 0, 0), Vec3f(0, s, 0) };
+		run("barycentric", param("size=%ld", s), 0, (double)(s+1)*(s+1), 0, [&] {
+			float sum = 0;
+			for (int y=0; y<=s; y++)
+				for (int x=0; x<=s; x++)
+					sum += barycentric(pts, Vec3f(x, y, 0)).x;
+			sink = sum;
+		});
+	}
+}
+
+void bench_triangle(Texture &texture) {
+	int sizes[] = { 4, 16, 64, 256, 1000 };
+	DepthBuffer zbuffer(1024, 1024);
+	RenderTarget target(1024, 1024);
+	for (int s : sizes) {
+		Vec3f pts[3] = { Vec3f(8, 8, 0), Vec3f(8+s, 8, 0), Vec3f(8, 8+s, 0) };
+		Vec2f uv[3] = { Vec2f(0, 0), Vec2f(1, 0), Vec2f(0, 1) };
+		// same depth every time, the fragments keep passing and getting shaded
+		run("triangle", param("size=%ld", s), 1, s*s/2., 0, [&] {
+			triangle(pts, zbuffer, uv, texture, target, 1.f);
+		});
+		run("triangle_depth", param("size=%ld", s), 1, s*s/2., 0, [&] {
+			triangle_depth(pts, zbuffer, 0, 0, 1023, 1023);
+		});
+	}
+}
+
+void bench_line() {
+	int lengths[] = { 10, 100, 1000 };
+	TGAImage image(1024, 1024, TGAImage::RGB);
+	TGAColor white(255, 255, 255, 255);
+	for (int l : lengths) {
+		run("line", param("length=%ld", l), 0, l+1, 0, [&] {
+			line(Vec2i(0, 0), Vec2i(l, l/3), image, white);
+		});
+	}
+}
+
+void bench_model_load(const std::string &dir, const std::vector<long> &sizes) {
+	std::string path = dir + "/tinyrenderer-bench.obj";
+	std::string cache = mesh_cache_path(path.c_str());
+	for (long n : sizes) {
+		ObjMesh mesh;
+		make_sphere(n, mesh);
+		long tris = mesh.faces.size()/3;
+		if (!write_obj(path.c_str(), mesh)) {
+			std::cerr << "can't write " << path << "\n";
+			return;
+		}
+		double bytes = file_size(path.c_str());
+		unlink(cache.c_str());
+		run("load_obj", param("tris=%ld", tris), tris, 0, bytes, [&] {
+			Model model(path.c_str(), false);
+			sink = model.nfaces();
+		});
+		{
+			Quiet quiet;
+			Model model(path.c_str(), true); // writes the cache
+		}
+		// mapping only, the pages come in as the first frame touches them
+		run("load_mcache", param("tris=%ld", tris), tris, 0, 0, [&] {
+			Model model(path.c_str(), true);
+			sink = model.pos_x()[model.nverts()-1]; // touch it
+		});
+	}
+	unlink(path.c_str());
+	unlink(cache.c_str());
+}
+
+void bench_tga(const std::string &dir, Texture &texture, ThreadPool &pool) {
+	int sizes[] = { 1024, 4096 };
+	std::string path = dir + "/tinyrenderer-bench.tga";
+	ObjMesh mesh;
+	make_sphere(20000, mesh);
+	Model model(mesh);
+	for (int s : sizes) {
+		// a rendered frame, flat background and textured surface, like real output
+		FrameBuffer frame(s, s, &pool);
+		render_model(model, texture, Camera(), Vec3f(0, 0, -1), frame);
+		TGAImage &image = frame.resolve();
+		double bytes = (double)s*s*image.get_bytespp();
+		for (int rle=0; rle<2; rle++) {
+			std::string p = param("res=%ld rle=%ld", s, rle);
+			run("tga_write", p, 0, (double)s*s, bytes, [&] {
+				image.write_tga_file(path.c_str(), rle, &pool);
+			});
+			TGAImage in;
+			run("tga_read", p, 0, (double)s*s, bytes, [&] {
+				in.read_tga_file(path.c_str());
+			});
+		}
+	}
+	unlink(path.c_str());
+}
+
+void bench_frames(Texture &texture, ThreadPool &pool, const std::vector<long> &sizes, const std::vector<int> &res) {
+	for (long n : sizes) {
+		ObjMesh mesh;
+		make_sphere(n, mesh);
+		Model model(mesh);
+		long tris = model.nfaces();
+		for (int r : res) {
+			FrameBuffer frame(r, r, &pool);
+			run("frame", param("tris=%ld res=%ld", tris, r), tris, (double)r*r, 0, [&] {
+				render_model(model, texture, Camera(), Vec3f(0, 0, -1), frame);
+			});
+			frame.set_zprepass(true);
+			run("frame_zprepass", param("tris=%ld res=%ld", tris, r), tris, (double)r*r, 0, [&] {
+				render_model(model, texture, Camera(), Vec3f(0, 0, -1), frame);
+			});
+			frame.set_zprepass(false);
+			frame.set_shadows(2048);
+			run("frame_shadows", param("tris=%ld res=%ld", tris, r), tris, (double)r*r, 0, [&] {
+				render_model(model, texture, Camera(), Vec3f(1, -1, -1), frame);
+			});
+			frame.set_shadows(0);
+			for (int samples=4; samples<=8; samples*=2) {
+				frame.set_samples(samples);
+				run(samples==4 ? "frame_msaa4" : "frame_msaa8", param("tris=%ld res=%ld", tris, r), tris, (double)r*r, 0, [&] {
+					render_model(model, texture, Camera(), Vec3f(0, 0, -1), frame);
+				});
+			}
+			frame.set_samples(1);
+			GouraudShader gouraud(model.view(), Vec3f(0, 0, -1), TGAColor(255, 255, 255, 255));
+			run("frame_gouraud", param("tris=%ld res=%ld", tris, r), tris, (double)r*r, 0, [&] {
+				render_shaded(model.view(), gouraud, Camera(), frame);
+			});
+			frame.set_shading(DEFERRED);
+			run("frame_deferred", param("tris=%ld res=%ld", tris, r), tris, (double)r*r, 0, [&] {
+				render_model(model, texture, Camera(), Vec3f(0, 0, -1), frame);
+			});
+		}
+	}
+}
+
+bool write_results(const char *path, const std::string &commit, int threads) {
+	std::ofstream out(path);
+	if (!out.is_open()) return false;
+	out << "{\"commit\": \"" << commit << "\", \"kernel\": \"" << raster_kernel_name()
+		<< "\", \"threads\": " << threads << ", \"results\": [\n";
+	for (size_t i=0; i<results.size(); i++) {
+		const Result &r = results[i];
+		char line[512];
+		snprintf(line, sizeof(line), "{\"name\": \"%s\", \"params\": \"%s\", \"iterations\": %ld, \"ns\": %.1f, "
+			"\"tri_per_s\": %.6g, \"px_per_s\": %.6g, \"mb_per_s\": %.6g}%s\n",
+			r.name.c_str(), r.params.c_str(), r.iterations, r.seconds*1e9,
+			r.tris/r.seconds, r.pixels/r.seconds, r.bytes/r.seconds/1e6, i+1<results.size() ? "," : "");
+		out << line;
+	}
+	out << "]}\n";
+	return out.good();
+}
+
+// reads back the name, params and ns of every result line written above
+bool read_baseline(const char *path, std::map<std::string, double> &ns) {
+	std::ifstream in(path);
+	if (!in.is_open()) return false;
+	std::string line;
+	while (std::getline(in, line)) {
+		char name[128], params[128];
+		double t;
+		if (sscanf(line.c_str(), "{\"name\": \"%127[^\"]\", \"params\": \"%127[^\"]\", \"iterations\": %*d, \"ns\": %lf",
+				name, params, &t)==3)
+			ns[std::string(name) + " " + params] = t;
+	}
+	return true;
+}
+
+int compare(const char *path) {
+	std::map<std::string, double> base;
+	if (!read_baseline(path, base)) {
+		std::cerr << "can't open file " << path << "\n";
+		return 1;
+	}
+	int slower = 0;
+	std::cout << "\nagainst " << path << ":\n";
+	for (size_t i=0; i<results.size(); i++) {
+		std::string key = results[i].name + " " + results[i].params;
+		if (!base.count(key)) continue;
+		double ratio = results[i].seconds*1e9/base[key];
+		char line[256];
+		snprintf(line, sizeof(line), "%-37s %6.2fx%s", key.c_str(), ratio, ratio>1.1 ? "  SLOWER" : "");
+		std::cout << line << "\n";
+		slower += ratio>1.1;
+	}
+	return slower ? 1 : 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+	bool full = false;
+	int threads = 0;
+	const char *out = "bench.json", *baseline = NULL;
+	std::string commit = "unknown";
+	for (int i=1; i<argc; i++) {
+		if (!strcmp(argv[i], "--full")) full = true;
+		else if (!strcmp(argv[i], "--threads") && i+1<argc) threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--time") && i+1<argc) min_time = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--commit") && i+1<argc) commit = argv[++i];
+		else if (!strcmp(argv[i], "-o") && i+1<argc) out = argv[++i];
+		else if (!strcmp(argv[i], "--baseline") && i+1<argc) baseline = argv[++i];
+		else {
+			std::cerr << "usage: " << argv[0] << " [--full] [--threads n] [--time s] [--commit id] [-o results.json] [--baseline old.json]\n";
+			return 2;
+		}
+	}
+	const char *tmp = getenv("TMPDIR");
+	std::string dir = tmp && *tmp ? tmp : "/tmp";
+
+	ThreadPool pool(threads);
+	TGAImage tex_image(256, 256, TGAImage::RGB);
+	checker(tex_image);
+	Texture texture(tex_image);
+	std::cout << "# kernel " << raster_kernel_name() << ", " << pool.size() << " threads" << std::endl;
+
+	std::vector<long> load_sizes = { 100000, 1000000 };
+	std::vector<long> tris = { 1000, 10000, 100000, 1000000 };
+	std::vector<int> res = { 256, 1024, 4096 };
+	if (full) {
+		load_sizes.push_back(10000000);
+		tris.push_back(10000000);
+		res = { 256, 1024, 2048, 4096, 8192 };
+	}
+
+	bench_barycentric();
+	bench_triangle(texture);
+	bench_line();
+	bench_model_load(dir, load_sizes);
+	bench_tga(dir, texture, pool);
+	bench_frames(texture, pool, tris, res);
+
+	if (!write_results(out, commit, pool.size())) {
+		std::cerr << "can't write " << out << "\n";
+		return 1;
+	}
+	std::cout << "# results in " << out << std::endl;
+	return baseline ? compare(baseline) : 0;
+}
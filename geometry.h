@@ -4,6 +4,9 @@
 #include <vector>
 #include <cassert>
 #include <iostream>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 template<size_t DimCols,size_t DimRows,typename T> class mat;
 
@@ -18,8 +21,8 @@ private:
 /////////////////////////////////////////////////////////////////////////////////
 
 template <typename T> struct vec<2,T> {
-    vec() : x(T()), y(T()) {}
-    vec(T X, T Y) : x(X), y(Y) {}
+    constexpr vec() : x(T()), y(T()) {}
+    constexpr vec(T X, T Y) : x(X), y(Y) {}
     template <class U> vec<2,T>(const vec<2,U> &v);
           T& operator[](const size_t i)       { assert(i<2); return i<=0 ? x : y; }
     const T& operator[](const size_t i) const { assert(i<2); return i<=0 ? x : y; }
@@ -30,8 +33,8 @@ template <typename T> struct vec<2,T> {
 /////////////////////////////////////////////////////////////////////////////////
 
 template <typename T> struct vec<3,T> {
-    vec() : x(T()), y(T()), z(T()) {}
-    vec(T X, T Y, T Z) : x(X), y(Y), z(Z) {}
+    constexpr vec() : x(T()), y(T()), z(T()) {}
+    constexpr vec(T X, T Y, T Z) : x(X), y(Y), z(Z) {}
     template <class U> vec<3,T>(const vec<3,U> &v);
           T& operator[](const size_t i)       { assert(i<3); return i<=0 ? x : (1==i ? y : z); }
     const T& operator[](const size_t i) const { assert(i<3); return i<=0 ? x : (1==i ? y : z); }
@@ -43,6 +46,25 @@ template <typename T> struct vec<3,T> {
 
 /////////////////////////////////////////////////////////////////////////////////
 
+#if defined(__SSE__)
+// Vec4f in one SSE register: no assert and no branch in operator[], the
+// arithmetic below overloads the generic templates.
+template <> struct vec<4,float> {
+    vec() : m(_mm_setzero_ps()) {}
+    vec(float X, float Y, float Z, float W) : m(_mm_setr_ps(X, Y, Z, W)) {}
+    explicit vec(__m128 v) : m(v) {}
+          float& operator[](const size_t i)       { return data_[i]; }
+    const float& operator[](const size_t i) const { return data_[i]; }
+
+    union {
+        __m128 m;
+        float data_[4];
+    };
+};
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////
+
 template<size_t DIM,typename T> T operator*(const vec<DIM,T>& lhs, const vec<DIM,T>& rhs) {
     T ret = T();
     for (size_t i=DIM; i--; ret+=lhs[i]*rhs[i]);
@@ -82,7 +104,7 @@ template<size_t LEN,size_t DIM, typename T> vec<LEN,T> proj(const vec<DIM,T> &v)
     return ret;
 }
 
-template <typename T> vec<3,T> cross(vec<3,T> v1, vec<3,T> v2) {
+template <typename T> constexpr vec<3,T> cross(vec<3,T> v1, vec<3,T> v2) {
     return vec<3,T>(v1.y*v2.z - v1.z*v2.y, v1.z*v2.x - v1.x*v2.z, v1.x*v2.y - v1.y*v2.x);
 }
 
@@ -211,6 +233,205 @@ template <size_t DimRows,size_t DimCols,class T> std::ostream& operator<<(std::o
 
 /////////////////////////////////////////////////////////////////////////////////
 
+#if defined(__SSE__)
+inline float operator*(const vec<4,float> &lhs, const vec<4,float> &rhs) {
+    __m128 p = _mm_mul_ps(lhs.m, rhs.m);
+    __m128 s = _mm_add_ps(p, _mm_movehl_ps(p, p));
+    return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, 1)));
+}
+
+inline vec<4,float> operator+(const vec<4,float> &lhs, const vec<4,float> &rhs) {
+    return vec<4,float>(_mm_add_ps(lhs.m, rhs.m));
+}
+
+inline vec<4,float> operator-(const vec<4,float> &lhs, const vec<4,float> &rhs) {
+    return vec<4,float>(_mm_sub_ps(lhs.m, rhs.m));
+}
+
+inline vec<4,float> operator*(const vec<4,float> &lhs, float rhs) {
+    return vec<4,float>(_mm_mul_ps(lhs.m, _mm_set1_ps(rhs)));
+}
+
+inline vec<4,float> operator/(const vec<4,float> &lhs, float rhs) {
+    return vec<4,float>(_mm_div_ps(lhs.m, _mm_set1_ps(rhs)));
+}
+
+// Matrix as four row registers. Products broadcast one matrix entry at a time
+// instead of copying columns out, the inverse is the closed form from 2x2
+// sub-determinants instead of the recursive cofactor templates.
+template<> class mat<4,4,float> {
+    vec<4,float> rows[4];
+
+    // the classical adjugate, inverse = adjugate/det
+    mat<4,4,float> adjugate_t(float &det) const {
+        const float *a0 = &rows[0][0], *a1 = &rows[1][0], *a2 = &rows[2][0], *a3 = &rows[3][0];
+        float s0 = a0[0]*a1[1] - a1[0]*a0[1], s1 = a0[0]*a1[2] - a1[0]*a0[2];
+        float s2 = a0[0]*a1[3] - a1[0]*a0[3], s3 = a0[1]*a1[2] - a1[1]*a0[2];
+        float s4 = a0[1]*a1[3] - a1[1]*a0[3], s5 = a0[2]*a1[3] - a1[2]*a0[3];
+        float c5 = a2[2]*a3[3] - a3[2]*a2[3], c4 = a2[1]*a3[3] - a3[1]*a2[3];
+        float c3 = a2[1]*a3[2] - a3[1]*a2[2], c2 = a2[0]*a3[3] - a3[0]*a2[3];
+        float c1 = a2[0]*a3[2] - a3[0]*a2[2], c0 = a2[0]*a3[1] - a3[0]*a2[1];
+        det = s0*c5 - s1*c4 + s2*c3 + s3*c2 - s4*c1 + s5*c0;
+        mat<4,4,float> b;
+        b[0] = vec<4,float>( a1[1]*c5 - a1[2]*c4 + a1[3]*c3, -a0[1]*c5 + a0[2]*c4 - a0[3]*c3,
+                             a3[1]*s5 - a3[2]*s4 + a3[3]*s3, -a2[1]*s5 + a2[2]*s4 - a2[3]*s3);
+        b[1] = vec<4,float>(-a1[0]*c5 + a1[2]*c2 - a1[3]*c1,  a0[0]*c5 - a0[2]*c2 + a0[3]*c1,
+                            -a3[0]*s5 + a3[2]*s2 - a3[3]*s1,  a2[0]*s5 - a2[2]*s2 + a2[3]*s1);
+        b[2] = vec<4,float>( a1[0]*c4 - a1[1]*c2 + a1[3]*c0, -a0[0]*c4 + a0[1]*c2 - a0[3]*c0,
+                             a3[0]*s4 - a3[1]*s2 + a3[3]*s0, -a2[0]*s4 + a2[1]*s2 - a2[3]*s0);
+        b[3] = vec<4,float>(-a1[0]*c3 + a1[1]*c1 - a1[2]*c0,  a0[0]*c3 - a0[1]*c1 + a0[2]*c0,
+                            -a3[0]*s3 + a3[1]*s1 - a3[2]*s0,  a2[0]*s3 - a2[1]*s1 + a2[2]*s0);
+        return b;
+    }
+
+public:
+    mat() {}
+
+          vec<4,float>& operator[] (const size_t idx)       { return rows[idx]; }
+    const vec<4,float>& operator[] (const size_t idx) const { return rows[idx]; }
+
+    vec<4,float> col(const size_t idx) const {
+        return vec<4,float>(rows[0][idx], rows[1][idx], rows[2][idx], rows[3][idx]);
+    }
+
+    void set_col(size_t idx, vec<4,float> v) {
+        for (size_t i=4; i--; rows[i][idx]=v[i]);
+    }
+
+    static mat<4,4,float> identity() {
+        mat<4,4,float> ret;
+        ret[0] = vec<4,float>(1, 0, 0, 0);
+        ret[1] = vec<4,float>(0, 1, 0, 0);
+        ret[2] = vec<4,float>(0, 0, 1, 0);
+        ret[3] = vec<4,float>(0, 0, 0, 1);
+        return ret;
+    }
+
+    float det() const {
+        float d;
+        adjugate_t(d);
+        return d;
+    }
+
+    mat<3,3,float> get_minor(size_t row, size_t col) const {
+        mat<3,3,float> ret;
+        for (size_t i=3; i--; )
+            for (size_t j=3; j--; ret[i][j]=rows[i<row?i:i+1][j<col?j:j+1]);
+        return ret;
+    }
+
+    float cofactor(size_t row, size_t col) const {
+        return get_minor(row,col).det()*((row+col)%2 ? -1 : 1);
+    }
+
+    // the matrix of cofactors, like the generic one
+    mat<4,4,float> adjugate() const {
+        float d;
+        return adjugate_t(d).transpose();
+    }
+
+    mat<4,4,float> invert_transpose() const {
+        float d;
+        mat<4,4,float> ret = adjugate_t(d).transpose();
+        return ret/d;
+    }
+
+    mat<4,4,float> invert() const {
+        float d;
+        return adjugate_t(d)/d;
+    }
+
+    mat<4,4,float> transpose() const {
+        __m128 r0 = rows[0].m, r1 = rows[1].m, r2 = rows[2].m, r3 = rows[3].m;
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        mat<4,4,float> ret;
+        ret[0] = vec<4,float>(r0); ret[1] = vec<4,float>(r1);
+        ret[2] = vec<4,float>(r2); ret[3] = vec<4,float>(r3);
+        return ret;
+    }
+};
+
+inline vec<4,float> operator*(const mat<4,4,float> &lhs, const vec<4,float> &rhs) {
+    __m128 p0 = _mm_mul_ps(lhs[0].m, rhs.m), p1 = _mm_mul_ps(lhs[1].m, rhs.m);
+    __m128 p2 = _mm_mul_ps(lhs[2].m, rhs.m), p3 = _mm_mul_ps(lhs[3].m, rhs.m);
+    _MM_TRANSPOSE4_PS(p0, p1, p2, p3);
+    return vec<4,float>(_mm_add_ps(_mm_add_ps(p0, p1), _mm_add_ps(p2, p3)));
+}
+
+inline mat<4,4,float> operator*(const mat<4,4,float> &lhs, const mat<4,4,float> &rhs) {
+    mat<4,4,float> ret;
+    for (size_t i=0; i<4; i++) {
+        const vec<4,float> &a = lhs[i];
+        __m128 r = _mm_mul_ps(_mm_set1_ps(a[0]), rhs[0].m);
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[1]), rhs[1].m));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[2]), rhs[2].m));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_set1_ps(a[3]), rhs[3].m));
+        ret[i] = vec<4,float>(r);
+    }
+    return ret;
+}
+
+inline mat<4,4,float> operator/(mat<4,4,float> lhs, const float &rhs) {
+    __m128 inv = _mm_set1_ps(rhs);
+    for (size_t i=4; i--; lhs[i] = vec<4,float>(_mm_div_ps(lhs[i].m, inv)));
+    return lhs;
+}
+#endif
+
+/////////////////////////////////////////////////////////////////////////////////
+
+// Batches of points in SoA form, one array per coordinate: m*(x,y,z,1) and
+// the divide by w. Four points per SSE register, the leftovers one by one
+// with the same operations in the same order, so every point gets the same
+// bits whichever way it went.
+inline void transform_points(const mat<4,4,float> &m, const float *x, const float *y, const float *z, size_t n,
+        float *ox, float *oy, float *oz, float *ow) {
+    size_t i = 0;
+#if defined(__SSE__)
+    __m128 e[4][4];
+    for (int r=0; r<4; r++)
+        for (int c=0; c<4; c++) e[r][c] = _mm_set1_ps(m[r][c]);
+    float *out[4] = { ox, oy, oz, ow };
+    for (; i+4<=n; i+=4) {
+        __m128 px = _mm_loadu_ps(x+i), py = _mm_loadu_ps(y+i), pz = _mm_loadu_ps(z+i);
+        for (int r=0; r<4; r++) {
+            __m128 v = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e[r][0], px), _mm_mul_ps(e[r][1], py)),
+                _mm_mul_ps(e[r][2], pz)), e[r][3]);
+            _mm_storeu_ps(out[r]+i, v);
+        }
+    }
+#endif
+    for (; i<n; i++) {
+        float px = x[i], py = y[i], pz = z[i];
+        ox[i] = m[0][0]*px + m[0][1]*py + m[0][2]*pz + m[0][3];
+        oy[i] = m[1][0]*px + m[1][1]*py + m[1][2]*pz + m[1][3];
+        oz[i] = m[2][0]*px + m[2][1]*py + m[2][2]*pz + m[2][3];
+        ow[i] = m[3][0]*px + m[3][1]*py + m[3][2]*pz + m[3][3];
+    }
+}
+
+inline void project_points(const float *x, const float *y, const float *z, const float *w, size_t n,
+        float *ox, float *oy, float *oz) {
+    size_t i = 0;
+#if defined(__SSE__)
+    __m128 one = _mm_set1_ps(1.f);
+    for (; i+4<=n; i+=4) {
+        __m128 inv = _mm_div_ps(one, _mm_loadu_ps(w+i));
+        _mm_storeu_ps(ox+i, _mm_mul_ps(_mm_loadu_ps(x+i), inv));
+        _mm_storeu_ps(oy+i, _mm_mul_ps(_mm_loadu_ps(y+i), inv));
+        _mm_storeu_ps(oz+i, _mm_mul_ps(_mm_loadu_ps(z+i), inv));
+    }
+#endif
+    for (; i<n; i++) {
+        float inv = 1.f/w[i];
+        ox[i] = x[i]*inv;
+        oy[i] = y[i]*inv;
+        oz[i] = z[i]*inv;
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+
 typedef vec<2,  float> Vec2f;
 typedef vec<2,  int>   Vec2i;
 typedef vec<3,  float> Vec3f;
@@ -0,0 +1,88 @@
+#include <iostream>
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include "lod.h"
+#include "meshcache.h"
+#include "simplify.h"
+#include "renderer.h"
+
+namespace {
+
+// no level is made from one with less than four times this many faces
+const int MIN_FACES = 64;
+// a level that keeps more than this much of the one before is not worth it
+const float MIN_REDUCTION = .8f;
+
+// "foo.obj", 2 -> "foo.obj.lod2.mcache"
+std::string lod_cache_path(const char *source, int level) {
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".lod%d.mcache", level);
+	return std::string(source) + suffix;
+}
+
+} // namespace
+
+LodModel::LodModel(const char *filename, bool cache) : levels_(), errors_(), center_(0, 0, 0), radius_(0) {
+	levels_.push_back(std::unique_ptr<Model>(new Model(filename, cache)));
+	errors_.push_back(0);
+	Model &model = *levels_[0];
+	if (!model.nverts()) return;
+
+	const MeshView &v = model.view();
+	Vec3f lo(v.vx[0], v.vy[0], v.vz[0]), hi = lo;
+	for (uint32_t i=1; i<v.nverts; i++) {
+		lo = Vec3f(std::min(lo.x, v.vx[i]), std::min(lo.y, v.vy[i]), std::min(lo.z, v.vz[i]));
+		hi = Vec3f(std::max(hi.x, v.vx[i]), std::max(hi.y, v.vy[i]), std::max(hi.z, v.vz[i]));
+	}
+	center_ = (lo+hi)*.5f;
+	float r2 = 0;
+	for (uint32_t i=0; i<v.nverts; i++) {
+		Vec3f d = Vec3f(v.vx[i], v.vy[i], v.vz[i])-center_;
+		r2 = std::max(r2, d*d);
+	}
+	radius_ = std::sqrt(r2);
+
+	for (int i=1; levels_.back()->nfaces()>=4*MIN_FACES; i++) {
+		Model &prev = *levels_.back();
+		std::string path = lod_cache_path(filename, i);
+		MeshCacheHeader header;
+		if (cache && read_mesh_cache_header(path.c_str(), header) && mesh_cache_fresh(header, filename)) {
+			std::unique_ptr<Model> level(new Model(path.c_str(), filename));
+			if (level->nfaces()) {
+				levels_.push_back(std::move(level));
+				errors_.push_back(header.lod_error);
+				continue;
+			}
+		}
+		ObjMesh mesh;
+		float error;
+		simplify_mesh(prev.view(), prev.nfaces()/4, mesh, error);
+		if (mesh.faces.empty() || mesh.faces.size()/3>MIN_REDUCTION*prev.nfaces()) break;
+		// measured against the level before, which was already that far off
+		error += errors_.back();
+		std::unique_ptr<Model> level(new Model(mesh));
+		// best effort like the cache of the model
+		if (cache) write_mesh_cache(path.c_str(), level->view(), filename, error);
+		levels_.push_back(std::move(level));
+		errors_.push_back(error);
+	}
+	std::cerr << "# lod: " << levels_.size() << " levels, f#";
+	for (size_t i=0; i<levels_.size(); i++) std::cerr << " " << levels_[i]->nfaces();
+	std::cerr << std::endl;
+}
+
+int LodModel::select(const Camera &camera, int width, int height, float max_pixels) const {
+	Vec3f z = camera.eye-camera.center;
+	float dist = z.norm();
+	if (dist<=0) return 0;
+	z = z*(1.f/dist);
+	// w of the point of the sphere nearest to the eye, see projection()
+	float w = camera.perspective ? 1.f-((center_-camera.center)*z+radius_)/dist : 1.f;
+	if (w<=0) return 0;
+	float pixels_per_unit = std::max(width, height)*.5f/w;
+	for (int i=levels()-1; i>0; i--)
+		if (errors_[i]*pixels_per_unit<=max_pixels) return i;
+	return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef __LOD_H__
+#define __LOD_H__
+
+#include <memory>
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+
+struct Camera;
+
+// what a level may be off on screen before a finer one is drawn
+const float LOD_PIXELS = .5f;
+
+// A model and its simplified levels (see simplify.h), each with about a
+// quarter of the faces of the one before, down to a few dozen. Level 0 is
+// the model itself. With cache, level i is kept in foo.obj.lodi.mcache along
+// with its error and rebuilt from level i-1 once the obj changes.
+class LodModel {
+public:
+	explicit LodModel(const char *filename, bool cache=true);
+	int levels() const { return (int)levels_.size(); }
+	Model &level(int i) { return *levels_[i]; }
+	// how far level i may be off the model, in model units
+	float error(int i) const { return errors_[i]; }
+	Vec3f center() const { return center_; }
+	float radius() const { return radius_; }
+	// the coarsest level whose error covers at most max_pixels where the
+	// bounding sphere comes closest to the camera
+	int select(const Camera &camera, int width, int height, float max_pixels=LOD_PIXELS) const;
+
+private:
+	LodModel(const LodModel &);
+	LodModel & operator =(const LodModel &);
+
+	std::vector<std::unique_ptr<Model> > levels_;
+	std::vector<float> errors_;
+	Vec3f center_;
+	float radius_;
+};
+
+#endif //__LOD_H__
@@ -1,12 +1,25 @@
+#include <algorithm>
 #include <complex>
 #include <vector>
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <limits>
+#include <iostream>
+#include <fstream>
+#include <memory>
 
 #include "tgaimage.h"
 #include "model.h"
 #include "geometry.h"
+#include "raster.h"
+#include "renderer.h"
+#include "batch.h"
+#include "sequence.h"
+#include "shader.h"
+#include "threadpool.h"
+#include "zbuffer.h"
+#include "profile.h"
 
 const TGAColor WHITE = TGAColor(255, 255, 255, 255);
 const TGAColor RED   = TGAColor(255, 0,   0,   255);
@@ -14,170 +27,331 @@ const TGAColor GREEN = TGAColor(0, 255, 0, 255);
 const TGAColor BLUE = TGAColor(0, 0, 255, 255);
 const int WIDTH = 1000;
 const int HEIGHT = 1000;
+// frames bigger than this are drawn in strips of STRIP_ROWS unless --strip says otherwise
+const long long STRIP_PIXELS = 1LL<<26;
+const int STRIP_ROWS = 256;
+// a TGA keeps its size in 16 bits
+const int MAX_SIZE = 65535;
 
-Model *model = NULL;
-TGAImage *texture = NULL;
+// "x,y,z" into light
+bool parse_light(const char *s, Vec3f &light) {
+	return sscanf(s, "%f,%f,%f", &light.x, &light.y, &light.z)==3;
+}
 
-void line(Vec2i p0, Vec2i p1, TGAImage &image, TGAColor color);
-void triangle(Vec3f *pts, float *zBuffer, Vec2f *texCoords, TGAImage &texture, TGAImage &image, float intensity);
+// "1920x1080" into width, height
+bool parse_size(const char *s, int &width, int &height) {
+	return sscanf(s, "%dx%d", &width, &height)==2 && width>0 && height>0 && width<=MAX_SIZE && height<=MAX_SIZE;
+}
 
+// "4" into samples, 1 or one MsaaBuffer::supported()
+bool parse_samples(const char *s, int &samples) {
+	samples = atoi(s);
+	return samples==1 || MsaaBuffer::supported(samples);
+}
 
-int main(int argc, char** argv) {
-	TGAImage image(WIDTH, HEIGHT, TGAImage::RGB);
-	TGAColor bg(83,41,104,255);
-	for(int x = 0; x<image.get_width(); x++){
-		for(int y = 0; y<image.get_height();y++){
-			image.set(x,y,bg);
+// render_shaded() into out, a strip at a time if frame is lower than height
+template <class Shader> void draw_shaded(const MeshView &mesh, const Shader &shader, const Camera &camera, int height,
+		FrameBuffer &frame, TGAWriter &out) {
+	if (frame.get_height()<height) render_shaded_strips(mesh, shader, camera, height, frame, out);
+	else render_shaded(mesh, shader, camera, frame, &out);
+}
+
+// main.render --batch jobs.txt (or - for stdin) [--threads n] [--jobs n] [--cache n]
+//     [--profile stats.json] [--trace trace.json]
+int batch_main(int argc, char** argv) {
+	BatchOptions options;
+	const char *list = NULL, *stats = NULL, *trace = NULL;
+	for (int i=1; i<argc; i++) {
+		if (!strcmp(argv[i], "--batch") && i+1<argc) list = argv[++i];
+		else if (!strcmp(argv[i], "--threads") && i+1<argc) options.threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--jobs") && i+1<argc) options.max_jobs = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--cache") && i+1<argc) options.cache_size = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--profile") && i+1<argc) stats = argv[++i];
+		else if (!strcmp(argv[i], "--trace") && i+1<argc) trace = argv[++i];
+		else {
+			std::cerr << "usage: " << argv[0] << " --batch jobs.txt|- [--threads n] [--jobs n] [--cache n]"
+				<< " [--profile stats.json] [--trace trace.json]\n";
+			return 2;
 		}
 	}
-	// init zBuffer
-	float *zBuffer = new float[WIDTH*HEIGHT];
-	for(int i = 0; i < WIDTH*HEIGHT; i++){
-		zBuffer[i] = -std::numeric_limits<float>::max();
+	if (!list) {
+		std::cerr << "--batch needs a job list\n";
+		return 2;
 	}
-
-	if(argc == 2){
-		model = new Model(argv[1]);
+	if ((stats || trace) && !PROFILE_ENABLED) {
+		std::cerr << "built without profiling, rebuild with make PROFILE=1\n";
+		return 2;
 	}
-	else{
-		model = new Model("obj/african_head.obj");
-		texture = new TGAImage();
-		texture->read_tga_file("obj/african_head_diffuse.tga");	
+	std::ofstream stats_out, trace_out;
+	if (stats) {
+		stats_out.open(stats);
+		if (!stats_out.is_open()) {
+			std::cerr << "can't open file " << stats << "\n";
+			return 1;
+		}
+		options.profile = &stats_out;
 	}
-	
-	Vec3f light = Vec3f(0, 0, -1);
-	light.normalize();
-	// Model rendering
-	for (int i=0; i<model->nfaces(); i++){
-		//printf("%d\n",i);
-		std::vector<int> face = model->face(i);
-		std::vector<int> faceTex = model->face_tex(i);
-		Vec3f screen_coords[3];
-		Vec3f world_coords[3];
-		Vec2f tex_coords[3];
-	//	printf("%d\n", face_tex[0]);
-		for (int j=0; j<3; j++){
-			Vec3f fv = model->vert(face[j]); // face vert
-			Vec2f tv = model->texCoord(faceTex[j]);
-			screen_coords[j] = Vec3f(int((fv.x+1.) * WIDTH/2.), int((fv.y+1.) * HEIGHT/2.), fv.z);
-			world_coords[j] = fv;
-			tex_coords[j] = tv;
-			//printf("%f\n", tv.x);
+	if (trace) {
+		trace_out.open(trace);
+		if (!trace_out.is_open()) {
+			std::cerr << "can't open file " << trace << "\n";
+			return 1;
 		}
-		Vec3f normal = cross(world_coords[2]-world_coords[0],world_coords[1]-world_coords[0]);
-		normal.normalize();
-		float intensity = normal*light;
-		//TGAColor faceCol = TGAColor(intensity*255, intensity*255, intensity*255, 255);
-		if(intensity > 0)
-			triangle(screen_coords, zBuffer, tex_coords, *texture, image, intensity);
+		options.trace = &trace_out;
 	}
-	
-
-	
-
-	image.flip_vertically(); // i want to have the origin at the left bottom corner of the image
-	image.write_tga_file("output.tga");
-	delete model;
-	return 0;
-}
-
-Vec3f barycentric(Vec3f *pts, Vec3f P){
-	// Get barycentric coords of point P on triangle given by pts
-	// (1-u-v, u, v)
-	Vec3f a = Vec3f(pts[2].x - pts[0].x, pts[1].x - pts[0].x, pts[0].x - P.x);
-	Vec3f b = Vec3f(pts[2].y - pts[0].y, pts[1].y - pts[0].y, pts[0].y - P.y);
-
-	// Solve linear system with cross prod.
-	Vec3f u = cross(a,b);
-	// Get (u, v, 1)
-	//printf("%f,%f,%f\n",u.x,u.y,u.z);
-	// if u[2] < 1, degenerate case, else normalize & return
-	if(std::abs(u.z) > 1e-2)
-		return Vec3f(1.f - (u.x + u.y)/u.z, u.y/u.z, u.x/u.z);
-
-	return Vec3f(-1, 1, 1);
-}
-
-Vec2f bary2Cart(Vec2f *texCoords, Vec3f bary){
-	Vec2f p;
-	for (int i=0; i<3; i++){
-		p.x += bary[i]*texCoords[i].x;
-		p.y += bary[i]*texCoords[i].y;
+	if (!strcmp(list, "-")) return run_batch(std::cin, options) ? 1 : 0;
+	std::ifstream in(list);
+	if (!in.is_open()) {
+		std::cerr << "can't open file " << list << "\n";
+		return 1;
 	}
-	return p;
+	return run_batch(in, options) ? 1 : 0;
 }
 
-void triangle(Vec3f *pts, float *zBuffer, Vec2f *texCoords, TGAImage &texture, TGAImage &image, float intensity){
-
-	Vec2f boxMin(image.get_width() - 1, image.get_height() - 1);
-	Vec2f boxMax(0,0);
-	Vec2f clamp(image.get_width() - 1, image.get_height() - 1);
-	
-	// Figure the box:
-	for(int i=0; i<3; i++){
-		for(int j=0; j<2; j++){
-			boxMin[j] = std::max(0.f, std::min(boxMin[j], pts[i][j]));
-			boxMax[j] = std::min(clamp[j], std::max(boxMax[j], pts[i][j]));
-		}
+// main.render --sequence frames [--out frame%04d.tga] [--model m.obj [--texture t.tga]] [--size WxH]
+//     [--camera "eye=x,y,z center=x,y,z up=x,y,z persp=1"] [--path cameras.txt] [--deferred] [--lod pixels]
+//     [--light x,y,z] [--shadows size] [--zprepass] [--msaa samples] [--threads n] [--writers n] [--buffers n]
+// a turntable around --camera, or through the cameras of the path file, one per line
+int sequence_main(int argc, char** argv) {
+	SequenceOptions options;
+	const char *path = NULL;
+	std::string error;
+	bool ok = true;
+	for (int i=1; i<argc && ok; i++) {
+		if (!strcmp(argv[i], "--sequence") && i+1<argc) options.frames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--out") && i+1<argc) options.output = argv[++i];
+		else if (!strcmp(argv[i], "--model") && i+1<argc) options.model = argv[++i];
+		else if (!strcmp(argv[i], "--texture") && i+1<argc) options.texture = argv[++i];
+		else if (!strcmp(argv[i], "--size") && i+1<argc) ok = parse_size(argv[++i], options.width, options.height);
+		else if (!strcmp(argv[i], "--camera") && i+1<argc) ok = parse_camera(argv[++i], options.camera, error);
+		else if (!strcmp(argv[i], "--path") && i+1<argc) path = argv[++i];
+		else if (!strcmp(argv[i], "--deferred")) options.shading = DEFERRED;
+		else if (!strcmp(argv[i], "--lod") && i+1<argc) options.lod_pixels = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--light") && i+1<argc) ok = parse_light(argv[++i], options.light);
+		else if (!strcmp(argv[i], "--shadows") && i+1<argc) options.shadows = std::max(atoi(argv[++i]), 0);
+		else if (!strcmp(argv[i], "--zprepass")) options.zprepass = true;
+		else if (!strcmp(argv[i], "--msaa") && i+1<argc) ok = parse_samples(argv[++i], options.samples);
+		else if (!strcmp(argv[i], "--threads") && i+1<argc) options.threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--writers") && i+1<argc) options.writers = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--buffers") && i+1<argc) options.buffers = atoi(argv[++i]);
+		else ok = false;
 	}
-	
-	// Walk the box and paint
-	Vec3f p;
-	for(p.x=boxMin.x; p.x<=boxMax.x; p.x++){
-		for(p.y=boxMin.y; p.y<=boxMax.y; p.y++){
-			Vec3f bary = barycentric(pts, p);
-			if(bary.x<0||bary.y<0||bary.z<0) continue;
-			// Gather z-value of p
-			p.z = 0;
-			for(int i=0; i<3; i++)
-				p.z += pts[i].z*bary[i];
-			if(zBuffer[int(p.x+p.y*WIDTH)] <= p.z){
-				zBuffer[int(p.x+p.y*WIDTH)] = p.z;
-				// figure color. Use bary coords in texture space to interp
-				Vec2f uv = bary2Cart(texCoords, bary);
-				TGAColor tex_color = texture.get(int((uv.x)*texture.get_width()),int((uv.y)*texture.get_height()));
-				tex_color.r *= intensity; tex_color.g *= intensity; tex_color.b*=intensity;
-				image.set(p.x,p.y,tex_color);
+	if (!ok || options.frames<=0) {
+		if (!error.empty()) std::cerr << "--camera: " << error << "\n";
+		std::cerr << "usage: " << argv[0] << " --sequence frames [--out frame%04d.tga] [--model m.obj [--texture t.tga]]"
+			<< " [--size WxH] [--camera \"eye=x,y,z ...\"] [--path cameras.txt] [--deferred] [--lod pixels]"
+			<< " [--light x,y,z] [--shadows size] [--zprepass] [--msaa 2|4|8] [--threads n] [--writers n] [--buffers n]\n";
+		return 2;
+	}
+	if (!valid_pattern(options.output)) {
+		std::cerr << "--out needs one %d for the frame number, got " << options.output << "\n";
+		return 2;
+	}
+	if (options.model.empty()) {
+		options.model = "obj/african_head.obj";
+		options.texture = "obj/african_head_diffuse.tga";
+	}
+	if (path) {
+		std::ifstream in(path);
+		if (!in.is_open()) {
+			std::cerr << "can't open file " << path << "\n";
+			return 1;
+		}
+		std::string line;
+		for (int lineno=1; std::getline(in, line); lineno++) {
+			size_t first = line.find_first_not_of(" \t\r");
+			if (first==std::string::npos || line[first]=='#') continue;
+			Camera camera;
+			if (!parse_camera(line, camera, error)) {
+				std::cerr << path << " line " << lineno << ": " << error << "\n";
+				return 1;
 			}
+			options.path.push_back(camera);
 		}
-	}	
-
+		if (options.path.empty()) {
+			std::cerr << path << " has no cameras\n";
+			return 1;
+		}
+	}
+	return run_sequence(options) ? 1 : 0;
 }
 
+// main.render [--size WxH] [--strip rows] [--deferred] [--lod pixels] [--light x,y,z] [--shadows size] [--zprepass]
+//     [--msaa samples] [--shader flat|gouraud|textured|normalmap] [--texture t.tga] [--normalmap nm.tga]
+//     [--profile stats.json] [--trace trace.json] [model.obj]
+// without --shader a textured model goes through render_model(), one without
+// a texture is Gouraud shaded, or flat if it has no normals. The frame is
+// drawn in strips of rows with --strip, rounded up to a multiple of 64, and
+// in strips of STRIP_ROWS without it when the frame has more than
+// STRIP_PIXELS; --strip 0 draws the whole frame at once whatever its size.
+int main(int argc, char** argv) {
+	for (int i=1; i<argc; i++)
+		if (!strcmp(argv[i], "--batch")) return batch_main(argc, argv);
+		else if (!strcmp(argv[i], "--sequence")) return sequence_main(argc, argv);
 
-void line(Vec2i p0, Vec2i p1, TGAImage &image, TGAColor color){
-	// We use Bressenham's algo
-	bool vertChart = false;
-	
-	int x0 = p0.x;
-	int y0 = p0.y;
-	int x1 = p1.x;
-	int y1 = p1.y;
-	
-	// Use vertical chart?
-	if(std::abs(x0 - x1) < std::abs(y0 - y1)){
-		std::swap(x0, y0);
-		std::swap(x1, y1);
-		vertChart = true;
+	Shading shading = FORWARD;
+	const char *stats = NULL, *trace = NULL, *path = NULL;
+	const char *shader = NULL, *texture_path = NULL, *normalmap_path = NULL;
+	float lod_pixels = LOD_PIXELS;
+	Vec3f light = Vec3f(0, 0, -1);
+	int shadows = 0;
+	bool zprepass = false;
+	int samples = 1;
+	int width = WIDTH, height = HEIGHT, strip = -1;
+	for (int i=1; i<argc; i++) {
+		if (!strcmp(argv[i], "--size") && i+1<argc && parse_size(argv[i+1], width, height)) i++;
+		else if (!strcmp(argv[i], "--strip") && i+1<argc && atoi(argv[i+1])>=0) strip = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--deferred")) shading = DEFERRED;
+		else if (!strcmp(argv[i], "--lod") && i+1<argc) lod_pixels = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--light") && i+1<argc && parse_light(argv[i+1], light)) i++;
+		else if (!strcmp(argv[i], "--shadows") && i+1<argc) shadows = std::max(atoi(argv[++i]), 0);
+		else if (!strcmp(argv[i], "--zprepass")) zprepass = true;
+		else if (!strcmp(argv[i], "--msaa") && i+1<argc && parse_samples(argv[i+1], samples)) i++;
+		else if (!strcmp(argv[i], "--shader") && i+1<argc) shader = argv[++i];
+		else if (!strcmp(argv[i], "--texture") && i+1<argc) texture_path = argv[++i];
+		else if (!strcmp(argv[i], "--normalmap") && i+1<argc) normalmap_path = argv[++i];
+		else if (!strcmp(argv[i], "--profile") && i+1<argc) stats = argv[++i];
+		else if (!strcmp(argv[i], "--trace") && i+1<argc) trace = argv[++i];
+		else if (strncmp(argv[i], "--", 2) && !path) path = argv[i];
+		else {
+			std::cerr << "usage: " << argv[0] << " [--size WxH] [--strip rows] [--deferred] [--lod pixels] [--light x,y,z]"
+				<< " [--shadows size] [--zprepass] [--msaa 2|4|8] [--shader flat|gouraud|textured|normalmap] [--texture t.tga] [--normalmap nm.tga]"
+				<< " [--profile stats.json] [--trace trace.json] [model.obj]\n";
+			return 2;
+		}
 	}
-	
-	// We shall draw left to right
-	if(x0 > x1){
-		std::swap(x0, x1);
-		std::swap(y0, y1);
+	if (!path) {
+		path = "obj/african_head.obj";
+		if (!texture_path) texture_path = "obj/african_head_diffuse.tga";
+	}
+	if (shader && strcmp(shader, "flat") && strcmp(shader, "gouraud") && strcmp(shader, "textured") && strcmp(shader, "normalmap")) {
+		std::cerr << "unknown shader " << shader << ", expected flat, gouraud, textured or normalmap\n";
+		return 2;
+	}
+	if (shader && !strcmp(shader, "normalmap") && !normalmap_path) {
+		std::cerr << "--shader normalmap needs --normalmap\n";
+		return 2;
+	}
+	if (shader && (!strcmp(shader, "textured") || !strcmp(shader, "normalmap")) && !texture_path) {
+		std::cerr << "--shader " << shader << " needs --texture\n";
+		return 2;
+	}
+	if (strip<0) strip = (long long)width*height>STRIP_PIXELS ? STRIP_ROWS : 0;
+	// strips start on the tiles of the whole frame, see render_model_strips()
+	strip = (std::min(strip, height)+TiledRasterizer::TILE_SIZE-1)/TiledRasterizer::TILE_SIZE*TiledRasterizer::TILE_SIZE;
+	if (strip>=height) strip = 0;
+	if ((stats || trace) && !PROFILE_ENABLED) {
+		std::cerr << "built without profiling, rebuild with make PROFILE=1\n";
+		return 2;
 	}
+	Profile profile(trace!=NULL);
 
-	// Finally, draw it!
-	for(int x = x0; x <= x1; x++){
-		float t = (x-x0) / (float)(x1-x0);
-		int y = y0*(1.-t) + y1*t;
-		if(vertChart){
-			image.set(y, x, color);
+	std::unique_ptr<LodModel> model;
+	std::unique_ptr<TGAImage> texture;
+	bool loaded = true;
+	{
+		PROFILE_SCOPE(&profile, STAGE_LOAD);
+		model.reset(new LodModel(path));
+		if (!model->level(0).nfaces()) {
+			std::cerr << "can't load model " << path << "\n";
+			loaded = false;
+		} else if (texture_path) {
+			texture.reset(new TGAImage());
+			if (!texture->read_tga_file(texture_path)) {
+				std::cerr << "can't load texture " << texture_path << "\n";
+				loaded = false;
+			}
 		}
-		else{
-			image.set(x, y, color);
-		
+	}
+	if (!loaded) return 1;
+	
+	ThreadPool pool;
+	FrameBuffer frame(width, strip ? strip : height, &pool);
+	frame.set_shading(shading);
+	frame.set_shadows(shadows);
+	frame.set_zprepass(zprepass);
+	frame.set_samples(samples);
+	frame.set_profile(&profile);
+	Texture diffuse, normals;
+	if (texture) {
+		PROFILE_SCOPE(&profile, STAGE_LOAD);
+		diffuse.build(*texture);
+	}
+	if (normalmap_path) {
+		PROFILE_SCOPE(&profile, STAGE_LOAD);
+		TGAImage image;
+		if (!image.read_tga_file(normalmap_path)) {
+			std::cerr << "can't load normal map " << normalmap_path << "\n";
+			return 1;
 		}
+		normals.build(image);
+	}
+	Camera camera;
+	int level = model->select(camera, width, height, lod_pixels);
+	const MeshView &mesh = model->level(level).view();
+	if (shader && !strcmp(shader, "gouraud") && !has_normals(mesh)) {
+		std::cerr << path << " has no normals for gouraud shading\n";
+		return 2;
+	}
+	// i want to have the origin at the left bottom corner of the image;
+	// rows go out top down as soon as they are drawn
+	TGAWriter output;
+	// TGAWriter says what went wrong
+	if (!output.open("output.tga", width, height, TGAImage::RGB)) return 1;
+	if (!shader) {
+		if (texture && strip) render_model_strips(model->level(level), diffuse, camera, light, height, frame, output);
+		else if (texture) render_model(model->level(level), diffuse, camera, light, frame, &output);
+		else if (strip) render_untextured_strips(*model, camera, light, height, frame, output, lod_pixels);
+		else render_untextured(*model, camera, light, frame, &output, lod_pixels);
+	}
+	else if (!strcmp(shader, "flat")) draw_shaded(mesh, FlatShader(mesh, light, WHITE), camera, height, frame, output);
+	else if (!strcmp(shader, "gouraud")) draw_shaded(mesh, GouraudShader(mesh, light, WHITE), camera, height, frame, output);
+	else if (!strcmp(shader, "textured")) draw_shaded(mesh, TexturedShader(mesh, light, diffuse), camera, height, frame, output);
+	else draw_shaded(mesh, NormalMappedShader(mesh, light, diffuse, normals), camera, height, frame, output);
+	if (strip) std::cerr << "# strips: " << (height+strip-1)/strip << " of " << strip << " rows" << std::endl;
+	bool written;
+	{
+		PROFILE_SCOPE(&profile, STAGE_WRITE);
+		written = output.close();
+	}
+	std::cerr << "# lod: level " << level << ", f# " << model->level(level).nfaces()
+		<< ", error " << model->error(level) << std::endl;
+	const CullStats &cull = frame.assembler().stats();
+	if (cull.clusters) {
+		std::cerr << "# meshlets: " << cull.clusters << " tested, offscreen " << cull.cluster_offscreen
+			<< ", backface " << cull.cluster_backface << ", faces skipped " << cull.cluster_faces << std::endl;
+	}
+	std::cerr << "# cull: " << cull.submitted << " in, " << cull.emitted << " out"
+		<< ", offscreen " << cull.offscreen << ", backface " << cull.backface << ", degenerate " << cull.degenerate
+		<< ", empty box " << cull.empty_box << ", near clipped " << cull.near_clipped
+		<< ", guard clipped " << cull.guard_clipped << std::endl;
+	HiZStats hiz = frame.depth().stats();
+	std::cerr << "# hiz: tiles rejected " << hiz.tile_rejects << " (" << hiz.tile_pixels << " px)"
+		<< ", blocks rejected " << hiz.block_rejects << " (" << hiz.block_pixels << " px)"
+		<< ", fragments tested " << hiz.fragments_tested << ", failed " << hiz.fragments_failed << std::endl;
+	if (frame.msaa() && shading==FORWARD) {
+		std::cerr << "# msaa: " << samples << " samples, " << frame.msaa()->expanded_pixels()
+			<< " pixels expanded" << std::endl;
+	}
+	if (shading==DEFERRED) {
+		unsigned long long drawn = hiz.fragments_tested-hiz.fragments_failed;
+		unsigned long long shaded = frame.raster().visible_pixels();
+		std::cerr << "# overdraw: " << drawn << " fragments drawn, " << shaded << " shaded, ratio "
+			<< (shaded ? (double)drawn/shaded : 0.) << std::endl;
+	}
+
+	if (stats) {
+		std::ofstream out(stats);
+		profile.write_json(out, "output.tga");
+		if (!out) std::cerr << "can't write " << stats << "\n";
+	}
+	if (trace) {
+		std::ofstream out(trace);
+		begin_trace(out);
+		profile.write_trace_events(out, "output.tga");
+		end_trace(out);
+		if (!out) std::cerr << "can't write " << trace << "\n";
 	}
 
+	return written ? 0 : 1;
 }
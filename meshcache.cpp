@@ -0,0 +1,221 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "meshcache.h"
+#include "threadpool.h"
+
+namespace {
+
+const char MAGIC[8] = {'T','R','M','E','S','H',0,0};
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+const uint64_t ALIGN = 64;
+const uint64_t FNV_OFFSET = 14695981039346656037ull;
+const uint64_t FNV_PRIME = 1099511628211ull;
+const size_t CHECKSUM_BLOCK = 1<<20;
+const int BLOCKS = 15;
+
+uint64_t align_up(uint64_t v) {
+	return (v+ALIGN-1) & ~(ALIGN-1);
+}
+
+// bytes of every array of a mesh with the counts of h, in the order of its offsets
+void block_sizes(const MeshCacheHeader &h, uint64_t *sizes) {
+	bool welded = h.flags & MESH_CACHE_WELDED;
+	uint64_t s[BLOCKS] = {
+		h.nverts*4ull, h.nverts*4ull, h.nverts*4ull, h.ntex*4ull, h.ntex*4ull,
+		h.nnorm*4ull, h.nnorm*4ull, h.nnorm*4ull,
+		h.nfaces*12ull, welded ? 0 : h.nfaces*12ull, welded ? 0 : h.nfaces*12ull,
+		h.nmeshlets*(uint64_t)sizeof(Meshlet), h.nfaces*4ull, h.ncluster_verts*4ull, h.nfaces*3ull
+	};
+	memcpy(sizes, s, sizeof(s));
+}
+
+int64_t mtime_ns(const struct stat &st) {
+	return (int64_t)st.st_mtim.tv_sec*1000000000 + st.st_mtim.tv_nsec;
+}
+
+// FNV-1a on 8-byte words, the bytes of the tail one by one
+uint64_t hash_block(const unsigned char *p, size_t n) {
+	uint64_t h = FNV_OFFSET;
+	size_t i = 0;
+	for (; i+8<=n; i+=8) {
+		uint64_t w;
+		memcpy(&w, p+i, 8);
+		h = (h^w)*FNV_PRIME;
+	}
+	for (; i<n; i++) h = (h^p[i])*FNV_PRIME;
+	return h;
+}
+
+} // namespace
+
+std::string mesh_cache_path(const char *source) {
+	return std::string(source) + ".mcache";
+}
+
+bool file_checksum(const char *path, uint64_t &sum) {
+	int fd = open(path, O_RDONLY);
+	if (fd<0) return false;
+	struct stat st;
+	if (fstat(fd, &st)<0) {
+		close(fd);
+		return false;
+	}
+	size_t size = st.st_size;
+	sum = FNV_OFFSET;
+	if (!size) {
+		close(fd);
+		return true;
+	}
+	void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map==MAP_FAILED) return false;
+	madvise(map, size, MADV_SEQUENTIAL);
+	// fixed size blocks hashed in parallel, then the block hashes in order
+	std::vector<uint64_t> blocks((size+CHECKSUM_BLOCK-1)/CHECKSUM_BLOCK);
+	ThreadPool pool;
+	pool.parallel_for((int)blocks.size(), [&](int i) {
+		size_t begin = i*CHECKSUM_BLOCK;
+		blocks[i] = hash_block((const unsigned char *)map+begin, std::min(CHECKSUM_BLOCK, size-begin));
+	});
+	munmap(map, size);
+	for (size_t i=0; i<blocks.size(); i++) sum = (sum^blocks[i])*FNV_PRIME;
+	return true;
+}
+
+bool write_mesh_cache(const char *path, const MeshView &mesh, const char *source, float lod_error) {
+	struct stat st;
+	if (stat(source, &st)<0) return false;
+	MeshCacheHeader header;
+	memset((void *)&header, 0, sizeof(header));
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = MESH_CACHE_VERSION;
+	header.byte_order = BYTE_ORDER_MARK;
+	header.src_size = st.st_size;
+	header.src_mtime = mtime_ns(st);
+	if (!file_checksum(source, header.src_checksum)) return false;
+	header.nverts = mesh.nverts;
+	header.ntex = mesh.ntex;
+	header.nnorm = mesh.nnorm;
+	header.nfaces = mesh.nfaces;
+	header.lod_error = lod_error;
+	header.nmeshlets = mesh.nmeshlets;
+	header.ncluster_verts = mesh.ncluster_verts;
+	if (mesh.face_tex==mesh.faces && mesh.face_norm==mesh.faces) header.flags |= MESH_CACHE_WELDED;
+
+	const void *blocks[BLOCKS] = {
+		mesh.vx, mesh.vy, mesh.vz, mesh.tu, mesh.tv, mesh.nx, mesh.ny, mesh.nz,
+		mesh.faces, mesh.face_tex, mesh.face_norm,
+		mesh.meshlets, mesh.cluster_faces, mesh.cluster_verts, mesh.cluster_corners
+	};
+	uint64_t sizes[BLOCKS];
+	block_sizes(header, sizes);
+	uint64_t pos = align_up(sizeof(header));
+	for (int i=0; i<BLOCKS; i++) {
+		header.offset[i] = pos;
+		pos = align_up(pos+sizes[i]);
+	}
+	header.file_size = pos;
+
+	char tmp[32];
+	snprintf(tmp, sizeof(tmp), ".tmp%d", (int)getpid());
+	std::string tmp_path = std::string(path) + tmp;
+	std::ofstream out;
+	out.open(tmp_path.c_str(), std::ios::binary);
+	if (!out.is_open()) return false;
+	const char zeros[ALIGN] = {0};
+	out.write((const char *)&header, sizeof(header));
+	out.write(zeros, header.offset[0]-sizeof(header));
+	for (int i=0; i<BLOCKS; i++) {
+		out.write((const char *)blocks[i], sizes[i]);
+		uint64_t end = i<BLOCKS-1 ? header.offset[i+1] : header.file_size;
+		out.write(zeros, end-header.offset[i]-sizes[i]);
+	}
+	out.close();
+	if (!out.good() || rename(tmp_path.c_str(), path)<0) {
+		unlink(tmp_path.c_str());
+		std::cerr << "can't write mesh cache " << path << "\n";
+		return false;
+	}
+	return true;
+}
+
+bool read_mesh_cache_header(const char *path, MeshCacheHeader &header) {
+	std::ifstream in;
+	in.open(path, std::ios::binary);
+	if (!in.is_open()) return false;
+	in.read((char *)&header, sizeof(header));
+	return in.good() && !memcmp(header.magic, MAGIC, sizeof(MAGIC))
+		&& header.version==MESH_CACHE_VERSION && header.byte_order==BYTE_ORDER_MARK;
+}
+
+bool mesh_cache_fresh(const MeshCacheHeader &header, const char *source) {
+	struct stat st;
+	if (stat(source, &st)<0) return false;
+	return (uint64_t)st.st_size==header.src_size && mtime_ns(st)==header.src_mtime;
+}
+
+bool map_mesh_cache(const char *path, const char *source, MeshView &view, void *&map, size_t &size) {
+	int fd = open(path, O_RDONLY);
+	if (fd<0) return false;
+	struct stat st;
+	if (fstat(fd, &st)<0 || (size_t)st.st_size<sizeof(MeshCacheHeader)) {
+		close(fd);
+		return false;
+	}
+	size = st.st_size;
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map==MAP_FAILED) {
+		map = NULL;
+		return false;
+	}
+	const MeshCacheHeader &h = *(const MeshCacheHeader *)map;
+	bool ok = !memcmp(h.magic, MAGIC, sizeof(MAGIC)) && h.version==MESH_CACHE_VERSION
+		&& h.byte_order==BYTE_ORDER_MARK && h.file_size==size;
+	if (ok && source) ok = mesh_cache_fresh(h, source);
+	uint64_t sizes[BLOCKS];
+	block_sizes(h, sizes);
+	for (int i=0; ok && i<BLOCKS; i++)
+		ok = h.offset[i]%ALIGN==0 && h.offset[i]<=size && sizes[i]<=size-h.offset[i];
+	if (!ok) {
+		munmap(map, size);
+		map = NULL;
+		return false;
+	}
+	const char *base = (const char *)map;
+	view.vx = (const float *)(base+h.offset[0]);
+	view.vy = (const float *)(base+h.offset[1]);
+	view.vz = (const float *)(base+h.offset[2]);
+	view.tu = (const float *)(base+h.offset[3]);
+	view.tv = (const float *)(base+h.offset[4]);
+	view.nx = (const float *)(base+h.offset[5]);
+	view.ny = (const float *)(base+h.offset[6]);
+	view.nz = (const float *)(base+h.offset[7]);
+	view.faces     = (const uint32_t *)(base+h.offset[8]);
+	bool welded = h.flags & MESH_CACHE_WELDED;
+	view.face_tex  = welded ? view.faces : (const uint32_t *)(base+h.offset[9]);
+	view.face_norm = welded ? view.faces : (const uint32_t *)(base+h.offset[10]);
+	view.nverts = h.nverts;
+	view.ntex = h.ntex;
+	view.nnorm = h.nnorm;
+	view.nfaces = h.nfaces;
+	view.meshlets = (const Meshlet *)(base+h.offset[11]);
+	view.cluster_faces = (const uint32_t *)(base+h.offset[12]);
+	view.cluster_verts = (const uint32_t *)(base+h.offset[13]);
+	view.cluster_corners = (const uint8_t *)(base+h.offset[14]);
+	view.nmeshlets = h.nmeshlets;
+	view.ncluster_verts = h.ncluster_verts;
+	return true;
+}
+
+void unmap_mesh_cache(void *map, size_t size) {
+	munmap(map, size);
+}
@@ -0,0 +1,53 @@
+#ifndef __MESHCACHE_H__
+#define __MESHCACHE_H__
+
+#include <string>
+#include <stdint.h>
+#include "model.h"
+
+// Binary mesh cache. A versioned header followed by the arrays of a MeshView,
+// its meshlets included, each one 64-byte aligned, in native byte order. The
+// file is mapped read-only and shared, so loading costs page faults only and
+// every process rendering the same asset shares the same pages of the page
+// cache.
+//
+// A cache is fresh when the size and mtime of its source recorded in the
+// header still match the source file. The header also keeps a checksum of the
+// source contents, which objcache --check checks.
+
+struct MeshCacheHeader {
+	char magic[8];          // "TRMESH\0\0"
+	uint32_t version;
+	uint32_t byte_order;    // 0x01020304 as written by the producer
+	uint64_t file_size;
+	uint64_t src_size;
+	int64_t  src_mtime;     // nanoseconds
+	uint64_t src_checksum;
+	uint32_t nverts, ntex, nnorm, nfaces;
+	float lod_error;        // of a simplified level (see lod.h), 0 for the mesh itself
+	uint32_t nmeshlets, ncluster_verts;
+	uint32_t flags;
+	// vx vy vz tu tv nx ny nz faces face_tex face_norm
+	// meshlets cluster_faces cluster_verts cluster_corners
+	uint64_t offset[15];
+};
+
+const uint32_t MESH_CACHE_VERSION = 5;
+// the faces index all the attributes (see meshopt.h), face_tex and
+// face_norm are empty and map to the faces
+const uint32_t MESH_CACHE_WELDED = 1;
+
+// "foo.obj" -> "foo.obj.mcache"
+std::string mesh_cache_path(const char *source);
+// checksum of the contents of a file, false if it can't be read
+bool file_checksum(const char *path, uint64_t &sum);
+// writes to a temporary file and renames it, readers never see half a cache
+bool write_mesh_cache(const char *path, const MeshView &mesh, const char *source, float lod_error=0);
+// maps path and points view into it. With a source, refuses caches that are
+// not fresh for it; without one takes the cache as it is.
+bool map_mesh_cache(const char *path, const char *source, MeshView &view, void *&map, size_t &size);
+void unmap_mesh_cache(void *map, size_t size);
+bool read_mesh_cache_header(const char *path, MeshCacheHeader &header);
+bool mesh_cache_fresh(const MeshCacheHeader &header, const char *source);
+
+#endif //__MESHCACHE_H__
@@ -0,0 +1,216 @@
+#include <cmath>
+#include <limits>
+#include "meshlet.h"
+#include "meshopt.h"
+#include "model.h"
+#include "primitive.h"
+#include "renderer.h"
+
+namespace {
+
+// what a face costs against one new vertex, per unit of 1-cos of its angle
+// to the normals of the meshlet
+const float CONE_WEIGHT = 1.f;
+
+const uint32_t NONE = ~0u;
+
+Vec3f position(const MeshView &mesh, uint32_t v) {
+	return Vec3f(mesh.vx[v], mesh.vy[v], mesh.vz[v]);
+}
+
+// sphere and normal cone of the faces and vertices just added to out
+void set_bounds(const MeshView &mesh, const std::vector<Vec3f> &normals, MeshletSet &out, Meshlet &m) {
+	const uint32_t *verts = &out.verts[m.first_vert];
+	Vec3f lo = position(mesh, verts[0]), hi = lo;
+	for (uint32_t i=1; i<m.nverts; i++) {
+		Vec3f p = position(mesh, verts[i]);
+		lo = Vec3f(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+		hi = Vec3f(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+	}
+	m.center = (lo+hi)*.5f;
+	float r2 = 0;
+	for (uint32_t i=0; i<m.nverts; i++) {
+		Vec3f d = position(mesh, verts[i])-m.center;
+		r2 = std::max(r2, d*d);
+	}
+	m.radius = std::sqrt(r2);
+
+	Vec3f sum(0, 0, 0);
+	for (uint32_t i=0; i<m.nfaces; i++) sum = sum + normals[out.faces[m.first_face+i]];
+	float len = sum.norm();
+	m.axis = len>0 ? sum*(1.f/len) : Vec3f(0, 0, 1);
+	m.cutoff = 2;
+	m.apex = m.center;
+	if (len<=0) return;
+	float min_dot = 1;
+	for (uint32_t i=0; i<m.nfaces; i++) {
+		const Vec3f &n = normals[out.faces[m.first_face+i]];
+		// faces without area are dropped by assembly whichever way they face
+		if (n*n>0) min_dot = std::min(min_dot, n*m.axis);
+	}
+	if (min_dot<=0) return;
+	m.cutoff = std::sqrt(std::max(1-min_dot*min_dot, 0.f));
+	// far enough back along the axis to be behind every face: an eye that
+	// sees the apex from within the cone sees every face from behind
+	float t = 0;
+	for (uint32_t i=0; i<m.nfaces; i++) {
+		uint32_t f = out.faces[m.first_face+i];
+		const Vec3f &n = normals[f];
+		if (n*n>0) t = std::max(t, (m.center-position(mesh, mesh.faces[3*f]))*n/(n*m.axis));
+	}
+	m.apex = m.center-m.axis*t;
+}
+
+} // namespace
+
+void build_meshlets(const MeshView &mesh, MeshletSet &out) {
+	out = MeshletSet();
+	uint32_t nf = mesh.nfaces, nv = mesh.nverts;
+	if (!nf) return;
+
+	std::vector<Vec3f> normals(nf);
+	for (uint32_t f=0; f<nf; f++) {
+		const uint32_t *face = mesh.faces+3*f;
+		Vec3f p0 = position(mesh, face[0]), p1 = position(mesh, face[1]), p2 = position(mesh, face[2]);
+		Vec3f n = cross(p1-p0, p2-p0);
+		float len = n.norm();
+		normals[f] = len>0 ? n*(1.f/len) : Vec3f(0, 0, 0);
+	}
+
+	// faces around every position, across the seams of a welded mesh
+	std::vector<uint32_t> remap;
+	position_remap(mesh, remap);
+	std::vector<uint32_t> first(nv+1, 0), around(3*nf);
+	for (uint32_t k=0; k<3*nf; k++) first[remap[mesh.faces[k]]+1]++;
+	for (uint32_t v=0; v<nv; v++) first[v+1] += first[v];
+	std::vector<uint32_t> fill(first.begin(), first.end()-1);
+	for (uint32_t k=0; k<3*nf; k++) around[fill[remap[mesh.faces[k]]]++] = k/3;
+
+	std::vector<uint8_t> used(nf, 0);
+	std::vector<uint32_t> queued(nf, NONE); // the meshlet that has it among its candidates
+	std::vector<int> local(nv, -1);         // in the verts of the meshlet being built
+	std::vector<uint8_t> touched(nv, 0);    // in a finished meshlet
+	std::vector<uint32_t> candidates;
+	uint32_t scan = 0;
+	for (;;) {
+		// the next meshlet starts next to the last one, where the fewest
+		// vertices are still free, so the finished ones grow over the mesh
+		// as one front without leaving islands behind
+		uint32_t seed = NONE;
+		int seed_free = 4;
+		for (size_t i=0; i<candidates.size(); i++) {
+			uint32_t g = candidates[i];
+			if (used[g]) continue;
+			const uint32_t *gf = mesh.faces+3*g;
+			int free = 0;
+			for (int j=0; j<3; j++) free += !touched[gf[j]];
+			if (free<seed_free) {
+				seed_free = free;
+				seed = g;
+			}
+		}
+		if (seed==NONE) {
+			while (scan<nf && used[scan]) scan++;
+			if (scan==nf) break;
+			seed = scan;
+		}
+		uint32_t id = out.meshlets.size();
+		Meshlet m;
+		m.first_face = out.faces.size();
+		m.first_vert = out.verts.size();
+		m.nfaces = m.nverts = 0;
+		Vec3f normal_sum(0, 0, 0);
+		candidates.clear();
+		for (uint32_t f=seed; f!=NONE; ) {
+			used[f] = 1;
+			const uint32_t *face = mesh.faces+3*f;
+			for (int j=0; j<3; j++) {
+				uint32_t v = face[j];
+				if (local[v]<0) {
+					local[v] = m.nverts++;
+					out.verts.push_back(v);
+					for (uint32_t k=first[remap[v]]; k<first[remap[v]+1]; k++) {
+						uint32_t g = around[k];
+						if (!used[g] && queued[g]!=id) {
+							queued[g] = id;
+							candidates.push_back(g);
+						}
+					}
+				}
+				out.corners.push_back((uint8_t)local[v]);
+			}
+			out.faces.push_back(f);
+			m.nfaces++;
+			normal_sum = normal_sum + normals[f];
+			if (m.nfaces==(uint32_t)Meshlet::MAX_TRIS) break;
+
+			float len = normal_sum.norm();
+			Vec3f axis = len>0 ? normal_sum*(1.f/len) : Vec3f(0, 0, 0);
+			float best = std::numeric_limits<float>::max();
+			f = NONE;
+			size_t kept = 0;
+			for (size_t i=0; i<candidates.size(); i++) {
+				uint32_t g = candidates[i];
+				if (used[g]) continue;
+				candidates[kept++] = g;
+				const uint32_t *gf = mesh.faces+3*g;
+				int fresh = (local[gf[0]]<0) + (local[gf[1]]<0) + (local[gf[2]]<0);
+				// may still fit once its other vertices are in
+				if (m.nverts+fresh>(uint32_t)Meshlet::MAX_VERTS) continue;
+				float score = fresh + CONE_WEIGHT*(1-normals[g]*axis);
+				if (score<best) {
+					best = score;
+					f = g;
+				}
+			}
+			candidates.resize(kept);
+		}
+		for (uint32_t i=0; i<m.nverts; i++) {
+			local[out.verts[m.first_vert+i]] = -1;
+			touched[out.verts[m.first_vert+i]] = 1;
+		}
+		set_bounds(mesh, normals, out, m);
+		out.meshlets.push_back(m);
+	}
+}
+
+MeshletCuller::MeshletCuller(const Matrix &mvp, const Camera &camera, int width, int height)
+		: eye_(camera.eye), dir_(camera.center-camera.eye), perspective_(camera.perspective) {
+	dir_.normalize();
+	// the sides of PrimitiveAssembler: 0 <= x <= (width-1)*w, 0 <= y <= (height-1)*w
+	// and w >= NEAR_W in clip space, as planes in model space
+	const float xmax = width-1, ymax = height-1;
+	for (int k=0; k<4; k++) {
+		planes_[0][k] = mvp[0][k];
+		planes_[1][k] = xmax*mvp[3][k]-mvp[0][k];
+		planes_[2][k] = mvp[1][k];
+		planes_[3][k] = ymax*mvp[3][k]-mvp[1][k];
+		planes_[4][k] = mvp[3][k];
+	}
+	planes_[4][3] -= PrimitiveAssembler::NEAR_W;
+	for (int i=0; i<5; i++) {
+		float len = std::sqrt(planes_[i][0]*planes_[i][0] + planes_[i][1]*planes_[i][1] + planes_[i][2]*planes_[i][2]);
+		// an orthographic camera has no near plane, nothing is outside it
+		if (len<=0) {
+			planes_[i][3] = std::numeric_limits<float>::max();
+			continue;
+		}
+		for (int k=0; k<4; k++) planes_[i][k] /= len;
+	}
+}
+
+MeshletCuller::Result MeshletCuller::test(const Meshlet &m) const {
+	const Vec3f &c = m.center;
+	for (int i=0; i<5; i++)
+		if (planes_[i][0]*c.x + planes_[i][1]*c.y + planes_[i][2]*c.z + planes_[i][3] < -m.radius) return OFFSCREEN;
+	if (m.cutoff>1) return VISIBLE;
+	// every face faces away if the way from the eye to the apex is within 90
+	// degrees of every normal in the cone
+	if (perspective_) {
+		Vec3f d = m.apex-eye_;
+		if (d*m.axis >= d.norm()*m.cutoff) return BACKFACING;
+	} else if (dir_*m.axis >= m.cutoff) {
+		return BACKFACING;
+	}
+	return VISIBLE;
+}
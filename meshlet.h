@@ -0,0 +1,61 @@
+#ifndef __MESHLET_H__
+#define __MESHLET_H__
+
+#include <vector>
+#include <stdint.h>
+#include "geometry.h"
+
+struct Camera;
+struct MeshView;
+
+// A cluster of neighbouring faces of a mesh with bounds that let a camera
+// drop all of them with one test: a sphere around the cluster and a cone
+// around the outward normals of its faces. The corners index into a vertex
+// list of the meshlet's own, so a meshlet can be transformed and assembled
+// without looking at any other.
+struct Meshlet {
+	static const int MAX_VERTS = 64;
+	static const int MAX_TRIS = 124;
+
+	uint32_t first_face, nfaces; // in MeshletSet::faces, and three corners per face in MeshletSet::corners
+	uint32_t first_vert, nverts; // in MeshletSet::verts
+	Vec3f center;
+	float radius;
+	Vec3f axis;   // of the normal cone, unit length
+	float cutoff; // sine of the half angle of the cone, above 1 if it is too wide to face away as a whole
+	Vec3f apex;   // on the axis, behind the planes of all the faces
+};
+
+// the meshlets of a mesh, every face in exactly one of them
+struct MeshletSet {
+	std::vector<Meshlet> meshlets;
+	std::vector<uint32_t> faces;  // faces of the mesh, meshlet after meshlet
+	std::vector<uint32_t> verts;  // vertices of the mesh, the same
+	std::vector<uint8_t> corners; // three per face, into the verts of its meshlet
+};
+
+// Grows meshlets one face at a time: of the faces sharing a vertex with the
+// meshlet, the one that brings the fewest new vertices and bends least away
+// from its normals goes in next, until MAX_TRIS faces or MAX_VERTS vertices.
+// A meshlet starts next to the one before, so they cover the mesh like a
+// front and keep their normal cones narrow.
+void build_meshlets(const MeshView &mesh, MeshletSet &out);
+
+// Whole meshlet tests for one frame. Both only drop meshlets whose faces
+// primitive assembly would all drop as well: outside one side of the screen
+// or the near plane, or facing away from the eye.
+class MeshletCuller {
+public:
+	enum Result { VISIBLE, OFFSCREEN, BACKFACING };
+
+	// mvp is camera_matrix(camera, width, height)
+	MeshletCuller(const Matrix &mvp, const Camera &camera, int width, int height);
+	Result test(const Meshlet &m) const;
+
+private:
+	float planes_[5][4]; // inside where a*x+b*y+c*z+d >= 0, a, b, c of unit length
+	Vec3f eye_, dir_;    // dir_ from the eye to the center, unit length
+	bool perspective_;
+};
+
+#endif //__MESHLET_H__
@@ -0,0 +1,179 @@
+#include <cstring>
+#include "meshopt.h"
+#include "model.h"
+
+namespace {
+
+const uint32_t NONE = ~0u;
+
+// a[i] = a[from[i]] for every i of from
+void gather(std::vector<float> &a, const std::vector<uint32_t> &from) {
+	std::vector<float> out(from.size());
+	for (size_t i=0; i<from.size(); i++) out[i] = a[from[i]];
+	a.swap(out);
+}
+
+uint32_t float_bits(float f) {
+	uint32_t u;
+	memcpy(&u, &f, sizeof(u));
+	return u;
+}
+
+} // namespace
+
+void weld_vertices(ObjMesh &mesh) {
+	size_t ncorners = mesh.faces.size();
+	if (!ncorners || mesh.face_tex.empty()) return;
+	// the vertices made so far for every position, as lists
+	std::vector<uint32_t> head(mesh.vx.size(), NONE), next;
+	std::vector<uint32_t> pos, tex, norm;
+	pos.reserve(mesh.vx.size()); tex.reserve(mesh.vx.size()); norm.reserve(mesh.vx.size());
+	for (size_t k=0; k<ncorners; k++) {
+		uint32_t v = mesh.faces[k], t = mesh.face_tex[k], n = mesh.face_norm[k];
+		uint32_t u = head[v];
+		while (u!=NONE && (tex[u]!=t || norm[u]!=n)) u = next[u];
+		if (u==NONE) {
+			u = pos.size();
+			pos.push_back(v); tex.push_back(t); norm.push_back(n);
+			next.push_back(head[v]);
+			head[v] = u;
+		}
+		mesh.faces[k] = u;
+	}
+	gather(mesh.vx, pos); gather(mesh.vy, pos); gather(mesh.vz, pos);
+	gather(mesh.tu, tex); gather(mesh.tv, tex);
+	gather(mesh.nx, norm); gather(mesh.ny, norm); gather(mesh.nz, norm);
+	std::vector<uint32_t>().swap(mesh.face_tex);
+	std::vector<uint32_t>().swap(mesh.face_norm);
+}
+
+void optimize_vertex_cache(uint32_t *faces, uint32_t nfaces, uint32_t nverts, int cache) {
+	if (!nfaces) return;
+	// faces around every vertex, and how many of them are still to go
+	std::vector<uint32_t> first(nverts+1, 0), around(3*nfaces);
+	for (uint32_t k=0; k<3*nfaces; k++) first[faces[k]+1]++;
+	for (uint32_t v=0; v<nverts; v++) first[v+1] += first[v];
+	std::vector<uint32_t> fill(first.begin(), first.end()-1);
+	for (uint32_t k=0; k<3*nfaces; k++) around[fill[faces[k]]++] = k/3;
+	std::vector<uint32_t> live(nverts);
+	for (uint32_t v=0; v<nverts; v++) live[v] = first[v+1]-first[v];
+
+	// a vertex is in the cache while time-stamp <= cache
+	std::vector<uint32_t> stamp(nverts, 0);
+	uint32_t time = cache+1;
+	std::vector<uint8_t> emitted(nfaces, 0);
+	std::vector<uint32_t> out, recent, candidates;
+	out.reserve(3*nfaces);
+	uint32_t cursor = 0;
+	uint32_t fan = faces[0];
+	while (fan!=NONE) {
+		candidates.clear();
+		for (uint32_t i=first[fan]; i<first[fan+1]; i++) {
+			uint32_t f = around[i];
+			if (emitted[f]) continue;
+			emitted[f] = 1;
+			for (int j=0; j<3; j++) {
+				uint32_t v = faces[3*f+j];
+				out.push_back(v);
+				recent.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if (time-stamp[v]>(uint32_t)cache) stamp[v] = time++;
+			}
+		}
+		// the oldest vertex that is still cached after its own faces went
+		// out; the ones that would drop out before are worth as little as
+		// the ones not cached at all
+		fan = NONE;
+		int best = -1;
+		for (size_t i=0; i<candidates.size(); i++) {
+			uint32_t v = candidates[i];
+			if (!live[v]) continue;
+			int age = time-stamp[v];
+			int score = age+2*(int)live[v]<=cache ? age : 0;
+			if (score>best) {
+				best = score;
+				fan = v;
+			}
+		}
+		// dead end: back to the last vertex with faces left, else on in order
+		while (fan==NONE && !recent.empty()) {
+			if (live[recent.back()]) fan = recent.back();
+			recent.pop_back();
+		}
+		while (fan==NONE && cursor<nverts) {
+			if (live[cursor]) fan = cursor;
+			else cursor++;
+		}
+	}
+	memcpy(faces, out.data(), out.size()*sizeof(uint32_t));
+}
+
+float acmr(const uint32_t *faces, uint32_t nfaces, uint32_t nverts, int cache) {
+	if (!nfaces) return 0;
+	std::vector<uint32_t> stamp(nverts, 0);
+	uint32_t time = cache+1;
+	size_t misses = 0;
+	for (size_t k=0; k<3*(size_t)nfaces; k++) {
+		uint32_t v = faces[k];
+		if (time-stamp[v]>(uint32_t)cache) {
+			stamp[v] = time++;
+			misses++;
+		}
+	}
+	return misses/(float)nfaces;
+}
+
+void optimize_vertex_fetch(ObjMesh &mesh) {
+	std::vector<uint32_t> remap(mesh.vx.size(), NONE), order;
+	order.reserve(mesh.vx.size());
+	for (size_t k=0; k<mesh.faces.size(); k++) {
+		uint32_t &v = mesh.faces[k];
+		if (remap[v]==NONE) {
+			remap[v] = order.size();
+			order.push_back(v);
+		}
+		v = remap[v];
+	}
+	gather(mesh.vx, order); gather(mesh.vy, order); gather(mesh.vz, order);
+	gather(mesh.tu, order); gather(mesh.tv, order);
+	gather(mesh.nx, order); gather(mesh.ny, order); gather(mesh.nz, order);
+}
+
+void optimize_mesh(ObjMesh &mesh, float *before, float *after) {
+	weld_vertices(mesh);
+	uint32_t nfaces = mesh.faces.size()/3, nverts = mesh.vx.size();
+	if (before) *before = acmr(mesh.faces.data(), nfaces, nverts);
+	if (!nfaces) {
+		if (after) *after = 0;
+		return;
+	}
+	optimize_vertex_cache(mesh.faces.data(), nfaces, nverts);
+	optimize_vertex_fetch(mesh);
+	if (after) *after = acmr(mesh.faces.data(), nfaces, nverts);
+}
+
+void position_remap(const MeshView &mesh, std::vector<uint32_t> &remap) {
+	uint32_t nv = mesh.nverts;
+	remap.resize(nv);
+	// open addressing on the bits of the positions
+	size_t size = 1;
+	while (size<2*(size_t)nv) size *= 2;
+	std::vector<uint32_t> table(size, NONE);
+	for (uint32_t v=0; v<nv; v++) {
+		uint32_t x = float_bits(mesh.vx[v]), y = float_bits(mesh.vy[v]), z = float_bits(mesh.vz[v]);
+		size_t i = ((x*73856093u) ^ (y*19349663u) ^ (z*83492791u)) & (size-1);
+		for (;;) {
+			uint32_t u = table[i];
+			if (u==NONE) {
+				table[i] = remap[v] = v;
+				break;
+			}
+			if (float_bits(mesh.vx[u])==x && float_bits(mesh.vy[u])==y && float_bits(mesh.vz[u])==z) {
+				remap[v] = u;
+				break;
+			}
+			i = (i+1) & (size-1);
+		}
+	}
+}
@@ -0,0 +1,42 @@
+#ifndef __MESHOPT_H__
+#define __MESHOPT_H__
+
+#include <vector>
+#include <stdint.h>
+#include "objloader.h"
+
+struct MeshView;
+
+// vertices in the FIFO post-transform cache the face orders are made for and
+// measured with
+const int VERTEX_CACHE = 16;
+
+// Turns every distinct (v, vt, vn) corner of the faces into one vertex that
+// has all three, so the faces become a single index buffer: afterwards faces
+// indexes vx.., tu.. and nx.. alike and face_tex and face_norm are empty.
+// Attributes no face uses are dropped. A welded mesh is left as it is.
+void weld_vertices(ObjMesh &mesh);
+
+// Tipsify (Sander, Nehab and Barczak 2007): emits the faces as fans around
+// one vertex at a time, next around the vertex of the last fan that stays in
+// the cache longest once its own faces are out, else the most recent one with
+// faces left. Linear in the faces. faces has three indices per face into
+// nverts vertices.
+void optimize_vertex_cache(uint32_t *faces, uint32_t nfaces, uint32_t nverts, int cache=VERTEX_CACHE);
+
+// Average cache miss ratio: vertices a FIFO cache of that many misses per
+// face. 3 at worst, about 0.5 at best on a big regular mesh.
+float acmr(const uint32_t *faces, uint32_t nfaces, uint32_t nverts, int cache=VERTEX_CACHE);
+
+// numbers the vertices of a welded mesh in the order the faces first use them
+void optimize_vertex_fetch(ObjMesh &mesh);
+
+// all three of the above; the acmr of the welded faces in file order and in
+// the new order if asked for
+void optimize_mesh(ObjMesh &mesh, float *before=NULL, float *after=NULL);
+
+// for every vertex the first one with the very same position, which sees
+// through the seams welding leaves between the vertices of one position
+void position_remap(const MeshView &mesh, std::vector<uint32_t> &remap);
+
+#endif //__MESHOPT_H__
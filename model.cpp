@@ -1,72 +1,97 @@
 #include <iostream>
 #include <string>
-#include <fstream>
-#include <sstream>
 #include <vector>
+#include <utility>
 #include "model.h"
+#include "meshcache.h"
+#include "meshopt.h"
 
-Model::Model(const char *filename) : verts_(), faces_(), face_tex_(), texCoords_() {
-    std::ifstream in;
-    in.open (filename, std::ifstream::in);
-    if (in.fail()) return;
-    std::string line;
-    while (!in.eof()) {
-        std::getline(in, line);
-        std::istringstream iss(line.c_str());
-        char trash;
-        if (!line.compare(0, 2, "v ")) {
-            iss >> trash;
-            Vec3f v;
-            for (int i=0;i<3;i++) iss >> v[i];
-            verts_.push_back(v);
-        } else if (!line.compare(0, 2, "f ")) {
-            std::vector<int> f;
-		std::vector<int> t;
-            int itrash, idx, tex_idx;
-            iss >> trash;
-            while (iss >> idx >> trash >> tex_idx >> trash >> itrash) {
-                idx--; tex_idx--; // in wavefront obj all indices start at 1, not zero
-                f.push_back(idx);
-		t.push_back(tex_idx);
-            }
-            faces_.push_back(f);
-		face_tex_.push_back(t);
-        }
-	else if(!line.compare(0,3, "vt ")){
-		Vec2f coords;
-		iss >> trash >> trash;
-		for(int i=0;i<2;i++) iss >> coords[i];
-		texCoords_.push_back(coords);
-	}
+Model::Model(const char *filename, bool cache) : mesh_(), map_(NULL), map_size_(0), meshlets_() {
+    set_view();
+    std::string path = filename;
+    bool is_cache = path.size()>7 && !path.compare(path.size()-7, 7, ".mcache");
+    std::string cache_path = is_cache ? path : mesh_cache_path(filename);
+    if ((cache || is_cache) && map_mesh_cache(cache_path.c_str(), is_cache ? NULL : filename, view_, map_, map_size_)) {
+        std::cerr << "# v# " << nverts() << " f# "  << nfaces() << " (cached)" << std::endl;
+        return;
     }
-    std::cerr << "# v# " << verts_.size() << " f# "  << faces_.size() << std::endl;
+    if (is_cache) return;
+    if (!load_obj(filename, mesh_)) return;
+    float before, after;
+    optimize_mesh(mesh_, &before, &after);
+    set_view();
+    build_meshlets(view_, meshlets_);
+    set_view();
+    // best effort, a read-only asset directory just means no cache
+    if (cache) write_mesh_cache(cache_path.c_str(), view_, filename);
+    std::cerr << "# v# " << nverts() << " f# "  << nfaces() << " acmr " << before << " -> " << after << std::endl;
+}
+
+Model::Model(const char *cache_path, const char *source) : mesh_(), map_(NULL), map_size_(0), meshlets_() {
+    set_view();
+    map_mesh_cache(cache_path, source, view_, map_, map_size_);
+}
+
+Model::Model(ObjMesh &mesh) : mesh_(), map_(NULL), map_size_(0), meshlets_() {
+    std::swap(mesh_, mesh);
+    optimize_mesh(mesh_);
+    set_view();
+    build_meshlets(view_, meshlets_);
+    set_view();
 }
 
 Model::~Model() {
+    if (map_) unmap_mesh_cache(map_, map_size_);
+}
+
+void Model::set_view() {
+    view_.vx = mesh_.vx.data(); view_.vy = mesh_.vy.data(); view_.vz = mesh_.vz.data();
+    view_.tu = mesh_.tu.data(); view_.tv = mesh_.tv.data();
+    view_.nx = mesh_.nx.data(); view_.ny = mesh_.ny.data(); view_.nz = mesh_.nz.data();
+    view_.faces = mesh_.faces.data();
+    // welded, faces index the texture coordinates and normals as well
+    view_.face_tex = mesh_.face_tex.empty() ? view_.faces : mesh_.face_tex.data();
+    view_.face_norm = mesh_.face_norm.empty() ? view_.faces : mesh_.face_norm.data();
+    view_.nverts = mesh_.vx.size();
+    view_.ntex = mesh_.tu.size();
+    view_.nnorm = mesh_.nx.size();
+    view_.nfaces = mesh_.faces.size()/3;
+    view_.meshlets = meshlets_.meshlets.data();
+    view_.cluster_faces = meshlets_.faces.data();
+    view_.cluster_verts = meshlets_.verts.data();
+    view_.cluster_corners = meshlets_.corners.data();
+    view_.nmeshlets = meshlets_.meshlets.size();
+    view_.ncluster_verts = meshlets_.verts.size();
 }
 
 int Model::nverts() {
-    return (int)verts_.size();
+    return (int)view_.nverts;
 }
 
 int Model::nfaces() {
-    return (int)faces_.size();
+    return (int)view_.nfaces;
+}
+
+int Model::ntexCoords() {
+	return (int)view_.ntex;
+}
+
+int Model::nnormals() {
+	return (int)view_.nnorm;
 }
 
 std::vector<int> Model::face(int idx) {
-    return faces_[idx];
+    return std::vector<int>(view_.faces+idx*3, view_.faces+idx*3+3);
 }
 
 std::vector<int> Model::face_tex(int idx) {
-	return face_tex_[idx];
+	return std::vector<int>(view_.face_tex+idx*3, view_.face_tex+idx*3+3);
 }
 
 Vec3f Model::vert(int i) {
-    return verts_[i];
+    return Vec3f(view_.vx[i], view_.vy[i], view_.vz[i]);
 }
 
 Vec2f Model::texCoord(int i) {
-	return texCoords_[i];
+	return Vec2f(view_.tu[i], view_.tv[i]);
 }
-
-
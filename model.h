@@ -2,23 +2,80 @@
 #define __MODEL_H__
 
 #include <vector>
+#include <stdint.h>
 #include "geometry.h"
+#include "objloader.h"
+#include "meshlet.h"
 
+// Where the arrays of a mesh are, whoever owns them. The meshlets are laid
+// out like in a MeshletSet (see meshlet.h).
+struct MeshView {
+	const float *vx, *vy, *vz;
+	const float *tu, *tv;
+	const float *nx, *ny, *nz;
+	const uint32_t *faces, *face_tex, *face_norm;
+	uint32_t nverts, ntex, nnorm, nfaces;
+	const Meshlet *meshlets;
+	const uint32_t *cluster_faces, *cluster_verts;
+	const uint8_t *cluster_corners; // three per face
+	uint32_t nmeshlets, ncluster_verts;
+};
+
+// Triangle mesh in flat arrays: positions and texture coordinates are stored
+// as structure of arrays, faces as packed triplets of indices (polygons are
+// split into fans at load time). The raw accessors hand out the arrays
+// themselves, so a render loop can walk the mesh without copying anything.
+//
+// The arrays either come from parsing the obj or straight from a memory mapped
+// binary cache (see meshcache.h) that is written next to it after a parse.
+// After the parse the corners are welded into vertices that carry all their
+// attributes and the faces and vertices reordered for the vertex cache (see
+// meshopt.h), so face_tex and face_norm are the faces themselves. The faces
+// are then clustered into meshlets (see meshlet.h), and the cache keeps those
+// too.
 class Model {
 private:
-	std::vector<Vec3f> verts_;
-	std::vector<std::vector<int> > faces_;
-	std::vector<std::vector<int> > face_tex_;
-	std::vector<Vec2f> texCoords_;
+	ObjMesh mesh_;    // parsed arrays, empty when mapped
+	void *map_;       // mapped cache, or NULL
+	size_t map_size_;
+	MeshView view_;
+	MeshletSet meshlets_; // built after a parse, empty when mapped
+
+	Model(const Model &);
+	Model & operator =(const Model &);
+	void set_view();
 public:
-	Model(const char *filename);
+	// cache: use filename.mcache if it is fresh, write it otherwise.
+	// A .mcache file can also be given directly.
+	Model(const char *filename, bool cache=true);
+	// maps cache_path only if it is a fresh cache of source, stays empty otherwise
+	Model(const char *cache_path, const char *source);
+	// takes over the arrays of an already built mesh, leaving it empty
+	explicit Model(ObjMesh &mesh);
 	~Model();
 	int nverts();
 	int nfaces();
+	int ntexCoords();
+	int nnormals();
 	Vec3f vert(int i);
 	Vec2f texCoord(int i);
+	// compatibility, these copy
 	std::vector<int> face(int idx);
 	std::vector<int> face_tex(int idx);
+
+	const MeshView &view() const { return view_; }
+	bool mapped() const { return map_!=NULL; }
+	const float *pos_x() const { return view_.vx; }
+	const float *pos_y() const { return view_.vy; }
+	const float *pos_z() const { return view_.vz; }
+	const float *uv_u() const { return view_.tu; }
+	const float *uv_v() const { return view_.tv; }
+	const float *norm_x() const { return view_.nx; }
+	const float *norm_y() const { return view_.ny; }
+	const float *norm_z() const { return view_.nz; }
+	const uint32_t *face_verts() const { return view_.faces; }
+	const uint32_t *face_uvs() const { return view_.face_tex; }
+	const uint32_t *face_normals() const { return view_.face_norm; }
 };
 
 #endif //__MODEL_H__
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <limits>
+#include "msaa.h"
+
+namespace {
+
+// the standard patterns of D3D, in 1/16 of a pixel from the center
+const int PATTERN2[] = { 4,4, -4,-4 };
+const int PATTERN4[] = { -2,-6, 6,-2, -6,2, 2,6 };
+const int PATTERN8[] = { 1,-3, -1,3, 5,1, -3,-5, -5,5, -7,-1, 3,7, 7,-7 };
+
+} // namespace
+
+MsaaBuffer::MsaaBuffer(int width, int height, int samples) : width_(width), height_(height), samples_(samples), clear_(0),
+		z_((size_t)width*height), dzdx_((size_t)width*height), dzdy_((size_t)width*height), color_((size_t)width*height), slot_((size_t)width*height, -1),
+		tiles_(((width+TILE-1)/TILE)*((height+TILE-1)/TILE)) {
+	const int *pattern = samples==2 ? PATTERN2 : samples==4 ? PATTERN4 : PATTERN8;
+	if (!supported(samples)) samples_ = 8;
+	for (int i=0; i<2*samples_; i++) offsets_[i] = pattern[i]/16.f;
+	for (size_t t=0; t<tiles_.size(); t++) tiles_[t].expanded = 0;
+}
+
+void MsaaBuffer::clear_tile(int t, int x0, int y0, int x1, int y1) {
+	for (int y=y0; y<=y1; y++) {
+		size_t i = x0 + (size_t)y*width_;
+		std::fill_n(&z_[i], x1-x0+1, -std::numeric_limits<float>::max());
+		std::fill_n(&dzdx_[i], x1-x0+1, 0.f);
+		std::fill_n(&dzdy_[i], x1-x0+1, 0.f);
+		std::fill_n(&color_[i], x1-x0+1, clear_);
+		std::fill_n(&slot_[i], x1-x0+1, -1);
+	}
+	tiles_[t].z.clear();
+	tiles_[t].color.clear();
+}
+
+void MsaaBuffer::store(int t, int x, int y, unsigned mask, const float *z, float center, float dzdx, float dzdy,
+		uint32_t color) {
+	size_t i = x + (size_t)y*width_;
+	if (mask==(1u<<samples_)-1) {
+		z_[i] = center;
+		dzdx_[i] = dzdx;
+		dzdy_[i] = dzdy;
+		color_[i] = color;
+		slot_[i] = -1;
+		return;
+	}
+	Tile &tile = tiles_[t];
+	if (slot_[i]<0) {
+		slot_[i] = (int)(tile.z.size()/samples_);
+		for (int s=0; s<samples_; s++) tile.z.push_back(sample_depth(i, s));
+		tile.color.insert(tile.color.end(), samples_, color_[i]);
+	}
+	float *zs = &tile.z[slot_[i]*samples_];
+	uint32_t *cs = &tile.color[slot_[i]*samples_];
+	for (int s=0; s<samples_; s++) {
+		if (!(mask>>s & 1)) continue;
+		zs[s] = z[s];
+		cs[s] = color;
+	}
+}
+
+void MsaaBuffer::resolve_tile(int t, int x0, int y0, int x1, int y1, RenderTarget &target) {
+	uint32_t *pixels = target.touch(x0, y0, x1, y1);
+	int w = target.get_width(), expanded = 0;
+	const uint32_t *colors = tiles_[t].color.empty() ? NULL : &tiles_[t].color[0];
+	for (int y=y0; y<=y1; y++) {
+		for (int x=x0; x<=x1; x++) {
+			size_t i = x + (size_t)y*width_;
+			if (slot_[i]<0) {
+				pixels[x + (size_t)y*w] = color_[i];
+				continue;
+			}
+			expanded++;
+			const uint32_t *cs = colors + slot_[i]*samples_;
+			// per channel sums, rounded
+			uint32_t sum[4] = { 0, 0, 0, 0 };
+			for (int s=0; s<samples_; s++)
+				for (int c=0; c<4; c++) sum[c] += cs[s]>>(8*c) & 0xff;
+			uint32_t out = 0;
+			for (int c=0; c<4; c++) out |= (sum[c]+samples_/2)/samples_ << (8*c);
+			pixels[x + (size_t)y*w] = out;
+		}
+	}
+	tiles_[t].expanded = expanded;
+}
+
+unsigned long long MsaaBuffer::expanded_pixels() const {
+	unsigned long long n = 0;
+	for (size_t t=0; t<tiles_.size(); t++) n += tiles_[t].expanded;
+	return n;
+}
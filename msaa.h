@@ -0,0 +1,95 @@
+#ifndef __MSAA_H__
+#define __MSAA_H__
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+#include "rendertarget.h"
+
+// Depth and colour of a multisampled frame, stored compactly. A pixel starts
+// out compact, one depth plane and one colour for all its samples, and stays that
+// way as long as every triangle drawn over it covers all of them. The first
+// one that covers only some gets the pixel expanded: a slot of one depth and
+// one colour per sample in the store of its 64x64 tile. A triangle that
+// covers a whole expanded pixel again makes it compact again; the slot is
+// only given back when the tile is cleared. Only pixels on edges ever pay for
+// their samples.
+//
+// Tiles are the ones of TiledRasterizer and everything of a tile is only
+// touched by the thread drawing it: clear_tile(), the triangles, then
+// resolve_tile() into the colour target.
+class MsaaBuffer {
+public:
+	static const int TILE = RenderTarget::TILE;
+	static const int MAX_SAMPLES = 8;
+
+	// samples is 2, 4 or 8
+	MsaaBuffer(int width, int height, int samples);
+	int get_width() const { return width_; }
+	int get_height() const { return height_; }
+	int samples() const { return samples_; }
+	// x, y of every sample from the pixel center, in pixels
+	const float *offsets() const { return offsets_; }
+	// valid sample counts
+	static bool supported(int samples) { return samples==2 || samples==4 || samples==8; }
+
+	// the colour clear_tile() fills in
+	void clear(uint32_t color) { clear_ = color; }
+	void clear_tile(int t, int x0, int y0, int x1, int y1);
+	// false if pixel x, y is expanded, the nearest depth of its samples in z
+	// if not
+	bool compact_depth(int x, int y, float &z) const {
+		size_t i = x + (size_t)y*width_;
+		if (slot_[i]>=0) return false;
+		z = sample_depth(i, 0);
+		for (int s=1; s<samples_; s++) z = std::max(z, sample_depth(i, s));
+		return true;
+	}
+	// the samples of mask at pixel x, y whose stored depth is <= z[sample]
+	unsigned test(int t, int x, int y, const float *z, unsigned mask) const {
+		size_t i = x + (size_t)y*width_;
+		int slot = slot_[i];
+		if (slot<0) {
+			unsigned pass = 0;
+			for (int s=0; s<samples_; s++)
+				if (sample_depth(i, s)<=z[s]) pass |= 1u<<s;
+			return pass & mask;
+		}
+		const float *zs = &tiles_[t].z[slot*samples_];
+		unsigned pass = 0;
+		for (int s=0; s<samples_; s++)
+			if (zs[s]<=z[s]) pass |= 1u<<s;
+		return pass & mask;
+	}
+	// writes color and the depths of the samples in mask; when mask is all of
+	// them the pixel goes compact with the plane of depth center at the pixel
+	// center and slopes dzdx, dzdy
+	void store(int t, int x, int y, unsigned mask, const float *z, float center, float dzdx, float dzdy, uint32_t color);
+	// averages the samples of the tile into target
+	void resolve_tile(int t, int x0, int y0, int x1, int y1, RenderTarget &target);
+	// pixels expanded at their last resolve, over all tiles
+	unsigned long long expanded_pixels() const;
+
+private:
+	MsaaBuffer(const MsaaBuffer &);
+	MsaaBuffer & operator =(const MsaaBuffer &);
+
+	// depth of sample s of compact pixel i
+	float sample_depth(size_t i, int s) const { return z_[i] + dzdx_[i]*offsets_[2*s] + dzdy_[i]*offsets_[2*s+1]; }
+
+	struct Tile {
+		std::vector<float> z;
+		std::vector<uint32_t> color;
+		int expanded;
+	};
+
+	int width_, height_, samples_;
+	float offsets_[2*MAX_SAMPLES];
+	uint32_t clear_;
+	std::vector<float> z_, dzdx_, dzdy_; // depth plane of a compact pixel
+	std::vector<uint32_t> color_;
+	std::vector<int> slot_; // per pixel, -1 while it is compact
+	std::vector<Tile> tiles_;
+};
+
+#endif //__MSAA_H__
@@ -0,0 +1,291 @@
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "objloader.h"
+#include "threadpool.h"
+
+namespace {
+
+const uint32_t MISSING = 0xFFFFFFFFu;
+
+enum LineKind { LINE_OTHER, LINE_V, LINE_VT, LINE_VN, LINE_F };
+
+struct Chunk {
+	const char *begin, *end;
+	size_t v, vt, vn, tris;  // pass 1: record counts, pass 2: where to write
+	bool no_vt, no_vn, bad;
+};
+
+inline bool is_space(char c) {
+	return c==' ' || c=='\t' || c=='\r';
+}
+
+inline bool is_digit(char c) {
+	return c>='0' && c<='9';
+}
+
+inline const char *skip_space(const char *p, const char *end) {
+	while (p<end && is_space(*p)) p++;
+	return p;
+}
+
+inline const char *line_end(const char *p, const char *end) {
+	const char *nl = (const char *)memchr(p, '\n', end-p);
+	return nl ? nl : end;
+}
+
+// a face ends where a trailing comment starts
+inline const char *face_end(const char *p, const char *eol) {
+	const char *hash = (const char *)memchr(p, '#', eol-p);
+	return hash ? hash : eol;
+}
+
+LineKind line_kind(const char *p, const char *end) {
+	if (end-p<2) return LINE_OTHER;
+	if (p[0]=='f' && is_space(p[1])) return LINE_F;
+	if (p[0]!='v') return LINE_OTHER;
+	if (is_space(p[1])) return LINE_V;
+	if (end-p<3 || !is_space(p[2])) return LINE_OTHER;
+	if (p[1]=='t') return LINE_VT;
+	if (p[1]=='n') return LINE_VN;
+	return LINE_OTHER;
+}
+
+// [+-]digits[.digits][(e|E)[+-]digits], no locale, no allocation
+float parse_float(const char *&p, const char *end) {
+	static const double pow10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	p = skip_space(p, end);
+	bool neg = false;
+	if (p<end && (*p=='-' || *p=='+')) neg = *p++=='-';
+	uint64_t mant = 0;
+	int exp10 = 0;
+	for (; p<end && is_digit(*p); p++) {
+		if (mant<100000000000000000ull) mant = mant*10 + (*p-'0');
+		else exp10++;
+	}
+	if (p<end && *p=='.') {
+		for (p++; p<end && is_digit(*p); p++) {
+			if (mant<100000000000000000ull) {
+				mant = mant*10 + (*p-'0');
+				exp10--;
+			}
+		}
+	}
+	if (p<end && (*p=='e' || *p=='E')) {
+		p++;
+		bool eneg = false;
+		if (p<end && (*p=='-' || *p=='+')) eneg = *p++=='-';
+		int e = 0;
+		for (; p<end && is_digit(*p); p++) if (e<10000) e = e*10 + (*p-'0');
+		exp10 += eneg ? -e : e;
+	}
+	double v = (double)mant;
+	if (exp10<0) v = exp10>=-22 ? v/pow10[-exp10] : v*std::pow(10., exp10);
+	else if (exp10>0) v = exp10<=22 ? v*pow10[exp10] : v*std::pow(10., exp10);
+	return (float)(neg ? -v : v);
+}
+
+long parse_int(const char *&p, const char *end) {
+	bool neg = false;
+	if (p<end && (*p=='-' || *p=='+')) neg = *p++=='-';
+	long v = 0;
+	for (; p<end && is_digit(*p); p++) v = v*10 + (*p-'0');
+	return neg ? -v : v;
+}
+
+// obj indices are 1-based, negative ones count back from the last record seen
+inline uint32_t resolve(long idx, size_t seen, size_t total, bool &bad) {
+	if (idx==0) return MISSING;
+	long i = idx>0 ? idx-1 : (long)seen+idx;
+	if (i<0 || i>=(long)total) {
+		bad = true;
+		return 0;
+	}
+	return (uint32_t)i;
+}
+
+void count_chunk(Chunk &c) {
+	c.v = c.vt = c.vn = c.tris = 0;
+	for (const char *p=c.begin; p<c.end; ) {
+		const char *eol = line_end(p, c.end);
+		switch (line_kind(p, eol)) {
+		case LINE_V:  c.v++;  break;
+		case LINE_VT: c.vt++; break;
+		case LINE_VN: c.vn++; break;
+		case LINE_F: {
+			int corners = 0;
+			const char *fend = face_end(p, eol);
+			for (const char *q=p+1; q<fend; ) {
+				q = skip_space(q, fend);
+				if (q==fend) break;
+				corners++;
+				while (q<fend && !is_space(*q)) q++;
+			}
+			if (corners>=3) c.tris += corners-2;
+			break;
+		}
+		default: break;
+		}
+		p = eol+1;
+	}
+}
+
+void parse_chunk(Chunk &c, ObjMesh &m, size_t nv, size_t nvt, size_t nvn) {
+	size_t v = c.v, vt = c.vt, vn = c.vn, tri = c.tris;
+	uint32_t fv[3], ft[3], fn[3]; // first corner, previous corner, current corner
+	for (const char *p=c.begin; p<c.end; ) {
+		const char *eol = line_end(p, c.end);
+		const char *q = p+2;
+		switch (line_kind(p, eol)) {
+		case LINE_V:
+			m.vx[v] = parse_float(q, eol);
+			m.vy[v] = parse_float(q, eol);
+			m.vz[v] = parse_float(q, eol);
+			v++;
+			break;
+		case LINE_VT:
+			q++;
+			m.tu[vt] = parse_float(q, eol);
+			m.tv[vt] = parse_float(q, eol);
+			vt++;
+			break;
+		case LINE_VN:
+			q++;
+			m.nx[vn] = parse_float(q, eol);
+			m.ny[vn] = parse_float(q, eol);
+			m.nz[vn] = parse_float(q, eol);
+			vn++;
+			break;
+		case LINE_F: {
+			// v, v/vt, v//vn or v/vt/vn
+			int corner = 0;
+			const char *fend = face_end(p, eol);
+			for (q=p+1; ; corner++) {
+				q = skip_space(q, fend);
+				if (q==fend) break;
+				long iv = parse_int(q, fend), it = 0, in = 0;
+				if (q<fend && *q=='/') {
+					q++;
+					if (q<fend && *q!='/') it = parse_int(q, fend);
+					if (q<fend && *q=='/') {
+						q++;
+						in = parse_int(q, fend);
+					}
+				}
+				while (q<fend && !is_space(*q)) q++;
+				int slot = corner<2 ? corner : 2;
+				fv[slot] = resolve(iv, v, nv, c.bad);
+				ft[slot] = resolve(it, vt, nvt, c.bad);
+				fn[slot] = resolve(in, vn, nvn, c.bad);
+				if (fv[slot]==MISSING) c.bad = true;
+				if (ft[slot]==MISSING) c.no_vt = true;
+				if (fn[slot]==MISSING) c.no_vn = true;
+				if (corner<2) continue;
+				m.faces[tri*3] = fv[0]; m.faces[tri*3+1] = fv[1]; m.faces[tri*3+2] = fv[2];
+				m.face_tex[tri*3] = ft[0]; m.face_tex[tri*3+1] = ft[1]; m.face_tex[tri*3+2] = ft[2];
+				m.face_norm[tri*3] = fn[0]; m.face_norm[tri*3+1] = fn[1]; m.face_norm[tri*3+2] = fn[2];
+				tri++;
+				fv[1] = fv[2]; ft[1] = ft[2]; fn[1] = fn[2];
+			}
+			break;
+		}
+		default: break;
+		}
+		p = eol+1;
+	}
+}
+
+// points faces without a texcoord/normal at a default one appended at the end
+void patch_missing(std::vector<uint32_t> &idx, uint32_t fallback) {
+	for (size_t i=0; i<idx.size(); i++)
+		if (idx[i]==MISSING) idx[i] = fallback;
+}
+
+} // namespace
+
+bool load_obj(const char *filename, ObjMesh &mesh, int nthreads) {
+	int fd = open(filename, O_RDONLY);
+	if (fd<0) {
+		std::cerr << "can't open file " << filename << "\n";
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st)<0) {
+		std::cerr << "can't stat file " << filename << "\n";
+		close(fd);
+		return false;
+	}
+	mesh = ObjMesh();
+	size_t size = st.st_size;
+	if (!size) {
+		close(fd);
+		return true;
+	}
+	void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map==MAP_FAILED) {
+		std::cerr << "can't map file " << filename << "\n";
+		return false;
+	}
+	madvise(map, size, MADV_SEQUENTIAL);
+	const char *data = (const char *)map;
+
+	ThreadPool pool(nthreads);
+	// a few chunks per thread so that stealing evens them out, but not tiny ones
+	size_t nchunks = pool.size()*4;
+	size_t chunk = std::max(size/nchunks, (size_t)1<<20);
+	std::vector<Chunk> chunks;
+	for (const char *p=data, *end=data+size; p<end; ) {
+		Chunk c;
+		memset(&c, 0, sizeof(c));
+		c.begin = p;
+		c.end = (size_t)(end-p)<=chunk ? end : line_end(p+chunk, end);
+		chunks.push_back(c);
+		p = c.end<end ? c.end+1 : end;
+	}
+
+	pool.parallel_for((int)chunks.size(), [&](int i) { count_chunk(chunks[i]); });
+
+	// running totals become the first record of each chunk
+	size_t nv = 0, nvt = 0, nvn = 0, ntris = 0;
+	for (size_t i=0; i<chunks.size(); i++) {
+		size_t v = chunks[i].v, vt = chunks[i].vt, vn = chunks[i].vn, tris = chunks[i].tris;
+		chunks[i].v = nv; chunks[i].vt = nvt; chunks[i].vn = nvn; chunks[i].tris = ntris;
+		nv += v; nvt += vt; nvn += vn; ntris += tris;
+	}
+	mesh.vx.resize(nv); mesh.vy.resize(nv); mesh.vz.resize(nv);
+	mesh.tu.resize(nvt); mesh.tv.resize(nvt);
+	mesh.nx.resize(nvn); mesh.ny.resize(nvn); mesh.nz.resize(nvn);
+	mesh.faces.resize(ntris*3); mesh.face_tex.resize(ntris*3); mesh.face_norm.resize(ntris*3);
+
+	pool.parallel_for((int)chunks.size(), [&](int i) { parse_chunk(chunks[i], mesh, nv, nvt, nvn); });
+	munmap(map, size);
+
+	bool no_vt = false, no_vn = false;
+	for (size_t i=0; i<chunks.size(); i++) {
+		if (chunks[i].bad) {
+			std::cerr << "bad face index in " << filename << "\n";
+			mesh = ObjMesh();
+			return false;
+		}
+		no_vt |= chunks[i].no_vt;
+		no_vn |= chunks[i].no_vn;
+	}
+	if (no_vt) {
+		patch_missing(mesh.face_tex, (uint32_t)mesh.tu.size());
+		mesh.tu.push_back(0); mesh.tv.push_back(0);
+	}
+	if (no_vn) {
+		patch_missing(mesh.face_norm, (uint32_t)mesh.nx.size());
+		mesh.nx.push_back(0); mesh.ny.push_back(0); mesh.nz.push_back(0);
+	}
+	return true;
+}
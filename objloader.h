@@ -0,0 +1,25 @@
+#ifndef __OBJLOADER_H__
+#define __OBJLOADER_H__
+
+#include <vector>
+#include <stdint.h>
+
+// Flat result of parsing a wavefront obj: structure of arrays for the
+// attributes, three indices per triangle for the faces (polygons are fanned).
+// Faces that leave out vt or vn point at one extra default entry appended to
+// the corresponding arrays, so every index is valid. Once welded (see
+// meshopt.h) face_tex and face_norm are empty and faces indexes all three.
+struct ObjMesh {
+	std::vector<float> vx, vy, vz;
+	std::vector<float> tu, tv;
+	std::vector<float> nx, ny, nz;
+	std::vector<uint32_t> faces, face_tex, face_norm;
+};
+
+// Memory maps the file, cuts it into chunks at line boundaries and parses the
+// chunks on nthreads threads (0 = one per core). A first pass counts the
+// records of every chunk, so the second one can resolve relative (negative)
+// indices and write straight into the final arrays in file order.
+bool load_obj(const char *filename, ObjMesh &mesh, int nthreads=0);
+
+#endif //__OBJLOADER_H__
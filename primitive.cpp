@@ -0,0 +1,189 @@
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include "primitive.h"
+
+namespace {
+
+// planes a triangle can get clipped against
+enum {
+	CLIP_NEAR = 1, CLIP_LEFT = 2, CLIP_RIGHT = 4, CLIP_BOTTOM = 8, CLIP_TOP = 16,
+	CLIP_ALL = 31
+};
+
+// sides of the screen, for trivial rejects
+enum {
+	OUT_LEFT = 1, OUT_RIGHT = 2, OUT_BOTTOM = 4, OUT_TOP = 8, OUT_NEAR = 16
+};
+
+} // namespace
+
+const float PrimitiveAssembler::NEAR_W = .01f;
+
+PrimitiveAssembler::PrimitiveAssembler(int width, int height) : width_(width), height_(height), cull_backfaces_(true) {
+	reset_stats();
+}
+
+void PrimitiveAssembler::set_size(int width, int height) {
+	width_ = width;
+	height_ = height;
+}
+
+void PrimitiveAssembler::set_cull_backfaces(bool cull) {
+	cull_backfaces_ = cull;
+}
+
+void PrimitiveAssembler::reset_stats() {
+	memset(&stats_, 0, sizeof(stats_));
+}
+
+void PrimitiveAssembler::add_stats(const CullStats &stats) {
+	stats_.clusters += stats.clusters;
+	stats_.cluster_offscreen += stats.cluster_offscreen;
+	stats_.cluster_backface += stats.cluster_backface;
+	stats_.cluster_faces += stats.cluster_faces;
+	stats_.submitted += stats.submitted;
+	stats_.offscreen += stats.offscreen;
+	stats_.backface += stats.backface;
+	stats_.degenerate += stats.degenerate;
+	stats_.empty_box += stats.empty_box;
+	stats_.near_clipped += stats.near_clipped;
+	stats_.guard_clipped += stats.guard_clipped;
+	stats_.emitted += stats.emitted;
+}
+
+int PrimitiveAssembler::assemble(const VertexBuffer &vb, const uint32_t *face, const Vec2f *uv, AssembledTri *out) {
+	stats_.submitted++;
+	float xmax = width_-1, ymax = height_-1;
+	float gx0 = -GUARD_BAND, gx1 = xmax+GUARD_BAND;
+	float gy0 = -GUARD_BAND, gy1 = ymax+GUARD_BAND;
+	unsigned all_out = ~0u, clip_planes = 0;
+	for (int j=0; j<3; j++) {
+		uint32_t i = face[j];
+		float x = vb.x[i], y = vb.y[i], w = vb.w[i];
+		unsigned o = 0;
+		if (x<0)       o |= OUT_LEFT;
+		if (x>xmax*w)  o |= OUT_RIGHT;
+		if (y<0)       o |= OUT_BOTTOM;
+		if (y>ymax*w)  o |= OUT_TOP;
+		if (w<NEAR_W)  o |= OUT_NEAR;
+		all_out &= o;
+		if (w<NEAR_W)  clip_planes |= CLIP_ALL; // the new vertices can land anywhere
+		if (x<gx0*w)   clip_planes |= CLIP_LEFT;
+		if (x>gx1*w)   clip_planes |= CLIP_RIGHT;
+		if (y<gy0*w)   clip_planes |= CLIP_BOTTOM;
+		if (y>gy1*w)   clip_planes |= CLIP_TOP;
+	}
+	if (all_out) {
+		stats_.offscreen++;
+		return 0;
+	}
+
+	if (!clip_planes) {
+		AssembledTri &t = out[0];
+		for (int j=0; j<3; j++) {
+			uint32_t i = face[j];
+			t.pts[j] = Vec3f(vb.sx[i], vb.sy[i], vb.sz[i]);
+			t.uv[j] = uv[j];
+		}
+		return finish(t) ? 1 : 0;
+	}
+
+	if (clip_planes & CLIP_NEAR) stats_.near_clipped++;
+	else stats_.guard_clipped++;
+	ClipVertex poly[3];
+	for (int j=0; j<3; j++) {
+		uint32_t i = face[j];
+		ClipVertex v = { vb.x[i], vb.y[i], vb.z[i], vb.w[i], uv[j].x, uv[j].y };
+		poly[j] = v;
+	}
+	return clip(poly, 3, clip_planes, out);
+}
+
+int PrimitiveAssembler::clip(ClipVertex *poly, int n, unsigned planes, AssembledTri *out) {
+	float gx0 = -GUARD_BAND, gx1 = width_-1+GUARD_BAND;
+	float gy0 = -GUARD_BAND, gy1 = height_-1+GUARD_BAND;
+	// each plane can add one vertex
+	ClipVertex buf[2][3+5];
+	ClipVertex *in = poly;
+	for (int p=0; p<5; p++) {
+		if (!(planes & (1u<<p))) continue;
+		ClipVertex *res = buf[p&1];
+		int m = 0;
+		float d[3+5];
+		for (int i=0; i<n; i++) {
+			const ClipVertex &v = in[i];
+			switch (p) {
+			case 0:  d[i] = v.w - NEAR_W; break;
+			case 1:  d[i] = v.x - gx0*v.w; break;
+			case 2:  d[i] = gx1*v.w - v.x; break;
+			case 3:  d[i] = v.y - gy0*v.w; break;
+			default: d[i] = gy1*v.w - v.y; break;
+			}
+		}
+		// Sutherland-Hodgman: keep the inside vertices, add one where an edge crosses
+		for (int i=0; i<n; i++) {
+			int k = (i+1)%n;
+			if (d[i]>=0) res[m++] = in[i];
+			if ((d[i]>=0) != (d[k]>=0)) {
+				float t = d[i]/(d[i]-d[k]);
+				const ClipVertex &a = in[i], &b = in[k];
+				ClipVertex c = {
+					a.x + (b.x-a.x)*t, a.y + (b.y-a.y)*t, a.z + (b.z-a.z)*t,
+					a.w + (b.w-a.w)*t, a.u + (b.u-a.u)*t, a.v + (b.v-a.v)*t
+				};
+				res[m++] = c;
+			}
+		}
+		in = res;
+		n = m;
+		if (n<3) {
+			stats_.offscreen++;
+			return 0;
+		}
+	}
+
+	// fan of what is left, projected like the vertex stage does it
+	int count = 0;
+	for (int i=1; i+1<n; i++) {
+		AssembledTri &t = out[count];
+		const ClipVertex *v[3] = { &in[0], &in[i], &in[i+1] };
+		for (int j=0; j<3; j++) {
+			float inv = 1.f/v[j]->w;
+			t.pts[j] = Vec3f(v[j]->x*inv, v[j]->y*inv, v[j]->z*inv);
+			t.uv[j] = Vec2f(v[j]->u, v[j]->v);
+		}
+		if (finish(t)) count++;
+	}
+	return count;
+}
+
+bool PrimitiveAssembler::finish(AssembledTri &t) {
+	const float scale = 1<<SUBPIXEL_BITS, inv = 1.f/scale;
+	for (int j=0; j<3; j++) {
+		t.pts[j].x = std::floor(t.pts[j].x*scale + .5f)*inv;
+		t.pts[j].y = std::floor(t.pts[j].y*scale + .5f)*inv;
+	}
+	Vec3f &a = t.pts[0], &b = t.pts[1], &c = t.pts[2];
+	// exact in double for anything inside the guard band
+	double area = ((double)b.x-a.x)*((double)c.y-a.y) - ((double)b.y-a.y)*((double)c.x-a.x);
+	// same threshold as setup_triangle()
+	if (std::fabs(area)<=1e-2) {
+		stats_.degenerate++;
+		return false;
+	}
+	// counter clockwise with y up faces the camera
+	if (area<0 && cull_backfaces_) {
+		stats_.backface++;
+		return false;
+	}
+	// a bounding box test only, the edges are left to setup and the kernels
+	float xmin = std::min(a.x, std::min(b.x, c.x)), xmax = std::max(a.x, std::max(b.x, c.x));
+	float ymin = std::min(a.y, std::min(b.y, c.y)), ymax = std::max(a.y, std::max(b.y, c.y));
+	if (std::ceil(xmin)>std::floor(xmax) || std::ceil(ymin)>std::floor(ymax)) {
+		stats_.empty_box++;
+		return false;
+	}
+	stats_.emitted++;
+	return true;
+}
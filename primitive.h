@@ -0,0 +1,78 @@
+#ifndef __PRIMITIVE_H__
+#define __PRIMITIVE_H__
+
+#include <stdint.h>
+#include "geometry.h"
+#include "transform.h"
+
+// What happened to the triangles of a frame. Pieces of a clipped triangle
+// go through the culling tests one by one and count as such. Faces of
+// meshlets culled as a whole (see meshlet.h) are never submitted.
+struct CullStats {
+	unsigned long long clusters;          // meshlets tested
+	unsigned long long cluster_offscreen; // all outside one side of the screen or the near plane
+	unsigned long long cluster_backface;  // all facing away
+	unsigned long long cluster_faces;     // faces of the two above
+	unsigned long long submitted;
+	unsigned long long offscreen;     // all outside one side of the screen, or behind the near plane
+	unsigned long long backface;
+	unsigned long long degenerate;    // no area left after snapping
+	unsigned long long empty_box;     // no pixel center inside the bounding box; a sliver whose box
+	                                  // holds one but whose edges cover none still goes on
+	unsigned long long near_clipped;  // crossed the near plane
+	unsigned long long guard_clipped; // crossed the guard band, not the near plane
+	unsigned long long emitted;       // triangles handed on, clipped ones can give several
+};
+
+// Screen space triangle ready for the rasterizer
+struct AssembledTri {
+	Vec3f pts[3];
+	Vec2f uv[3];
+};
+
+// Primitive assembly, between the vertex stage and the rasterizer. The
+// vertices come in the clip space of a matrix that ends with viewport(), so
+// the screen is 0 <= x <= (width-1)*w, 0 <= y <= (height-1)*w there.
+//
+// Triangles all on the outside of one screen edge or of the near plane are
+// dropped from the outcodes alone. Those inside a guard band of GUARD_BAND
+// pixels around the screen are never clipped, the rasterizer scissors them.
+// Only triangles crossing the near plane or the guard band are clipped in
+// homogeneous space. Then vertices snap to 1/2^SUBPIXEL_BITS of a pixel,
+// and back facing and zero area triangles are dropped, as are those whose
+// bounding box holds no pixel center.
+class PrimitiveAssembler {
+public:
+	static const int SUBPIXEL_BITS = 4;
+	static const int GUARD_BAND = 4096;
+	static const int MAX_TRIS = 6; // a triangle clipped by five planes
+	static const float NEAR_W;     // near plane, as a fraction of the eye to center distance
+
+	PrimitiveAssembler(int width, int height);
+	void set_cull_backfaces(bool cull);
+	void set_size(int width, int height);
+	int get_width() const { return width_; }
+	int get_height() const { return height_; }
+	// assembles face (three indices into vb) and writes what is left of it
+	// to out, returns how many triangles that is
+	int assemble(const VertexBuffer &vb, const uint32_t *face, const Vec2f *uv, AssembledTri *out);
+
+	const CullStats &stats() const { return stats_; }
+	void reset_stats();
+	// adds stats to the ones of this, for assembly split over copies of it
+	void add_stats(const CullStats &stats);
+
+private:
+	struct ClipVertex {
+		float x, y, z, w, u, v;
+	};
+
+	int clip(ClipVertex *poly, int n, unsigned planes, AssembledTri *out);
+	bool finish(AssembledTri &t);
+
+	int width_, height_;
+	bool cull_backfaces_;
+	CullStats stats_;
+};
+
+#endif //__PRIMITIVE_H__
@@ -0,0 +1,142 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "profile.h"
+
+namespace {
+
+const char *STAGE_NAMES[STAGE_COUNT] = {
+	"load", "shadow", "transform", "setup", "raster", "shade", "write"
+};
+const char *COUNTER_NAMES[COUNTER_COUNT] = {
+	"tris_submitted", "tris_culled", "tris_rasterized", "fragments_tested", "fragments_passed", "texels_fetched"
+};
+
+thread_local ProfileScope *current = NULL;
+thread_local int thread_index = -1;
+std::atomic<int> threads(0);
+
+int this_thread() {
+	if (thread_index<0) thread_index = threads++;
+	return thread_index;
+}
+
+// name as a json string
+std::string quote(const std::string &name) {
+	std::string out = "\"";
+	for (size_t i=0; i<name.size(); i++) {
+		char c = name[i];
+		if (c=='"' || c=='\\') out += '\\';
+		if ((unsigned char)c<32) {
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out += buf;
+		} else {
+			out += c;
+		}
+	}
+	return out + "\"";
+}
+
+} // namespace
+
+const char *stage_name(int stage) {
+	return STAGE_NAMES[stage];
+}
+
+const char *counter_name(int counter) {
+	return COUNTER_NAMES[counter];
+}
+
+int64_t profile_now() {
+	static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-start).count();
+}
+
+Profile::Profile(bool trace) : trace_(trace), lock_(), events_() {
+	for (int i=0; i<STAGE_COUNT; i++) ns_[i] = 0;
+	for (int i=0; i<COUNTER_COUNT; i++) counters_[i] = 0;
+}
+
+void Profile::add_time(int stage, int64_t ns) {
+	ns_[stage] += ns;
+}
+
+void Profile::add(int counter, uint64_t n) {
+	counters_[counter] += n;
+}
+
+void Profile::add_event(const TraceEvent &e) {
+	if (!trace_) return;
+	std::lock_guard<std::mutex> guard(lock_);
+	events_.push_back(e);
+}
+
+void Profile::write_json(std::ostream &out, const std::string &name) const {
+	char buf[64];
+	out << "{\"name\": " << quote(name) << ", \"ms\": {";
+	for (int i=0; i<STAGE_COUNT; i++) {
+		snprintf(buf, sizeof(buf), "%.3f", ns_[i]/1e6);
+		out << (i ? ", " : "") << "\"" << STAGE_NAMES[i] << "\": " << buf;
+	}
+	out << "}, \"counters\": {";
+	for (int i=0; i<COUNTER_COUNT; i++)
+		out << (i ? ", " : "") << "\"" << COUNTER_NAMES[i] << "\": " << counters_[i];
+	out << "}}\n";
+}
+
+void Profile::write_trace_events(std::ostream &out, const std::string &name) const {
+	std::string args = "{\"frame\": " + quote(name) + "}";
+	char buf[128];
+	for (size_t i=0; i<events_.size(); i++) {
+		const TraceEvent &e = events_[i];
+		snprintf(buf, sizeof(buf), "\"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+			e.thread, e.start_ns/1e3, e.dur_ns/1e3);
+		out << "{\"name\": \"" << STAGE_NAMES[e.stage] << "\", " << buf << ", \"args\": " << args << "},\n";
+	}
+}
+
+void begin_trace(std::ostream &out) {
+	out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+}
+
+void end_trace(std::ostream &out) {
+	// the events all end with a comma, this one doesn't
+	out << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"tinyrenderer\"}}\n]}\n";
+}
+
+ProfileScope::ProfileScope(Profile *profile, int stage) : profile_(NULL), parent_(current), root_(NULL), stage_(stage),
+		start_(0), children_(0) {
+	// a thread that helps out the pool while it waits can run work of another
+	// profile from inside a scope: that starts a root of its own
+	bool nested = parent_ && (!profile || profile==parent_->profile_);
+	root_ = nested ? parent_->root_ : this;
+	profile_ = nested ? parent_->profile_ : profile;
+	// a root without a profile times nothing, and is not current either
+	if (!profile_) return;
+	if (root_==this) {
+		memset(ns_, 0, sizeof(ns_));
+		memset(counters_, 0, sizeof(counters_));
+	}
+	current = this;
+	start_ = profile_now();
+}
+
+ProfileScope::~ProfileScope() {
+	if (!profile_) return;
+	int64_t elapsed = profile_now()-start_;
+	root_->ns_[stage_] += elapsed-children_;
+	if (parent_) parent_->children_ += elapsed;
+	current = parent_;
+	if (root_!=this) return;
+	for (int i=0; i<STAGE_COUNT; i++)
+		if (ns_[i]) profile_->add_time(i, ns_[i]);
+	for (int i=0; i<COUNTER_COUNT; i++)
+		if (counters_[i]) profile_->add(i, counters_[i]);
+	TraceEvent e = { stage_, this_thread(), start_, elapsed };
+	profile_->add_event(e);
+}
+
+void ProfileScope::count(int counter, uint64_t n) {
+	if (current) current->root_->counters_[counter] += n;
+}
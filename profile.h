@@ -0,0 +1,116 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <atomic>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Per stage timers and pipeline counters. They are built in with
+// make PROFILE=1, which defines PROFILE; otherwise the macros at the bottom
+// expand to nothing and nothing is ever added to a Profile.
+//
+// A Profile collects one frame or one job. The first scope a thread opens is
+// a root: it says which Profile it is for, it becomes one event of the trace
+// and it adds everything timed and counted under it to the Profile when it
+// ends. Scopes opened under it on the same thread only time themselves, and
+// their time is taken out of the enclosing scope, so each stage gets its own
+// time only: raster is the time of the raster tiles minus the shading done
+// from them.
+
+enum ProfileStage {
+	STAGE_LOAD, STAGE_SHADOW, STAGE_TRANSFORM, STAGE_SETUP, STAGE_RASTER, STAGE_SHADE, STAGE_WRITE, STAGE_COUNT
+};
+
+enum ProfileCounter {
+	TRIS_SUBMITTED,   // faces handed to primitive assembly
+	TRIS_CULLED,      // faces assembly dropped
+	TRIS_RASTERIZED,  // assembled triangles binned for rasterization
+	FRAGMENTS_TESTED,
+	FRAGMENTS_PASSED, // passed the depth test
+	TEXELS_FETCHED,   // filter taps of the texture samples
+	COUNTER_COUNT
+};
+
+struct TraceEvent {
+	int stage;
+	int thread;
+	int64_t start_ns, dur_ns;
+};
+
+class Profile {
+public:
+	// events are only kept with trace
+	explicit Profile(bool trace=false);
+	void add_time(int stage, int64_t ns);
+	void add(int counter, uint64_t n);
+	void add_event(const TraceEvent &e);
+	int64_t time_ns(int stage) const { return ns_[stage]; }
+	uint64_t count(int counter) const { return counters_[counter]; }
+
+	// {"name": ..., "ms": {...}, "counters": {...}} on one line, the times
+	// summed over all the threads that worked on a stage
+	void write_json(std::ostream &out, const std::string &name) const;
+	// the events as Chrome trace events, each one followed by a comma
+	void write_trace_events(std::ostream &out, const std::string &name) const;
+
+private:
+	Profile(const Profile &);
+	Profile & operator =(const Profile &);
+
+	std::atomic<int64_t> ns_[STAGE_COUNT];
+	std::atomic<uint64_t> counters_[COUNTER_COUNT];
+	bool trace_;
+	std::mutex lock_;
+	std::vector<TraceEvent> events_;
+};
+
+const char *stage_name(int stage);
+const char *counter_name(int counter);
+// nanoseconds since the first call, the time base of the trace
+int64_t profile_now();
+
+// Chrome trace event file (chrome://tracing, Perfetto): begin(), the
+// write_trace_events() of every Profile, end()
+void begin_trace(std::ostream &out);
+void end_trace(std::ostream &out);
+
+class ProfileScope {
+public:
+	// profile is only needed by roots, the scopes under one take the root's;
+	// a scope for a different profile than the enclosing one is a root again
+	ProfileScope(Profile *profile, int stage);
+	~ProfileScope();
+	// counts n into the root scope of this thread, if there is one
+	static void count(int counter, uint64_t n);
+
+private:
+	ProfileScope(const ProfileScope &);
+	ProfileScope & operator =(const ProfileScope &);
+
+	Profile *profile_;
+	ProfileScope *parent_, *root_;
+	int stage_;
+	int64_t start_, children_;
+	// roots only: what the scopes under them timed and counted
+	int64_t ns_[STAGE_COUNT];
+	uint64_t counters_[COUNTER_COUNT];
+};
+
+#ifdef PROFILE
+const bool PROFILE_ENABLED = true;
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(profile, stage) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(profile, stage)
+#define PROFILE_COUNT(counter, n) ProfileScope::count(counter, n)
+#define PROFILE_ADD(profile, counter, n) do { if (profile) (profile)->add(counter, n); } while (0)
+#else
+const bool PROFILE_ENABLED = false;
+#define PROFILE_SCOPE(profile, stage) ((void)0)
+#define PROFILE_COUNT(counter, n) ((void)0)
+#define PROFILE_ADD(profile, counter, n) ((void)0)
+#endif
+
+#endif //__PROFILE_H__
@@ -0,0 +1,632 @@
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <emmintrin.h>
+#include "raster.h"
+#include "rasterkernel_impl.h"
+#include "threadpool.h"
+#include "profile.h"
+
+Vec3f barycentric(Vec3f *pts, Vec3f P){
+	// Get barycentric coords of point P on triangle given by pts
+	// (1-u-v, u, v)
+	Vec3f a = Vec3f(pts[2].x - pts[0].x, pts[1].x - pts[0].x, pts[0].x - P.x);
+	Vec3f b = Vec3f(pts[2].y - pts[0].y, pts[1].y - pts[0].y, pts[0].y - P.y);
+
+	// Solve linear system with cross prod.
+	Vec3f u = cross(a,b);
+	// Get (u, v, 1)
+	// if u[2] < 1, degenerate case, else normalize & return
+	if(std::abs(u.z) > 1e-2)
+		return Vec3f(1.f - (u.x + u.y)/u.z, u.y/u.z, u.x/u.z);
+
+	return Vec3f(-1, 1, 1);
+}
+
+Vec2f bary2Cart(Vec2f *texCoords, Vec3f bary){
+	Vec2f p;
+	for (int i=0; i<3; i++){
+		p.x += bary[i]*texCoords[i].x;
+		p.y += bary[i]*texCoords[i].y;
+	}
+	return p;
+}
+
+void line(Vec2i p0, Vec2i p1, TGAImage &image, TGAColor color){
+	// We use Bressenham's algo
+	bool vertChart = false;
+	
+	int x0 = p0.x;
+	int y0 = p0.y;
+	int x1 = p1.x;
+	int y1 = p1.y;
+	
+	// Use vertical chart?
+	if(std::abs(x0 - x1) < std::abs(y0 - y1)){
+		std::swap(x0, y0);
+		std::swap(x1, y1);
+		vertChart = true;
+	}
+	
+	// We shall draw left to right
+	if(x0 > x1){
+		std::swap(x0, x1);
+		std::swap(y0, y1);
+	}
+
+	// Finally, draw it!
+	for(int x = x0; x <= x1; x++){
+		float t = (x-x0) / (float)(x1-x0);
+		int y = y0*(1.-t) + y1*t;
+		if(vertChart){
+			image.set(y, x, color);
+		}
+		else{
+			image.set(x, y, color);
+		
+		}
+	}
+
+}
+
+void triangle(Vec3f *pts, DepthBuffer &zBuffer, Vec2f *texCoords, Texture &texture, RenderTarget &target, float intensity,
+		Texture::Filter filter){
+	triangle_rect(pts, zBuffer, texCoords, texture, target, intensity, filter, 0, 0, target.get_width()-1, target.get_height()-1);
+}
+
+// one lane, same block walk; the fallback when there is no AVX2
+struct LanesScalar {
+	enum { LX=1, LY=1 };
+	typedef float F;
+	typedef bool M;
+
+	static F set1(float v)   { return v; }
+	static F add(F a, F b)   { return a+b; }
+	static F mul(F a, F b)   { return a*b; }
+	static F lane_dx()       { return 0; }
+	static F lane_dy()       { return 0; }
+	static M all()           { return true; }
+	static M ge0(F w)        { return w>=0; }
+	static M le(F a, F b)    { return a<=b; }
+	static M and_(M a, M b)  { return a && b; }
+	static unsigned bits(M m) { return m ? 1 : 0; }
+
+	static M rect(int x, int y, const RasterTri &t) { return x>=t.x0 && x<=t.x1 && y>=t.y0 && y<=t.y1; }
+	static F load(const float *p, int, M) { return *p; }
+	static void store(float *p, int, M m, F v) { if (m) *p = v; }
+	static void spill(float *out, F v) { *out = v; }
+};
+
+void raster_kernel_scalar(const RasterTri &tri, DepthTarget &depth, FragmentFn shade, void *ctx) {
+	raster_blocks<LanesScalar>(tri, depth, shade, ctx);
+}
+
+void depth_kernel_scalar(const RasterTri &tri, DepthTarget &depth) {
+	raster_blocks<LanesScalar, true>(tri, depth, NULL, NULL);
+}
+
+static RasterKernel pick_kernel() {
+	// RASTER_KERNEL=scalar|avx2|avx512 forces a kernel, handy for comparing them
+	const char *force = getenv("RASTER_KERNEL");
+	__builtin_cpu_init();
+	bool avx512 = __builtin_cpu_supports("avx512f");
+	bool avx2 = __builtin_cpu_supports("avx2");
+	if (force && !strcmp(force, "scalar")) return raster_kernel_scalar;
+	if (force && !strcmp(force, "avx2") && avx2) return raster_kernel_avx2;
+	if (avx512 && !(force && !strcmp(force, "avx2"))) return raster_kernel_avx512;
+	if (avx2) return raster_kernel_avx2;
+	return raster_kernel_scalar;
+}
+
+static RasterKernel raster_kernel = pick_kernel();
+// always the one built like raster_kernel
+static DepthKernel depth_kernel = raster_kernel==raster_kernel_avx512 ? depth_kernel_avx512
+	: raster_kernel==raster_kernel_avx2 ? depth_kernel_avx2 : depth_kernel_scalar;
+
+const char *raster_kernel_name() {
+	if (raster_kernel==raster_kernel_avx512) return "avx512";
+	if (raster_kernel==raster_kernel_avx2) return "avx2";
+	return "scalar";
+}
+
+bool setup_triangle(Vec3f *pts, int x0, int y0, int x1, int y1, RasterTri &t, int origin) {
+	float xmin = std::min(pts[0].x, std::min(pts[1].x, pts[2].x));
+	float xmax = std::max(pts[0].x, std::max(pts[1].x, pts[2].x));
+	float ymin = std::min(pts[0].y, std::min(pts[1].y, pts[2].y));
+	float ymax = std::max(pts[0].y, std::max(pts[1].y, pts[2].y));
+	t.x0 = std::max(x0, (int)std::ceil(xmin));
+	t.y0 = std::max(y0, (int)std::ceil(ymin));
+	t.x1 = std::min(x1, (int)std::floor(xmax));
+	t.y1 = std::min(y1, (int)std::floor(ymax));
+	t.origin = origin;
+	if (t.x0>t.x1 || t.y0>t.y1) return false;
+
+	// edge i goes from vertex i+1 to vertex i+2
+	for (int i=0; i<3; i++) {
+		Vec3f &a = pts[(i+1)%3];
+		Vec3f &b = pts[(i+2)%3];
+		t.A[i] = a.y - b.y;
+		t.B[i] = b.x - a.x;
+		t.C[i] = a.x*b.y - b.x*a.y;
+		t.z[i] = pts[i].z;
+	}
+	float area = t.C[0] + t.A[0]*pts[0].x + t.B[0]*pts[0].y;
+	if (area<0) {
+		for (int i=0; i<3; i++) {
+			t.A[i] = -t.A[i]; t.B[i] = -t.B[i]; t.C[i] = -t.C[i];
+		}
+		area = -area;
+	}
+	// degenerate, same threshold barycentric() uses
+	if (area<=1e-2) return false;
+	t.inv_area = 1.f/area;
+	return true;
+}
+
+struct TexturedShade {
+	Vec2f *texCoords;
+	Texture *texture;
+	uint32_t *pixels;
+	int width;
+	float intensity;
+	Texture::Filter filter;
+	float lod;
+	const float *z;              // of the vertices, for the shadow lookup
+	const ShadowLookup *shadow;  // NULL for no shadows
+	int origin;                  // frame row of row 0 of pixels
+};
+
+// Colour channels of packed texels times intensity, truncated like the old
+// per channel float multiply of a TGAColor, four texels per register. Alpha
+// is left alone. n is rounded up to 4, the extra texels must be readable.
+static void scale_texels(uint32_t *c, int n, float intensity) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128 k = _mm_setr_ps(intensity, intensity, intensity, 1.f);
+	for (int i=0; i<n; i+=4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(c+i));
+		__m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+		__m128i t0 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), k));
+		__m128i t1 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), k));
+		__m128i t2 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), k));
+		__m128i t3 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), k));
+		v = _mm_packus_epi16(_mm_packs_epi32(t0, t1), _mm_packs_epi32(t2, t3));
+		_mm_storeu_si128((__m128i *)(c+i), v);
+	}
+}
+
+// per texel intensities, otherwise the same
+static void scale_texels(uint32_t *c, int n, const float *intensity) {
+	const __m128i zero = _mm_setzero_si128();
+	for (int i=0; i<n; i+=4) {
+		const float *k = intensity+i;
+		__m128i v = _mm_loadu_si128((const __m128i *)(c+i));
+		__m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+		__m128i t0 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), _mm_setr_ps(k[0], k[0], k[0], 1.f)));
+		__m128i t1 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), _mm_setr_ps(k[1], k[1], k[1], 1.f)));
+		__m128i t2 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), _mm_setr_ps(k[2], k[2], k[2], 1.f)));
+		__m128i t3 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), _mm_setr_ps(k[3], k[3], k[3], 1.f)));
+		v = _mm_packus_epi16(_mm_packs_epi32(t0, t1), _mm_packs_epi32(t2, t3));
+		_mm_storeu_si128((__m128i *)(c+i), v);
+	}
+}
+
+const float ShadowLookup::SHADOW_LIGHT = .3f;
+const float ShadowLookup::MAX_SLOPE = 8.f;
+
+// Intensity of every fragment, with what is left of it in the shadow where
+// the map has something nearer to the light. n is rounded up to 4 like above.
+static void shadow_intensities(const TexturedShade &s, const Fragment *frags, int n, float *k) {
+	const ShadowLookup &sh = *s.shadow;
+	float c = s.intensity;
+	for (int i=0; i<n; i++) k[i] = c;
+	for (int i=n; i&3; i++) k[i] = 0;
+	if (c<=0) return;
+	// a face the light grazes changes depth fast over one texel of the map
+	float slope = std::min(std::sqrt(std::max(1-c*c, 0.f))/c, ShadowLookup::MAX_SLOPE);
+	float bias = sh.bias*(1+slope);
+	for (int i=0; i<n; i++) {
+		const Fragment &f = frags[i];
+		float z = s.z[0]*f.bary[0] + s.z[1]*f.bary[1] + s.z[2]*f.bary[2];
+		Vec4f p = sh.to_map*Vec4f(f.x, f.y+s.origin, z, 1);
+		float inv = 1.f/p[3];
+		int x = (int)std::floor(p[0]*inv+.5f), y = (int)std::floor(p[1]*inv+.5f);
+		if (x<0 || y<0 || x>=sh.width || y>=sh.height) continue;
+		if (sh.depth[x+(size_t)y*sh.width] > p[2]*inv+bias) k[i] = c*ShadowLookup::SHADOW_LIGHT;
+	}
+}
+
+// the kernels hand over at most one 8x8 block of fragments at a time
+static const int MAX_FRAGMENTS = 64;
+
+static void shade_textured(void *ctx, const Fragment *frags, int n) {
+	TexturedShade &s = *(TexturedShade *)ctx;
+	PROFILE_SCOPE(NULL, STAGE_SHADE);
+	PROFILE_COUNT(TEXELS_FETCHED, n*(s.filter==Texture::NEAREST ? 1 : s.filter==Texture::BILINEAR ? 4 : 8));
+	uint32_t texels[MAX_FRAGMENTS+3];
+	for (int i=0; i<n; i++) {
+		Vec3f bary(frags[i].bary[0], frags[i].bary[1], frags[i].bary[2]);
+		// figure color. Use bary coords in texture space to interp
+		Vec2f uv = bary2Cart(s.texCoords, bary);
+		texels[i] = s.texture->sample(uv.x, uv.y, s.lod, s.filter);
+	}
+	for (int i=n; i&3; i++) texels[i] = 0;
+	if (s.shadow) {
+		float k[MAX_FRAGMENTS+3];
+		shadow_intensities(s, frags, n, k);
+		scale_texels(texels, n, k);
+	} else {
+		scale_texels(texels, n, s.intensity);
+	}
+	for (int i=0; i<n; i++)
+		s.pixels[frags[i].x + (size_t)frags[i].y*s.width] = texels[i];
+}
+
+// uv is affine in screen space, its derivatives are the same all over the triangle
+static float triangle_lod(const RasterTri &t, const Vec2f *texCoords, const Texture &texture) {
+	float dudx = 0, dvdx = 0, dudy = 0, dvdy = 0;
+	for (int i=0; i<3; i++) {
+		dudx += texCoords[i].x*t.A[i]*t.inv_area;
+		dvdx += texCoords[i].y*t.A[i]*t.inv_area;
+		dudy += texCoords[i].x*t.B[i]*t.inv_area;
+		dvdy += texCoords[i].y*t.B[i]*t.inv_area;
+	}
+	return texture.lod(dudx, dvdx, dudy, dvdy);
+}
+
+void triangle_rect(Vec3f *pts, DepthBuffer &zBuffer, Vec2f *texCoords, Texture &texture, RenderTarget &target, float intensity,
+		Texture::Filter filter, int x0, int y0, int x1, int y1, const ShadowLookup *shadow, int origin){
+	RasterTri t;
+	if (!setup_triangle(pts, x0, y0, x1, y1, t, origin)) return;
+	// only the tiles under the box get their pending clears done
+	uint32_t *pixels = target.touch(t.x0, t.y0-origin, t.x1, t.y1-origin);
+	TexturedShade s = { texCoords, &texture, pixels, target.get_width(), intensity, filter, triangle_lod(t, texCoords, texture),
+		t.z, shadow, origin };
+	raster_kernel(t, zBuffer.touch(t.x0, t.y0-origin, t.x1, t.y1-origin), shade_textured, &s);
+}
+
+// far enough out to take in any box the assembler lets through
+static const int GUARD = 1<<20;
+
+void triangle_msaa(Vec3f *pts, MsaaBuffer &msaa, int tile, Vec2f *texCoords, Texture &texture, RenderTarget &target,
+		float intensity, Texture::Filter filter, int x0, int y0, int x1, int y1, const ShadowLookup *shadow, int origin) {
+	RasterTri t;
+	// the box is made here: the samples reach half a pixel past the centers
+	// setup_triangle() goes by, across the edges of the tile too
+	if (!setup_triangle(pts, -GUARD, -GUARD, GUARD, GUARD, t, origin)) return;
+	float xmin = std::min(pts[0].x, std::min(pts[1].x, pts[2].x));
+	float xmax = std::max(pts[0].x, std::max(pts[1].x, pts[2].x));
+	float ymin = std::min(pts[0].y, std::min(pts[1].y, pts[2].y));
+	float ymax = std::max(pts[0].y, std::max(pts[1].y, pts[2].y));
+	t.x0 = std::max(x0, (int)std::ceil(xmin-.5f));
+	t.y0 = std::max(y0, (int)std::ceil(ymin-.5f));
+	t.x1 = std::min(x1, (int)std::floor(xmax+.5f));
+	t.y1 = std::min(y1, (int)std::floor(ymax+.5f));
+	if (t.x0>t.x1 || t.y0>t.y1) return;
+	uint32_t *pixels = target.touch(t.x0, t.y0-origin, t.x1, t.y1-origin);
+	TexturedShade s = { texCoords, &texture, pixels, target.get_width(), intensity, filter, triangle_lod(t, texCoords, texture),
+		t.z, shadow, origin };
+
+	const int samples = msaa.samples();
+	const float *off = msaa.offsets();
+	const unsigned all = (1u<<samples)-1;
+	// edge functions and depth at the samples, relative to the center, and
+	// how far they get from it either way
+	float dw[3][MsaaBuffer::MAX_SAMPLES], dwmin[3], dwmax[3];
+	float dzmin = 0;
+	for (int e=0; e<3; e++) {
+		dwmin[e] = dwmax[e] = 0;
+		for (int k=0; k<samples; k++) {
+			dw[e][k] = t.A[e]*off[2*k] + t.B[e]*off[2*k+1];
+			dwmin[e] = std::min(dwmin[e], dw[e][k]);
+			dwmax[e] = std::max(dwmax[e], dw[e][k]);
+		}
+	}
+	for (int k=0; k<samples; k++)
+		dzmin = std::min(dzmin, (dw[0][k]*t.z[0] + dw[1][k]*t.z[1] + dw[2][k]*t.z[2])*t.inv_area);
+	// the depth plane a pixel covered all over keeps
+	float dzdx = (t.A[0]*t.z[0] + t.A[1]*t.z[1] + t.A[2]*t.z[2])*t.inv_area;
+	float dzdy = (t.B[0]*t.z[0] + t.B[1]*t.z[1] + t.B[2]*t.z[2])*t.inv_area;
+
+	// a block of shaded pixels waiting for their colour to be stored
+	Fragment frags[MAX_FRAGMENTS];
+	unsigned masks[MAX_FRAGMENTS];
+	float depths[MAX_FRAGMENTS][MsaaBuffer::MAX_SAMPLES];
+	float centers[MAX_FRAGMENTS];
+	int n = 0;
+	auto store = [&] {
+		shade_textured(&s, frags, n);
+		for (int i=0; i<n; i++) {
+			const Fragment &f = frags[i];
+			msaa.store(tile, f.x, f.y, masks[i], depths[i], centers[i], dzdx, dzdy, pixels[f.x + (size_t)f.y*s.width]);
+		}
+		n = 0;
+	};
+
+	for (int y=t.y0; y<=t.y1; y++) {
+		for (int x=t.x0; x<=t.x1; x++) {
+			float w[3];
+			bool inside = true, outside = false;
+			for (int e=0; e<3; e++) {
+				w[e] = t.A[e]*x + t.B[e]*y + t.C[e];
+				inside = inside && w[e]+dwmin[e]>=0;
+				outside = outside || w[e]+dwmax[e]<0;
+			}
+			if (outside) continue;
+			Fragment &f = frags[n];
+			f.x = x;
+			f.y = y-origin;
+			float zc = (w[0]*t.z[0] + w[1]*t.z[1] + w[2]*t.z[2])*t.inv_area;
+			float stored;
+			// all covered, all in front of a compact pixel: shaded at the center,
+			// which is the centroid of all the samples
+			if (inside && msaa.compact_depth(x, y-origin, stored) && stored<=zc+dzmin) {
+				for (int e=0; e<3; e++) f.bary[e] = w[e]*t.inv_area;
+				masks[n] = all;
+				centers[n] = zc;
+				if (++n==MAX_FRAGMENTS) store();
+				continue;
+			}
+			unsigned cover = 0;
+			float *z = depths[n];
+			for (int k=0; k<samples; k++) {
+				float w0 = w[0]+dw[0][k], w1 = w[1]+dw[1][k], w2 = w[2]+dw[2][k];
+				if (w0>=0 && w1>=0 && w2>=0) cover |= 1u<<k;
+				z[k] = (w0*t.z[0] + w1*t.z[1] + w2*t.z[2])*t.inv_area;
+			}
+			if (!cover) continue;
+			unsigned pass = msaa.test(tile, x, y-origin, z, cover);
+			if (!pass) continue;
+			// shaded at the centroid of the samples covered, which is inside
+			// the triangle unlike the center of an edge pixel may be
+			float cx = 0, cy = 0;
+			int covered = 0;
+			for (int k=0; k<samples; k++)
+				if (cover>>k & 1) { cx += off[2*k]; cy += off[2*k+1]; covered++; }
+			cx /= covered;
+			cy /= covered;
+			for (int e=0; e<3; e++) f.bary[e] = (w[e] + t.A[e]*cx + t.B[e]*cy)*t.inv_area;
+			masks[n] = pass;
+			centers[n] = f.bary[0]*t.z[0] + f.bary[1]*t.z[1] + f.bary[2]*t.z[2];
+			if (++n==MAX_FRAGMENTS) store();
+		}
+	}
+	if (n) store();
+}
+
+void raster_triangle(const RasterTri &t, DepthBuffer &zBuffer, FragmentFn shade, void *ctx) {
+	raster_kernel(t, zBuffer.touch(t.x0, t.y0-t.origin, t.x1, t.y1-t.origin), shade, ctx);
+}
+
+void triangle_depth(Vec3f *pts, DepthBuffer &zBuffer, int x0, int y0, int x1, int y1, int origin) {
+	RasterTri t;
+	if (!setup_triangle(pts, x0, y0, x1, y1, t, origin)) return;
+	depth_kernel(t, zBuffer.touch(t.x0, t.y0-origin, t.x1, t.y1-origin));
+}
+
+struct IdStore {
+	uint32_t *ids;
+	int width;
+	uint32_t id;
+};
+
+static void store_ids(void *ctx, const Fragment *frags, int n) {
+	IdStore &s = *(IdStore *)ctx;
+	for (int i=0; i<n; i++)
+		s.ids[frags[i].x + (size_t)frags[i].y*s.width] = s.id;
+}
+
+void triangle_ids(Vec3f *pts, DepthBuffer &zBuffer, RenderTarget &ids, uint32_t id, int x0, int y0, int x1, int y1,
+		int origin) {
+	RasterTri t;
+	if (!setup_triangle(pts, x0, y0, x1, y1, t, origin)) return;
+	IdStore s = { ids.touch(t.x0, t.y0-origin, t.x1, t.y1-origin), ids.get_width(), id };
+	raster_kernel(t, zBuffer.touch(t.x0, t.y0-origin, t.x1, t.y1-origin), store_ids, &s);
+}
+
+TiledRasterizer::TiledRasterizer(int width, int height, ThreadPool *pool) : width_(width), height_(height), pool_(pool), profile_(NULL), filter_(Texture::TRILINEAR), shadow_(NULL), origin_(0), tris_(), deferred_(), visible_(0), bins_() {
+	tiles_x_ = (width +TILE_SIZE-1)/TILE_SIZE;
+	tiles_y_ = (height+TILE_SIZE-1)/TILE_SIZE;
+	bins_.resize(tiles_x_*tiles_y_);
+}
+
+void TiledRasterizer::set_filter(Texture::Filter filter) {
+	filter_ = filter;
+}
+
+void TiledRasterizer::set_shadow(const ShadowLookup *shadow) {
+	shadow_ = shadow;
+}
+
+void TiledRasterizer::set_profile(Profile *profile) {
+	profile_ = profile;
+}
+
+void TiledRasterizer::set_origin(int y) {
+	origin_ = y;
+}
+
+int TiledRasterizer::add(Vec3f *pts) {
+	// half a pixel wider all around for the samples of flush_msaa()
+	float xmin = std::min(pts[0].x, std::min(pts[1].x, pts[2].x))-.5f;
+	float xmax = std::max(pts[0].x, std::max(pts[1].x, pts[2].x))+.5f;
+	float ymin = std::min(pts[0].y, std::min(pts[1].y, pts[2].y))-.5f-origin_;
+	float ymax = std::max(pts[0].y, std::max(pts[1].y, pts[2].y))+.5f-origin_;
+	if (xmax<0 || ymax<0 || xmin>width_-1 || ymin>height_-1) return -1;
+
+	int tx0 = std::max(0, (int)std::ceil(xmin)) / TILE_SIZE;
+	int ty0 = std::max(0, (int)std::ceil(ymin)) / TILE_SIZE;
+	int tx1 = std::min(width_ -1, (int)std::floor(xmax)) / TILE_SIZE;
+	int ty1 = std::min(height_-1, (int)std::floor(ymax)) / TILE_SIZE;
+
+	Setup s;
+	for (int i=0; i<3; i++) s.pts[i] = pts[i];
+	int id = (int)tris_.size();
+	tris_.push_back(s);
+	for (int ty=ty0; ty<=ty1; ty++)
+		for (int tx=tx0; tx<=tx1; tx++)
+			bins_[tx+ty*tiles_x_].push_back(id);
+	return id;
+}
+
+void TiledRasterizer::submit(Vec3f *pts, Vec2f *texCoords, float intensity) {
+	int id = add(pts);
+	if (id<0) return;
+	Setup &s = tris_[id];
+	for (int i=0; i<3; i++) s.uv[i] = texCoords[i];
+	s.intensity = intensity;
+}
+
+void TiledRasterizer::submit(Vec3f *pts, const float *varyings, int count) {
+	if (add(pts)<0) return;
+	varyings_.insert(varyings_.end(), varyings, varyings+3*count);
+}
+
+void TiledRasterizer::for_each_tile(int stage, const std::function<void(int t, int x0, int y0, int x1, int y1)> &fn, const RowsDone &done) {
+	(void)stage; // only timed in the PROFILE build
+	// tiles left per row of tiles, rows counted from the top
+	std::unique_ptr<std::atomic<int>[]> left(new std::atomic<int>[tiles_y_]);
+	for (int r=0; r<tiles_y_; r++) left[r] = tiles_x_;
+	std::mutex handing;
+	int next = 0;
+	auto hand_over = [&] {
+		for (; next<tiles_y_ && left[next]==0; next++) {
+			int ty = tiles_y_-1-next;
+			done(ty*TILE_SIZE, std::min((ty+1)*TILE_SIZE, height_));
+		}
+	};
+	pool_->parallel_for(tiles_x_*tiles_y_, [&](int k) {
+		int r = k/tiles_x_;
+		int t = (tiles_y_-1-r)*tiles_x_ + k%tiles_x_;
+		int x0 = (t%tiles_x_)*TILE_SIZE;
+		int y0 = (t/tiles_x_)*TILE_SIZE;
+		{
+			PROFILE_SCOPE(profile_, stage);
+			fn(t, x0, y0, std::min(x0+TILE_SIZE, width_)-1, std::min(y0+TILE_SIZE, height_)-1);
+		}
+		if (done && --left[r]==0) {
+			// whoever is handing rows over already will get to this one, or the sweep below
+			std::unique_lock<std::mutex> guard(handing, std::try_to_lock);
+			if (guard.owns_lock()) hand_over();
+		}
+	});
+	if (done) {
+		std::lock_guard<std::mutex> guard(handing);
+		hand_over();
+	}
+}
+
+void TiledRasterizer::flush(DepthBuffer &zBuffer, Texture &texture, RenderTarget &target, const RowsDone &done) {
+	PROFILE_ADD(profile_, TRIS_RASTERIZED, tris_.size());
+	for_each_tile(STAGE_RASTER, [&](int t, int x0, int y0, int x1, int y1) {
+		std::vector<int> &bin = bins_[t];
+		for (size_t i=0; i<bin.size(); i++) {
+			Setup &s = tris_[bin[i]];
+			triangle_rect(s.pts, zBuffer, s.uv, texture, target, s.intensity, filter_, x0, y0+origin_, x1, y1+origin_, shadow_, origin_);
+		}
+		bin.clear();
+	}, done);
+	tris_.clear();
+}
+
+void TiledRasterizer::flush_msaa(MsaaBuffer &msaa, Texture &texture, RenderTarget &target, const RowsDone &done) {
+	PROFILE_ADD(profile_, TRIS_RASTERIZED, tris_.size());
+	for_each_tile(STAGE_RASTER, [&](int t, int x0, int y0, int x1, int y1) {
+		msaa.clear_tile(t, x0, y0, x1, y1);
+		std::vector<int> &bin = bins_[t];
+		for (size_t i=0; i<bin.size(); i++) {
+			Setup &s = tris_[bin[i]];
+			triangle_msaa(s.pts, msaa, t, s.uv, texture, target, s.intensity, filter_, x0, y0+origin_, x1, y1+origin_, shadow_,
+				origin_);
+		}
+		bin.clear();
+		msaa.resolve_tile(t, x0, y0, x1, y1, target);
+	}, done);
+	tris_.clear();
+}
+
+void TiledRasterizer::flush_depth(DepthBuffer &zBuffer, bool keep) {
+	PROFILE_ADD(profile_, TRIS_RASTERIZED, tris_.size());
+	for_each_tile(STAGE_RASTER, [&](int t, int x0, int y0, int x1, int y1) {
+		std::vector<int> &bin = bins_[t];
+		for (size_t i=0; i<bin.size(); i++)
+			triangle_depth(tris_[bin[i]].pts, zBuffer, x0, y0+origin_, x1, y1+origin_, origin_);
+		if (!keep) bin.clear();
+	}, RowsDone());
+	if (!keep) {
+		tris_.clear();
+		varyings_.clear();
+	}
+}
+
+void TiledRasterizer::flush_ids(DepthBuffer &zBuffer, RenderTarget &ids) {
+	ids.clear(NO_TRIANGLE);
+	PROFILE_ADD(profile_, TRIS_RASTERIZED, tris_.size());
+	for_each_tile(STAGE_RASTER, [&](int t, int x0, int y0, int x1, int y1) {
+		std::vector<int> &bin = bins_[t];
+		for (size_t i=0; i<bin.size(); i++) {
+			Setup &s = tris_[bin[i]];
+			triangle_ids(s.pts, zBuffer, ids, bin[i], x0, y0+origin_, x1, y1+origin_, origin_);
+		}
+		bin.clear();
+	}, RowsDone());
+}
+
+void TiledRasterizer::shade_ids(RenderTarget &ids, Texture &texture, RenderTarget &target, const RowsDone &done) {
+	// edge functions and lod of every triangle, set up once for all its pixels
+	const int CHUNK = 4096;
+	deferred_.resize(tris_.size());
+	pool_->parallel_for(((int)tris_.size()+CHUNK-1)/CHUNK, [&](int c) {
+		PROFILE_SCOPE(profile_, STAGE_SETUP);
+		int end = std::min((int)tris_.size(), (c+1)*CHUNK);
+		for (int i=c*CHUNK; i<end; i++) {
+			Deferred &d = deferred_[i];
+			// pixels of a triangle without any were never written
+			if (!setup_triangle(tris_[i].pts, 0, origin_, width_-1, origin_+height_-1, d.tri, origin_)) continue;
+			d.lod = triangle_lod(d.tri, tris_[i].uv, texture);
+		}
+	});
+
+	std::vector<unsigned long long> visible(tiles_x_*tiles_y_);
+	for_each_tile(STAGE_SHADE, [&](int t, int x0, int y0, int x1, int y1) {
+		// a tile nothing was drawn to keeps the pending clear of the target
+		if (!ids.touched(x0, y0)) return;
+		uint32_t *pixels = target.touch(x0, y0, x1, y1);
+		// runs of pixels of the same triangle go to the shader together
+		Fragment frags[MAX_FRAGMENTS];
+		int n = 0;
+		uint32_t id = NO_TRIANGLE;
+		TexturedShade s = { NULL, &texture, pixels, target.get_width(), 0, filter_, 0, NULL, shadow_, origin_ };
+		unsigned long long count = 0;
+		for (int y=y0; y<=y1; y++) {
+			const uint32_t *row = ids.row(y);
+			for (int x=x0; x<=x1; x++) {
+				if (row[x]==NO_TRIANGLE) continue;
+				count++;
+				if (row[x]!=id || n==MAX_FRAGMENTS) {
+					if (n) shade_textured(&s, frags, n);
+					n = 0;
+					id = row[x];
+					Setup &tri = tris_[id];
+					s.texCoords = tri.uv;
+					s.intensity = tri.intensity;
+					s.lod = deferred_[id].lod;
+					s.z = deferred_[id].tri.z;
+				}
+				const RasterTri &rt = deferred_[id].tri;
+				Fragment &f = frags[n++];
+				f.x = x;
+				f.y = y;
+				for (int i=0; i<3; i++) f.bary[i] = (rt.C[i] + rt.A[i]*x + rt.B[i]*(y+origin_))*rt.inv_area;
+			}
+		}
+		if (n) shade_textured(&s, frags, n);
+		visible[t] = count;
+	}, done);
+	tris_.clear();
+	visible_ = 0;
+	for (size_t t=0; t<visible.size(); t++) visible_ += visible[t];
+}
@@ -0,0 +1,146 @@
+#ifndef __RASTER_H__
+#define __RASTER_H__
+
+#include <vector>
+#include <functional>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "rasterkernel.h"
+#include "zbuffer.h"
+#include "texture.h"
+#include "rendertarget.h"
+#include "msaa.h"
+
+class ThreadPool;
+class Profile;
+
+// A depth map rendered from the light (see render_model()) and how to get
+// there from the frame: to_map takes screen x, y and depth to map texels and
+// map depth, through a divide by w.
+struct ShadowLookup {
+	static const float SHADOW_LIGHT; // what is left of the light in the shadow
+	static const float MAX_SLOPE;    // of the bias, faces at a slant get more
+	const float *depth;
+	int width, height;
+	Matrix to_map;
+	float bias; // map depth a face square to the light may be behind the map and still be lit
+};
+
+Vec3f barycentric(Vec3f *pts, Vec3f P);
+Vec2f bary2Cart(Vec2f *texCoords, Vec3f bary);
+void line(Vec2i p0, Vec2i p1, TGAImage &image, TGAColor color);
+void triangle(Vec3f *pts, DepthBuffer &zBuffer, Vec2f *texCoords, Texture &texture, RenderTarget &target, float intensity,
+		Texture::Filter filter=Texture::TRILINEAR);
+// same as triangle(), but only touches pixels in [x0,x1]x[y0,y1]; with a
+// shadow the intensity drops to SHADOW_LIGHT of it where the light is blocked.
+// pts and the box are in frame coordinates, zBuffer and target hold the frame
+// rows from origin up, a multiple of TiledRasterizer::TILE_SIZE (see RasterTri);
+// the same goes for the functions below that take an origin.
+void triangle_rect(Vec3f *pts, DepthBuffer &zBuffer, Vec2f *texCoords, Texture &texture, RenderTarget &target, float intensity,
+		Texture::Filter filter, int x0, int y0, int x1, int y1, const ShadowLookup *shadow=NULL, int origin=0);
+// triangle_rect() into the samples of msaa instead, tile t of it being the one
+// [x0,x1]x[y0,y1] is in: every sample covered is depth tested, every pixel
+// with samples passing is shaded once, at the centroid of them, with target
+// as the scratch the colour goes through
+void triangle_msaa(Vec3f *pts, MsaaBuffer &msaa, int t, Vec2f *texCoords, Texture &texture, RenderTarget &target,
+		float intensity, Texture::Filter filter, int x0, int y0, int x1, int y1, const ShadowLookup *shadow=NULL,
+		int origin=0);
+// depth test and depth write only, for shadow maps and depth prepasses
+void triangle_depth(Vec3f *pts, DepthBuffer &zBuffer, int x0, int y0, int x1, int y1, int origin=0);
+// writes id into ids where pts passes the depth test, instead of shading
+void triangle_ids(Vec3f *pts, DepthBuffer &zBuffer, RenderTarget &ids, uint32_t id, int x0, int y0, int x1, int y1,
+		int origin=0);
+// edge functions and pixel box of pts clipped to [x0,x1]x[y0,y1], false if nothing to draw
+bool setup_triangle(Vec3f *pts, int x0, int y0, int x1, int y1, RasterTri &t, int origin=0);
+// runs the kernel of raster_kernel_name() over a set up triangle, shade gets
+// the fragments that pass the depth test one block at a time
+void raster_triangle(const RasterTri &t, DepthBuffer &zBuffer, FragmentFn shade, void *ctx);
+// kernel picked from cpuid at startup: "scalar", "avx2" or "avx512"
+const char *raster_kernel_name();
+
+// Binned rasterizer: submit() sets a triangle up and drops it in the bins of
+// every screen tile its box touches, flush() rasterizes the tiles in parallel.
+// A tile owns its piece of the zbuffer and of the image, and its bin keeps
+// submission order, so the result is the same as calling triangle() in a loop.
+// Tiles are taken from the top row of tiles down, and flush() can hand every
+// finished row of tiles over while the rows below are still being drawn.
+class TiledRasterizer {
+public:
+	static const int TILE_SIZE = DepthBuffer::TILE; // a tile owns its hi-z tile too
+	// pixel rows [y0,y1) are final; called in order from the top of the
+	// image down, one call at a time, from whichever thread got there
+	typedef std::function<void(int y0, int y1)> RowsDone;
+
+	TiledRasterizer(int width, int height, ThreadPool *pool);
+	void set_filter(Texture::Filter filter);
+	// the shadow map flush() and shade_ids() look up, NULL for none; it has to
+	// stay around until then
+	void set_shadow(const ShadowLookup *shadow);
+	// where the tiles are timed, NULL for nowhere
+	void set_profile(Profile *profile);
+	// The frame row of row 0 of the targets, for drawing a frame a strip of
+	// rows at a time; a multiple of TILE_SIZE. Triangles are submitted in
+	// frame coordinates all the same, and come out bit for bit like in the
+	// whole frame. RowsDone gets rows of the targets.
+	void set_origin(int y);
+	void submit(Vec3f *pts, Vec2f *texCoords, float intensity);
+	void flush(DepthBuffer &zBuffer, Texture &texture, RenderTarget &target, const RowsDone &done=RowsDone());
+	// Depth only, no texture and no colour. With keep the triangles stay
+	// binned, so a flush() right after draws them again: a depth prepass, that
+	// leaves only the visible fragment of every pixel passing the depth test.
+	void flush_depth(DepthBuffer &zBuffer, bool keep=false);
+	// flush() multisampled: each tile is cleared in msaa, drawn into it and
+	// resolved into target, zBuffer is not used
+	void flush_msaa(MsaaBuffer &msaa, Texture &texture, RenderTarget &target, const RowsDone &done=RowsDone());
+
+	// Triangles for a shader of shader.h: count floats of varyings go along
+	// with every corner, flush_shaded() draws them with the shader. Don't mix
+	// them with the textured triangles of submit() before one flush.
+	void submit(Vec3f *pts, const float *varyings, int count);
+	template <class Shader> void flush_shaded(DepthBuffer &zBuffer, const Shader &shader, RenderTarget &target,
+			const RowsDone &done=RowsDone());
+
+	// Deferred shading, in two passes. flush_ids() is the depth pass: it
+	// clears ids to NO_TRIANGLE and stores the index of the triangle seen at
+	// each pixel, no texture is touched. shade_ids() then goes over the tiles
+	// in parallel and shades every pixel with a triangle exactly once, the
+	// pixels of a triangle next to each other together. Nothing may be
+	// submitted in between.
+	static const uint32_t NO_TRIANGLE = 0xffffffff;
+	void flush_ids(DepthBuffer &zBuffer, RenderTarget &ids);
+	void shade_ids(RenderTarget &ids, Texture &texture, RenderTarget &target, const RowsDone &done=RowsDone());
+	// pixels shaded by the last shade_ids(); the fragments that passed the
+	// depth test over this is the overdraw forward shading would have had
+	unsigned long long visible_pixels() const { return visible_; }
+
+private:
+	struct Setup {
+		Vec3f pts[3];
+		Vec2f uv[3];
+		float intensity;
+	};
+	struct Deferred {
+		RasterTri tri;
+		float lod;
+	};
+
+	// adds pts to tris_ and its id to the bins under it, -1 if it is off screen
+	int add(Vec3f *pts);
+	// fn(tile, its pixel box) on the pool, the top row of tiles first, each tile timed as stage
+	void for_each_tile(int stage, const std::function<void(int t, int x0, int y0, int x1, int y1)> &fn, const RowsDone &done);
+
+	int width_, height_;
+	int tiles_x_, tiles_y_;
+	ThreadPool *pool_;
+	Profile *profile_;
+	Texture::Filter filter_;
+	const ShadowLookup *shadow_;
+	int origin_;
+	std::vector<Setup> tris_;
+	std::vector<float> varyings_;
+	std::vector<Deferred> deferred_;
+	unsigned long long visible_;
+	std::vector<std::vector<int> > bins_;
+};
+
+#endif //__RASTER_H__
@@ -0,0 +1,42 @@
+#include <immintrin.h>
+#include "rasterkernel_impl.h"
+
+// built with -mavx2, only ever called when cpuid says so
+struct LanesAVX2 {
+	enum { LX=8, LY=1 };
+	typedef __m256 F;
+	typedef __m256 M;
+
+	static F set1(float v)   { return _mm256_set1_ps(v); }
+	static F add(F a, F b)   { return _mm256_add_ps(a, b); }
+	static F mul(F a, F b)   { return _mm256_mul_ps(a, b); }
+	static F lane_dx()       { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+	static F lane_dy()       { return _mm256_setzero_ps(); }
+	static M all()           { return _mm256_castsi256_ps(_mm256_set1_epi32(-1)); }
+	static M ge0(F w)        { return _mm256_cmp_ps(w, _mm256_setzero_ps(), _CMP_GE_OQ); }
+	static M le(F a, F b)    { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+	static M and_(M a, M b)  { return _mm256_and_ps(a, b); }
+	static unsigned bits(M m) { return (unsigned)_mm256_movemask_ps(m); }
+
+	static M rect(int x, int y, const RasterTri &t) {
+		if (y<t.y0 || y>t.y1) return _mm256_setzero_ps();
+		F xs = _mm256_add_ps(_mm256_set1_ps(x), lane_dx());
+		return _mm256_and_ps(_mm256_cmp_ps(xs, _mm256_set1_ps(t.x0), _CMP_GE_OQ),
+		                     _mm256_cmp_ps(xs, _mm256_set1_ps(t.x1), _CMP_LE_OQ));
+	}
+	static F load(const float *p, int, M m) {
+		return _mm256_maskload_ps(p, _mm256_castps_si256(m));
+	}
+	static void store(float *p, int, M m, F v) {
+		_mm256_maskstore_ps(p, _mm256_castps_si256(m), v);
+	}
+	static void spill(float *out, F v) { _mm256_storeu_ps(out, v); }
+};
+
+void raster_kernel_avx2(const RasterTri &tri, DepthTarget &depth, FragmentFn shade, void *ctx) {
+	raster_blocks<LanesAVX2>(tri, depth, shade, ctx);
+}
+
+void depth_kernel_avx2(const RasterTri &tri, DepthTarget &depth) {
+	raster_blocks<LanesAVX2, true>(tri, depth, NULL, NULL);
+}
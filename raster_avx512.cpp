@@ -0,0 +1,48 @@
+#include <immintrin.h>
+#include "rasterkernel_impl.h"
+
+// built with -mavx512f, only ever called when cpuid says so.
+// 16 lanes cover two rows of 8 pixels; the second row is reached with a masked
+// access shifted by stride-8 floats, so only AVX-512F is needed.
+struct LanesAVX512 {
+	enum { LX=8, LY=2 };
+	typedef __m512 F;
+	typedef __mmask16 M;
+
+	static F set1(float v)   { return _mm512_set1_ps(v); }
+	static F add(F a, F b)   { return _mm512_add_ps(a, b); }
+	static F mul(F a, F b)   { return _mm512_mul_ps(a, b); }
+	static F lane_dx()       { return _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7); }
+	static F lane_dy()       { return _mm512_setr_ps(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1); }
+	static M all()           { return 0xFFFF; }
+	static M ge0(F w)        { return _mm512_cmp_ps_mask(w, _mm512_setzero_ps(), _CMP_GE_OQ); }
+	static M le(F a, F b)    { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+	static M and_(M a, M b)  { return a & b; }
+	static unsigned bits(M m) { return (unsigned)m; }
+
+	static M rect(int x, int y, const RasterTri &t) {
+		F xs = _mm512_add_ps(_mm512_set1_ps(x), lane_dx());
+		F ys = _mm512_add_ps(_mm512_set1_ps(y), lane_dy());
+		M m = _mm512_cmp_ps_mask(xs, _mm512_set1_ps(t.x0), _CMP_GE_OQ);
+		m = _mm512_mask_cmp_ps_mask(m, xs, _mm512_set1_ps(t.x1), _CMP_LE_OQ);
+		m = _mm512_mask_cmp_ps_mask(m, ys, _mm512_set1_ps(t.y0), _CMP_GE_OQ);
+		return _mm512_mask_cmp_ps_mask(m, ys, _mm512_set1_ps(t.y1), _CMP_LE_OQ);
+	}
+	static F load(const float *p, int stride, M m) {
+		F v = _mm512_maskz_loadu_ps(m & 0x00FF, p);
+		return _mm512_mask_loadu_ps(v, m & 0xFF00, p+stride-8);
+	}
+	static void store(float *p, int stride, M m, F v) {
+		_mm512_mask_storeu_ps(p, m & 0x00FF, v);
+		_mm512_mask_storeu_ps(p+stride-8, m & 0xFF00, v);
+	}
+	static void spill(float *out, F v) { _mm512_storeu_ps(out, v); }
+};
+
+void raster_kernel_avx512(const RasterTri &tri, DepthTarget &depth, FragmentFn shade, void *ctx) {
+	raster_blocks<LanesAVX512>(tri, depth, shade, ctx);
+}
+
+void depth_kernel_avx512(const RasterTri &tri, DepthTarget &depth) {
+	raster_blocks<LanesAVX512, true>(tri, depth, NULL, NULL);
+}
@@ -0,0 +1,71 @@
+#ifndef __RASTERKERNEL_H__
+#define __RASTERKERNEL_H__
+
+// Edge-function triangle kernels. Edge i is A*x + B*y + C, positive inside and
+// zero on the edge opposite to vertex i; the setup flips the signs so the
+// area is always positive. The kernels walk the clipped box in 8x8 blocks,
+// throw away blocks that are outside of an edge, skip the edge tests for
+// blocks that are fully inside, depth test a whole row of pixels at once and
+// hand the surviving fragments over to the caller one block at a time.
+//
+// Depth is bigger-is-nearer, a fragment passes when stored <= z. Before any
+// coverage work the kernels check the coarse min/max depth of every 64x64 tile
+// and 8x8 block: if the nearest point of the triangle over it is behind the
+// farthest stored depth the whole tile/block is dropped, if its farthest point
+// is in front of the nearest stored depth the per pixel depth test is skipped.
+
+// The edges and the box are in frame coordinates. A target that holds only
+// the frame rows from origin up (a strip, see render_model_strips()) is
+// indexed, and gets its fragments, in rows of its own: origin is a multiple
+// of 64, so the 8x8 blocks and 64x64 tiles are the ones of the whole frame
+// and every pixel comes out bit for bit like there.
+struct RasterTri {
+	float A[3], B[3], C[3];
+	float z[3];
+	float inv_area;
+	int x0, y0, x1, y1; // inclusive pixel box, already clipped
+	int origin;         // frame row of row 0 of the target
+};
+
+struct Fragment {
+	int x, y;
+	float bary[3];
+};
+
+// Where the fragments went, one set per 64x64 tile so that tiles rendered on
+// different threads never share a counter. "pixels" are the pixels of the
+// triangle box that were skipped, not all of them would have been covered.
+struct HiZStats {
+	unsigned long long tile_rejects, tile_pixels;
+	unsigned long long block_rejects, block_pixels;
+	unsigned long long fragments_tested, fragments_failed;
+};
+
+// Plain view of a DepthBuffer for the kernels
+struct DepthTarget {
+	float *z;
+	int width, height;
+	float *min8, *max8;    // per 8x8 block, bw blocks per row
+	int bw;
+	float *min64, *max64;  // per 64x64 tile, tw tiles per row
+	unsigned char *dirty64; // tile bounds are stale, rebuild from the blocks
+	int tw;
+	HiZStats *stats;       // per 64x64 tile
+};
+
+typedef void (*FragmentFn)(void *ctx, const Fragment *frags, int n);
+typedef void (*RasterKernel)(const RasterTri &tri, DepthTarget &depth, FragmentFn shade, void *ctx);
+
+void raster_kernel_scalar(const RasterTri &tri, DepthTarget &depth, FragmentFn shade, void *ctx);
+void raster_kernel_avx2  (const RasterTri &tri, DepthTarget &depth, FragmentFn shade, void *ctx);
+void raster_kernel_avx512(const RasterTri &tri, DepthTarget &depth, FragmentFn shade, void *ctx);
+
+// the same walk and depth test, the depths are stored and that is all: no
+// barycentrics are spilled and nothing is handed over
+typedef void (*DepthKernel)(const RasterTri &tri, DepthTarget &depth);
+
+void depth_kernel_scalar(const RasterTri &tri, DepthTarget &depth);
+void depth_kernel_avx2  (const RasterTri &tri, DepthTarget &depth);
+void depth_kernel_avx512(const RasterTri &tri, DepthTarget &depth);
+
+#endif //__RASTERKERNEL_H__
@@ -0,0 +1,183 @@
+#ifndef __RASTERKERNEL_IMPL_H__
+#define __RASTERKERNEL_IMPL_H__
+
+// The block walker shared by every kernel. Each raster_*.cpp includes this with
+// its own lane type and its own -m flags, so it is kept in an anonymous namespace:
+// the differently compiled copies must never be merged by the linker.
+//
+// A lane type L packs LX x LY pixels (LX is 8 or 1) and provides
+//   F, M                  float vector and mask types
+//   set1, add, mul        the usual
+//   lane_dx(), lane_dy()  pixel offsets of the lanes
+//   all(), ge0(w), le(a,b), and_(a,b), bits(m)
+//   rect(x, y, tri)       lanes inside the box of tri
+//   load(p, stride, m), store(p, stride, m, v)  masked zbuffer access
+//   spill(float *out, v)  writes the N lanes to memory
+
+#include <algorithm>
+#include <cmath>
+#include "rasterkernel.h"
+
+namespace {
+
+// recompute the bounds of an 8x8 block from the pixels, by in rows of the target
+inline void refresh_block(DepthTarget &d, int bx, int by) {
+	int x1 = std::min(bx+8, d.width), y1 = std::min(by+8, d.height);
+	float mn = d.z[bx+(size_t)by*d.width], mx = mn;
+	for (int y=by; y<y1; y++) {
+		const float *row = d.z + (size_t)y*d.width;
+		for (int x=bx; x<x1; x++) {
+			mn = std::min(mn, row[x]);
+			mx = std::max(mx, row[x]);
+		}
+	}
+	int b = bx/8 + (by/8)*d.bw;
+	d.min8[b] = mn;
+	d.max8[b] = mx;
+}
+
+// recompute the bounds of a 64x64 tile from its blocks
+inline void refresh_tile(DepthTarget &d, int t) {
+	int bx0 = (t%d.tw)*8, by0 = (t/d.tw)*8;
+	int bx1 = std::min(bx0+8, d.bw), by1 = std::min(by0+8, (d.height+7)/8);
+	float mn = d.min8[bx0+by0*d.bw], mx = d.max8[bx0+by0*d.bw];
+	for (int by=by0; by<by1; by++) {
+		for (int bx=bx0; bx<bx1; bx++) {
+			mn = std::min(mn, d.min8[bx+by*d.bw]);
+			mx = std::max(mx, d.max8[bx+by*d.bw]);
+		}
+	}
+	d.min64[t] = mn;
+	d.max64[t] = mx;
+	d.dirty64[t] = 0;
+}
+
+// DEPTH_ONLY stores the depths and hands nothing over, shade is never called;
+// the depths are computed exactly like the shading walk does them
+template <class L, bool DEPTH_ONLY=false> void raster_blocks(const RasterTri &t, DepthTarget &d, FragmentFn shade, void *ctx) {
+	typedef typename L::F F;
+	typedef typename L::M M;
+	const int N = L::LX*L::LY;
+
+	Fragment frags[64];
+	float lb[3][N];
+	F dx = L::lane_dx(), dy = L::lane_dy();
+	F inv = L::set1(t.inv_area);
+	F z0 = L::set1(t.z[0]), z1 = L::set1(t.z[1]), z2 = L::set1(t.z[2]);
+	F stepx[3], stepy[3];
+	for (int i=0; i<3; i++) {
+		stepx[i] = L::set1(t.A[i]*L::LX);
+		stepy[i] = L::set1(t.B[i]*L::LY);
+	}
+
+	// depth plane z = zc + zx*x + zy*y, used for the coarse tests only; the
+	// slack covers the rounding of the interpolated depth
+	float zx = 0, zy = 0, zc = 0;
+	for (int i=0; i<3; i++) {
+		zx += t.z[i]*t.A[i]*t.inv_area;
+		zy += t.z[i]*t.B[i]*t.inv_area;
+		zc += t.z[i]*t.C[i]*t.inv_area;
+	}
+	float tzmin = std::min(t.z[0], std::min(t.z[1], t.z[2]));
+	float tzmax = std::max(t.z[0], std::max(t.z[1], t.z[2]));
+	float slack = 1e-4f*std::max(std::abs(tzmin), std::abs(tzmax));
+	const int oy = t.origin;
+
+	for (int ty=t.y0&~63; ty<=t.y1; ty+=64) {
+		for (int tx=t.x0&~63; tx<=t.x1; tx+=64) {
+			int ti = tx/64 + ((ty-oy)/64)*d.tw;
+			HiZStats &st = d.stats[ti];
+			int cx0 = std::max(tx, t.x0), cx1 = std::min(tx+63, t.x1);
+			int cy0 = std::max(ty, t.y0), cy1 = std::min(ty+63, t.y1);
+			if (d.dirty64[ti]) refresh_tile(d, ti);
+			if (tzmax+slack < d.min64[ti]) {
+				st.tile_rejects++;
+				st.tile_pixels += (cx1-cx0+1)*(cy1-cy0+1);
+				continue;
+			}
+
+			for (int by=cy0&~7; by<=cy1; by+=8) {
+				for (int bx=cx0&~7; bx<=cx1; bx+=8) {
+					// trivial reject / accept on the block corners
+					bool reject = false, inside = true;
+					for (int i=0; i<3 && !reject; i++) {
+						float lo = t.C[i] + t.A[i]*(t.A[i]>0 ? bx : bx+7) + t.B[i]*(t.B[i]>0 ? by : by+7);
+						float hi = t.C[i] + t.A[i]*(t.A[i]>0 ? bx+7 : bx) + t.B[i]*(t.B[i]>0 ? by+7 : by);
+						if (hi<0) reject = true;
+						if (lo<0) inside = false;
+					}
+					if (reject) continue;
+
+					// nearest and farthest point of the plane over the block
+					int bi = bx/8 + ((by-oy)/8)*d.bw;
+					float pmin = zc + zx*(zx>0 ? bx : bx+7) + zy*(zy>0 ? by : by+7);
+					float pmax = zc + zx*(zx>0 ? bx+7 : bx) + zy*(zy>0 ? by+7 : by);
+					float bzmax = std::min(pmax, tzmax) + slack;
+					float bzmin = std::max(pmin, tzmin) - slack;
+					int px0 = std::max(bx, cx0), px1 = std::min(bx+7, cx1);
+					int py0 = std::max(by, cy0), py1 = std::min(by+7, cy1);
+					if (bzmax < d.min8[bi]) {
+						st.block_rejects++;
+						st.block_pixels += (px1-px0+1)*(py1-py0+1);
+						continue;
+					}
+					bool pass = bzmin >= d.max8[bi];
+					bool clip = bx<px0 || by<py0 || bx+7>px1 || by+7>py1;
+					RasterTri box = t;
+					box.x0 = px0; box.x1 = px1; box.y0 = py0; box.y1 = py1;
+
+					F roww[3];
+					for (int i=0; i<3; i++)
+						roww[i] = L::add(L::add(L::set1(t.C[i]), L::mul(L::set1(t.A[i]), L::add(L::set1(bx), dx))),
+						                 L::mul(L::set1(t.B[i]), L::add(L::set1(by), dy)));
+					int nfrags = 0;
+					bool wrote = false;
+					for (int ry=0; ry<8 && by+ry<=py1; ry+=L::LY) {
+						int y = by+ry;
+						F w[3] = {roww[0], roww[1], roww[2]};
+						for (int rx=0; rx<8 && bx+rx<=px1; rx+=L::LX) {
+							int x = bx+rx;
+							M m = clip ? L::rect(x, y, box) : L::all();
+							if (!inside) m = L::and_(m, L::and_(L::ge0(w[0]), L::and_(L::ge0(w[1]), L::ge0(w[2]))));
+							unsigned covered = L::bits(m);
+							if (covered) {
+								F b0 = L::mul(w[0], inv), b1 = L::mul(w[1], inv), b2 = L::mul(w[2], inv);
+								F z = L::add(L::add(L::mul(z0, b0), L::mul(z1, b1)), L::mul(z2, b2));
+								float *zp = d.z + x + (size_t)(y-oy)*d.width;
+								if (!pass) m = L::and_(m, L::le(L::load(zp, d.width, m), z));
+								unsigned bits = L::bits(m);
+								st.fragments_tested += __builtin_popcount(covered);
+								st.fragments_failed += __builtin_popcount(covered) - __builtin_popcount(bits);
+								if (bits && DEPTH_ONLY) {
+									L::store(zp, d.width, m, z);
+									wrote = true;
+								} else if (bits) {
+									L::store(zp, d.width, m, z);
+									L::spill(lb[0], b0); L::spill(lb[1], b1); L::spill(lb[2], b2);
+									for (int l=0; l<N; l++) {
+										if (!(bits>>l & 1)) continue;
+										Fragment &f = frags[nfrags++];
+										f.x = x + l%L::LX;
+										f.y = y-oy + l/L::LX;
+										f.bary[0] = lb[0][l]; f.bary[1] = lb[1][l]; f.bary[2] = lb[2][l];
+									}
+								}
+							}
+							for (int i=0; i<3; i++) w[i] = L::add(w[i], stepx[i]);
+						}
+						for (int i=0; i<3; i++) roww[i] = L::add(roww[i], stepy[i]);
+					}
+					if (nfrags || wrote) {
+						refresh_block(d, bx, by-oy);
+						d.dirty64[ti] = 1;
+						if (nfrags) shade(ctx, frags, nfrags);
+					}
+				}
+			}
+		}
+	}
+}
+
+} // namespace
+
+#endif //__RASTERKERNEL_IMPL_H__
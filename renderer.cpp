@@ -0,0 +1,406 @@
+#include <algorithm>
+#include <cmath>
+#include "renderer.h"
+#include "model.h"
+#include "texture.h"
+#include "meshlet.h"
+#include "threadpool.h"
+#include "profile.h"
+
+Camera::Camera() : eye(0, 0, 1), center(0, 0, 0), up(0, 1, 0), perspective(false) {
+}
+
+Matrix lookat(Vec3f eye, Vec3f center, Vec3f up) {
+	Vec3f z = (eye-center).normalize();
+	Vec3f x = cross(up, z).normalize();
+	Vec3f y = cross(z, x).normalize();
+	Matrix rot = Matrix::identity();
+	Matrix tr = Matrix::identity();
+	for (int i=0; i<3; i++) {
+		rot[0][i] = x[i];
+		rot[1][i] = y[i];
+		rot[2][i] = z[i];
+		tr[i][3] = -center[i];
+	}
+	return rot*tr;
+}
+
+Matrix projection(float coeff) {
+	Matrix m = Matrix::identity();
+	m[3][2] = coeff;
+	return m;
+}
+
+Matrix viewport(int x, int y, int w, int h) {
+	Matrix m = Matrix::identity();
+	m[0][0] = w/2.f;
+	m[1][1] = h/2.f;
+	m[0][3] = x+w/2.f;
+	m[1][3] = y+h/2.f;
+	return m;
+}
+
+Matrix camera_matrix(const Camera &camera, int width, int height) {
+	float dist = (camera.center-camera.eye).norm();
+	return viewport(0, 0, width, height)*projection(camera.perspective ? -1.f/dist : 0.f)
+		*lookat(camera.eye, camera.center, camera.up);
+}
+
+ShadowMap::ShadowMap(int size, ThreadPool *pool) : size(size), depth(size, size), raster(size, size, pool), vertices(),
+		assembler(size, size), lookup() {
+	// nothing is seen from the back in there, the light reaches both sides
+	assembler.set_cull_backfaces(false);
+	// in texels of the map, which is in texels deep too
+	lookup.bias = 1.f;
+}
+
+FrameBuffer::FrameBuffer(int width, int height, ThreadPool *pool) : width_(width), height_(height), pool_(pool),
+		color_(width, height), output_(width, height, TGAImage::RGB), depth_(width, height), raster_(width, height, pool), vertices_(),
+		assembler_(width, height), band_(), shading_(FORWARD), ids_(), shadows_(0), shadow_(), zprepass_(false),
+		samples_(1), msaa_(), profile_(NULL) {
+}
+
+RenderTarget &FrameBuffer::ids() {
+	if (!ids_) ids_.reset(new RenderTarget(width_, height_));
+	return *ids_;
+}
+
+void FrameBuffer::set_shadows(int size) {
+	shadows_ = std::max(size, 0);
+	if (shadow_ && shadow_->size!=shadows_) shadow_.reset();
+}
+
+ShadowMap *FrameBuffer::shadow_map() {
+	if (!shadows_) return NULL;
+	if (!shadow_) shadow_.reset(new ShadowMap(shadows_, pool_));
+	return shadow_.get();
+}
+
+void FrameBuffer::set_samples(int samples) {
+	samples_ = MsaaBuffer::supported(samples) ? samples : 1;
+	if (msaa_ && msaa_->samples()!=samples_) msaa_.reset();
+}
+
+MsaaBuffer *FrameBuffer::msaa() {
+	if (samples_==1) return NULL;
+	if (!msaa_) msaa_.reset(new MsaaBuffer(width_, height_, samples_));
+	return msaa_.get();
+}
+
+TGAImage &FrameBuffer::resolve(bool flip) {
+	color_.resolve(output_, flip);
+	return output_;
+}
+
+void FrameBuffer::set_profile(Profile *profile) {
+	profile_ = profile;
+	raster_.set_profile(profile);
+}
+
+bool FrameBuffer::write_rows(TGAWriter &out, int y0, int y1) {
+	PROFILE_SCOPE(profile_, STAGE_WRITE);
+	band_.resize((size_t)width_*(y1-y0)*TGAImage::RGB);
+	color_.resolve_rows(y0, y1, &band_[0], true);
+	return out.write_rows(&band_[0], y1-y0, pool_);
+}
+
+namespace {
+
+// Renders the depth of model as the light sees it into map and points its
+// lookup at it, with mvp the matrix of the frame. Returns false if there is
+// nothing to cast a shadow.
+bool render_shadow_map(Model &model, const Matrix &mvp, Vec3f light, ShadowMap &map, ThreadPool *pool) {
+	const MeshView &v = model.view();
+	if (!v.nverts || light.norm()<=0) return false;
+	Vec3f lo(v.vx[0], v.vy[0], v.vz[0]), hi = lo;
+	for (uint32_t i=1; i<v.nverts; i++) {
+		lo = Vec3f(std::min(lo.x, v.vx[i]), std::min(lo.y, v.vy[i]), std::min(lo.z, v.vz[i]));
+		hi = Vec3f(std::max(hi.x, v.vx[i]), std::max(hi.y, v.vy[i]), std::max(hi.z, v.vz[i]));
+	}
+	// looking along the light, any up that isn't parallel to it will do
+	Vec3f up = std::fabs(light.y)<.99f ? Vec3f(0, 1, 0) : Vec3f(1, 0, 0);
+	Matrix view = lookat(light*-1.f, Vec3f(0, 0, 0), up);
+	// the corners of the box in light space, fit into the map with a texel to
+	// spare on every side; depth gets the same scale, so it is in texels too
+	Vec3f vlo, vhi;
+	for (int i=0; i<8; i++) {
+		Vec3f c(i&1 ? hi.x : lo.x, i&2 ? hi.y : lo.y, i&4 ? hi.z : lo.z);
+		Vec4f p = view*embed<4>(c);
+		Vec3f q(p[0], p[1], p[2]);
+		vlo = i ? Vec3f(std::min(vlo.x, q.x), std::min(vlo.y, q.y), std::min(vlo.z, q.z)) : q;
+		vhi = i ? Vec3f(std::max(vhi.x, q.x), std::max(vhi.y, q.y), std::max(vhi.z, q.z)) : q;
+	}
+	float extent = std::max(std::max(vhi.x-vlo.x, vhi.y-vlo.y), 1e-6f);
+	float scale = (map.size-3)/extent;
+	Matrix fit = Matrix::identity();
+	for (int i=0; i<3; i++) fit[i][i] = scale;
+	fit[0][3] = 1-vlo.x*scale;
+	fit[1][3] = 1-vlo.y*scale;
+	fit[2][3] = -vlo.z*scale;
+	Matrix light_mvp = fit*view;
+
+	map.depth.clear();
+	transform_vertices(light_mvp, v, map.vertices, pool);
+	AssembledTri tris[PrimitiveAssembler::MAX_TRIS];
+	Vec2f uv[3];
+	for (uint32_t i=0; i<v.nfaces; i++) {
+		int n = map.assembler.assemble(map.vertices, v.faces+3*i, uv, tris);
+		for (int k=0; k<n; k++)
+			map.raster.submit(tris[k].pts, tris[k].uv, 0);
+	}
+	map.raster.flush_depth(map.depth);
+
+	map.lookup.depth = map.depth.buffer();
+	map.lookup.width = map.lookup.height = map.size;
+	map.lookup.to_map = light_mvp*mvp.invert();
+	return true;
+}
+
+// meshlets per task of assemble_model()
+const int MESHLET_GROUP = 16;
+
+// what assembly made of a face, kept until its turn to be submitted
+struct ClusterTri {
+	AssembledTri tri;
+	float intensity;
+};
+
+// Tests the meshlets of model against camera, with mvp its matrix for the
+// frame of assembler, and runs the vertex stage and assembly of the ones left
+// a meshlet at a time: the faces of the others are never fetched. Groups of
+// meshlets go in parallel on pool, each on its own copy of assembler. Every
+// triangle that comes out goes to submit(pts, uv, intensity) in meshlet
+// order, whatever the threads did.
+template <class Submit> void assemble_model(Model &model, const Matrix &mvp, const Camera &camera,
+		PrimitiveAssembler &assembler, Vec3f light, ThreadPool *pool, Submit submit) {
+	const MeshView &mesh = model.view();
+	MeshletCuller culler(mvp, camera, assembler.get_width(), assembler.get_height());
+	int ngroups = (int)(mesh.nmeshlets+MESHLET_GROUP-1)/MESHLET_GROUP;
+	std::vector<std::vector<ClusterTri> > groups(ngroups);
+	std::vector<CullStats> stats(ngroups);
+	auto assemble_group = [&](int g) {
+		PrimitiveAssembler local = assembler;
+		local.reset_stats();
+		CullStats clusters = CullStats();
+		VertexBuffer vb;
+		vb.resize(Meshlet::MAX_VERTS);
+		float x[Meshlet::MAX_VERTS], y[Meshlet::MAX_VERTS], z[Meshlet::MAX_VERTS];
+		AssembledTri tris[PrimitiveAssembler::MAX_TRIS];
+		size_t end = std::min((size_t)mesh.nmeshlets, (size_t)(g+1)*MESHLET_GROUP);
+		for (size_t i=(size_t)g*MESHLET_GROUP; i<end; i++) {
+			const Meshlet &m = mesh.meshlets[i];
+			clusters.clusters++;
+			MeshletCuller::Result result = culler.test(m);
+			if (result!=MeshletCuller::VISIBLE) {
+				if (result==MeshletCuller::OFFSCREEN) clusters.cluster_offscreen++;
+				else clusters.cluster_backface++;
+				clusters.cluster_faces += m.nfaces;
+				continue;
+			}
+			const uint32_t *verts = mesh.cluster_verts+m.first_vert;
+			for (uint32_t v=0; v<m.nverts; v++) {
+				x[v] = mesh.vx[verts[v]];
+				y[v] = mesh.vy[verts[v]];
+				z[v] = mesh.vz[verts[v]];
+			}
+			transform_points(mvp, x, y, z, m.nverts, &vb.x[0], &vb.y[0], &vb.z[0], &vb.w[0]);
+			project_points(&vb.x[0], &vb.y[0], &vb.z[0], &vb.w[0], m.nverts, &vb.sx[0], &vb.sy[0], &vb.sz[0]);
+			for (uint32_t f=m.first_face; f<m.first_face+m.nfaces; f++) {
+				const uint8_t *c = mesh.cluster_corners+3*f;
+				uint32_t corners[3] = { c[0], c[1], c[2] };
+				const uint32_t *face = mesh.faces + 3*mesh.cluster_faces[f];
+				const uint32_t *ft = mesh.face_tex + 3*mesh.cluster_faces[f];
+				Vec2f tex_coords[3];
+				for (int j=0; j<3; j++)
+					tex_coords[j] = Vec2f(mesh.tu[ft[j]], mesh.tv[ft[j]]);
+				int n = local.assemble(vb, corners, tex_coords, tris);
+				if (!n) continue;
+				Vec3f world_coords[3];
+				for (int j=0; j<3; j++)
+					world_coords[j] = Vec3f(mesh.vx[face[j]], mesh.vy[face[j]], mesh.vz[face[j]]);
+				Vec3f normal = cross(world_coords[2]-world_coords[0],world_coords[1]-world_coords[0]);
+				normal.normalize();
+				ClusterTri t;
+				t.intensity = std::max(normal*light, 0.f);
+				for (int k=0; k<n; k++) {
+					t.tri = tris[k];
+					groups[g].push_back(t);
+				}
+			}
+		}
+		stats[g] = local.stats();
+		stats[g].clusters = clusters.clusters;
+		stats[g].cluster_offscreen = clusters.cluster_offscreen;
+		stats[g].cluster_backface = clusters.cluster_backface;
+		stats[g].cluster_faces = clusters.cluster_faces;
+	};
+	if (pool && ngroups>1) pool->parallel_for(ngroups, assemble_group);
+	else for (int g=0; g<ngroups; g++) assemble_group(g);
+	for (int g=0; g<ngroups; g++) {
+		assembler.add_stats(stats[g]);
+		for (size_t i=0; i<groups[g].size(); i++)
+			submit(groups[g][i].tri.pts, groups[g][i].tri.uv, groups[g][i].intensity);
+	}
+}
+
+// draws what was submitted to the rasterizer of frame the way frame is set up to
+void draw_submitted(FrameBuffer &frame, Texture &texture, const TiledRasterizer::RowsDone &rows_done) {
+	TiledRasterizer &raster = frame.raster();
+	if (frame.get_shading()==DEFERRED) {
+		raster.flush_ids(frame.depth(), frame.ids());
+		raster.shade_ids(frame.ids(), texture, frame.color(), rows_done);
+	} else if (MsaaBuffer *msaa = frame.msaa()) {
+		msaa->clear(BACKGROUND.val);
+		raster.flush_msaa(*msaa, texture, frame.color(), rows_done);
+	} else {
+		if (frame.get_zprepass()) raster.flush_depth(frame.depth(), true);
+		raster.flush(frame.depth(), texture, frame.color(), rows_done);
+	}
+}
+
+void add_stats(FrameBuffer &frame) {
+#ifdef PROFILE
+	const CullStats &cull = frame.assembler().stats();
+	HiZStats hiz = frame.depth().stats();
+	PROFILE_ADD(frame.profile(), TRIS_SUBMITTED, cull.submitted+cull.cluster_faces);
+	PROFILE_ADD(frame.profile(), TRIS_CULLED, cull.cluster_faces+cull.offscreen+cull.backface+cull.degenerate+cull.empty_box);
+	PROFILE_ADD(frame.profile(), FRAGMENTS_TESTED, hiz.fragments_tested);
+	PROFILE_ADD(frame.profile(), FRAGMENTS_PASSED, hiz.fragments_tested-hiz.fragments_failed);
+#else
+	(void)frame;
+#endif
+}
+
+} // namespace
+
+void render_model(Model &model, Texture &texture, const Camera &camera, Vec3f light, FrameBuffer &frame,
+		TGAWriter *out) {
+	int width = frame.get_width(), height = frame.get_height();
+	frame.color().clear(BACKGROUND);
+	frame.depth().clear();
+	frame.depth().reset_stats();
+
+	Matrix mvp = camera_matrix(camera, width, height);
+	light.normalize();
+
+	TiledRasterizer &raster = frame.raster();
+	ShadowMap *shadow = frame.shadow_map();
+	if (shadow) {
+		PROFILE_SCOPE(frame.profile(), STAGE_SHADOW);
+		if (!render_shadow_map(model, mvp, light, *shadow, frame.pool())) shadow = NULL;
+	}
+	raster.set_shadow(shadow ? &shadow->lookup : NULL);
+
+	PrimitiveAssembler &assembler = frame.assembler();
+	assembler.reset_stats();
+	{
+		PROFILE_SCOPE(frame.profile(), STAGE_SETUP);
+		assemble_model(model, mvp, camera, assembler, light, frame.pool(), [&](Vec3f *pts, Vec2f *uv, float intensity) {
+			raster.submit(pts, uv, intensity);
+		});
+	}
+	TiledRasterizer::RowsDone rows_done;
+	if (out) rows_done = [&](int y0, int y1) { frame.write_rows(*out, y0, y1); };
+	draw_submitted(frame, texture, rows_done);
+	raster.set_shadow(NULL);
+	add_stats(frame);
+}
+
+bool strip_span(const Vec3f *pts, int height, int rows, int &k0, int &k1) {
+	// as wide as the bins of TiledRasterizer
+	float ymin = std::min(pts[0].y, std::min(pts[1].y, pts[2].y))-.5f;
+	float ymax = std::max(pts[0].y, std::max(pts[1].y, pts[2].y))+.5f;
+	if (ymax<0 || ymin>height-1) return false;
+	k0 = std::max(0, (int)std::ceil(ymin))/rows;
+	k1 = std::min(height-1, (int)std::floor(ymax))/rows;
+	return true;
+}
+
+void begin_strip(FrameBuffer &strip, int k) {
+	strip.color().clear(BACKGROUND);
+	strip.depth().clear();
+	strip.raster().set_origin(k*strip.get_height());
+}
+
+bool write_strip(FrameBuffer &strip, int k, int height, TGAWriter &out) {
+	int rows = strip.get_height();
+	// a top strip that is not full reaches past the frame
+	return strip.write_rows(out, 0, std::min(rows, height-k*rows));
+}
+
+void render_model_strips(Model &model, Texture &texture, const Camera &camera, Vec3f light, int height,
+		FrameBuffer &strip, TGAWriter &out) {
+	int width = strip.get_width(), rows = strip.get_height();
+	strip.depth().reset_stats();
+	Matrix mvp = camera_matrix(camera, width, height);
+	light.normalize();
+
+	TiledRasterizer &raster = strip.raster();
+	ShadowMap *shadow = strip.shadow_map();
+	if (shadow) {
+		PROFILE_SCOPE(strip.profile(), STAGE_SHADOW);
+		if (!render_shadow_map(model, mvp, light, *shadow, strip.pool())) shadow = NULL;
+	}
+	raster.set_shadow(shadow ? &shadow->lookup : NULL);
+
+	// Every triangle is assembled once, for the whole frame, and kept with
+	// the strips it reaches.
+	struct StripTri {
+		Vec3f pts[3];
+		Vec2f uv[3];
+		float intensity;
+	};
+	std::vector<StripTri> tris;
+	int nstrips = (height+rows-1)/rows;
+	std::vector<std::vector<uint32_t> > bins(nstrips);
+	PrimitiveAssembler &assembler = strip.assembler();
+	assembler.set_size(width, height);
+	assembler.reset_stats();
+	{
+		PROFILE_SCOPE(strip.profile(), STAGE_SETUP);
+		assemble_model(model, mvp, camera, assembler, light, strip.pool(), [&](Vec3f *pts, Vec2f *uv, float intensity) {
+			int k0, k1;
+			if (!strip_span(pts, height, rows, k0, k1)) return;
+			StripTri t;
+			for (int j=0; j<3; j++) {
+				t.pts[j] = pts[j];
+				t.uv[j] = uv[j];
+			}
+			t.intensity = intensity;
+			for (int k=k0; k<=k1; k++) bins[k].push_back((uint32_t)tris.size());
+			tris.push_back(t);
+		});
+	}
+	assembler.set_size(width, rows);
+
+	// the top strip first, like the file
+	for (int k=nstrips-1; k>=0; k--) {
+		begin_strip(strip, k);
+		{
+			PROFILE_SCOPE(strip.profile(), STAGE_SETUP);
+			for (size_t i=0; i<bins[k].size(); i++) {
+				StripTri &t = tris[bins[k][i]];
+				raster.submit(t.pts, t.uv, t.intensity);
+			}
+		}
+		draw_submitted(strip, texture, TiledRasterizer::RowsDone());
+		write_strip(strip, k, height, out);
+	}
+	raster.set_origin(0);
+	raster.set_shadow(NULL);
+	add_stats(strip);
+}
+
+int render_model(LodModel &model, Texture &texture, const Camera &camera, Vec3f light, FrameBuffer &frame,
+		TGAWriter *out, float lod_pixels) {
+	int level = model.select(camera, frame.get_width(), frame.get_height(), lod_pixels);
+	render_model(model.level(level), texture, camera, light, frame, out);
+	return level;
+}
+
+int render_model_strips(LodModel &model, Texture &texture, const Camera &camera, Vec3f light, int height,
+		FrameBuffer &strip, TGAWriter &out, float lod_pixels) {
+	int level = model.select(camera, strip.get_width(), height, lod_pixels);
+	render_model_strips(model.level(level), texture, camera, light, height, strip, out);
+	return level;
+}
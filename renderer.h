@@ -0,0 +1,161 @@
+#ifndef __RENDERER_H__
+#define __RENDERER_H__
+
+#include "geometry.h"
+#include "tgaimage.h"
+#include "zbuffer.h"
+#include "rendertarget.h"
+#include "raster.h"
+#include "transform.h"
+#include "primitive.h"
+#include "lod.h"
+#include <memory>
+
+class Model;
+class Texture;
+class ThreadPool;
+class Profile;
+
+const TGAColor BACKGROUND = TGAColor(83, 41, 104, 255);
+
+// Where the model is seen from. The default one looks down -z from +z with an
+// orthographic projection, which maps [-1,1]^2 onto the whole image.
+struct Camera {
+	Vec3f eye, center, up;
+	bool perspective; // central projection with the eye at |eye-center| from center
+
+	Camera();
+};
+
+Matrix lookat(Vec3f eye, Vec3f center, Vec3f up);
+// coeff is -1/distance to the eye, 0 for orthographic
+Matrix projection(float coeff);
+// [-1,1]^2 onto the w x h pixels at x,y, depth left as it is
+Matrix viewport(int x, int y, int w, int h);
+// model to screen for camera and a width x height frame
+Matrix camera_matrix(const Camera &camera, int width, int height);
+
+// FORWARD shades every fragment that passes the depth test as it is drawn.
+// DEFERRED draws depth and triangle ids only, then shades each visible pixel
+// once: it pays off when a lot of the shaded fragments get drawn over.
+enum Shading {
+	FORWARD, DEFERRED
+};
+
+// The depth of the model seen from the light, an orthographic square of size
+// texels fit around the model every frame. Faces facing either way are drawn
+// into it, so the map holds the side nearest to the light.
+struct ShadowMap {
+	int size;
+	DepthBuffer depth;
+	TiledRasterizer raster;
+	VertexBuffer vertices;
+	PrimitiveAssembler assembler;
+	ShadowLookup lookup;
+
+	ShadowMap(int size, ThreadPool *pool);
+};
+
+// Everything a frame is rendered into. Allocating these is most of the fixed
+// cost of a frame, so they are meant to be kept and reused from frame to frame.
+class FrameBuffer {
+public:
+	FrameBuffer(int width, int height, ThreadPool *pool);
+	int get_width() const { return width_; }
+	int get_height() const { return height_; }
+	RenderTarget &color() { return color_; }
+	DepthBuffer &depth() { return depth_; }
+	TiledRasterizer &raster() { return raster_; }
+	VertexBuffer &vertices() { return vertices_; }
+	PrimitiveAssembler &assembler() { return assembler_; }
+	ThreadPool *pool() { return pool_; }
+	// where the stages of the frames are timed and counted, NULL for nowhere
+	Profile *profile() { return profile_; }
+	void set_profile(Profile *profile);
+	Shading get_shading() const { return shading_; }
+	void set_shading(Shading shading) { shading_ = shading; }
+	// the triangle id buffer of deferred shading, allocated on first use
+	RenderTarget &ids();
+	// side of the shadow map in texels, 0 for no shadows
+	int get_shadows() const { return shadows_; }
+	void set_shadows(int size);
+	// NULL while shadows are off, allocated on first use
+	ShadowMap *shadow_map();
+	// forward shading draws the depth of the frame first, then shades only
+	// the fragments that are still nearest; deferred shading has a depth pass
+	// of its own and ignores this, so does multisampling
+	bool get_zprepass() const { return zprepass_; }
+	void set_zprepass(bool zprepass) { zprepass_ = zprepass; }
+	// samples per pixel of forward shading, 1 for none or one of
+	// MsaaBuffer::supported(); deferred shading ignores it
+	int get_samples() const { return samples_; }
+	void set_samples(int samples);
+	// NULL with one sample, allocated on first use
+	MsaaBuffer *msaa();
+	// the colour target as an RGB image for writing out, kept for the next frame
+	TGAImage &resolve(bool flip=false);
+	// rows [y0,y1) of the colour target to out as RGB, the top one first;
+	// more rows than a band of TGAWriter are encoded on the pool in parallel
+	bool write_rows(TGAWriter &out, int y0, int y1);
+
+private:
+	FrameBuffer(const FrameBuffer &);
+	FrameBuffer & operator =(const FrameBuffer &);
+
+	int width_, height_;
+	ThreadPool *pool_;
+	RenderTarget color_;
+	TGAImage output_;
+	DepthBuffer depth_;
+	TiledRasterizer raster_;
+	VertexBuffer vertices_;
+	PrimitiveAssembler assembler_;
+	std::vector<unsigned char> band_;
+	Shading shading_;
+	std::unique_ptr<RenderTarget> ids_;
+	int shadows_;
+	std::unique_ptr<ShadowMap> shadow_;
+	bool zprepass_;
+	int samples_;
+	std::unique_ptr<MsaaBuffer> msaa_;
+	Profile *profile_;
+};
+
+// clears frame and renders model into it, with y up like in the model. With
+// out, open for an RGB image the size of the frame, the rows are written to
+// it top down as they are finished; closing it is up to the caller. Meshlets
+// of the model off screen or facing away are dropped before any of their
+// vertices is transformed, the others are transformed and assembled in
+// parallel, a group of meshlets per task.
+void render_model(Model &model, Texture &texture, const Camera &camera, Vec3f light, FrameBuffer &frame,
+		TGAWriter *out=NULL);
+// the same with the coarsest level of model that is within lod_pixels of the
+// full one on screen; returns the level drawn
+int render_model(LodModel &model, Texture &texture, const Camera &camera, Vec3f light, FrameBuffer &frame,
+		TGAWriter *out=NULL, float lod_pixels=LOD_PIXELS);
+
+// render_model() for frames too big to keep in memory: a frame as wide as
+// strip and height rows high, drawn into strip a strip of its rows at a time
+// from the top down, and every strip written to out as it is finished. The
+// vertices are transformed and the triangles assembled and binned by strip
+// once, so memory goes with the strip and the model, not the frame. The
+// strips are drawn in frame coordinates (see TiledRasterizer::set_origin()),
+// so strip has to be a multiple of TiledRasterizer::TILE_SIZE rows high, and
+// the image is the one render_model() gives bit for bit. The stats of strip
+// are for the whole frame.
+void render_model_strips(Model &model, Texture &texture, const Camera &camera, Vec3f light, int height,
+		FrameBuffer &strip, TGAWriter &out);
+int render_model_strips(LodModel &model, Texture &texture, const Camera &camera, Vec3f light, int height,
+		FrameBuffer &strip, TGAWriter &out, float lod_pixels=LOD_PIXELS);
+
+// The pieces of render_model_strips() the other renderers draw strips with.
+// Strip k holds the frame rows [k*rows, (k+1)*rows), the top one is drawn
+// first. strip_span() gives the strips pts reaches in a frame height rows
+// high, false for none; begin_strip() clears strip and sets it up for strip
+// k, write_strip() writes the rows of the drawn strip k that are in the frame
+// to out in one go.
+bool strip_span(const Vec3f *pts, int height, int rows, int &k0, int &k1);
+void begin_strip(FrameBuffer &strip, int k);
+bool write_strip(FrameBuffer &strip, int k, int height, TGAWriter &out);
+
+#endif //__RENDERER_H__
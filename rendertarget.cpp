@@ -0,0 +1,78 @@
+#include <algorithm>
+#include "rendertarget.h"
+#include "streamfill.h"
+
+RenderTarget::RenderTarget(int width, int height) : width_(width), height_(height),
+		tiles_x_((width+TILE-1)/TILE), tiles_y_((height+TILE-1)/TILE), clear_(0),
+		pending_(tiles_x_*tiles_y_), pixels_((size_t)width*height) {
+}
+
+uint32_t *RenderTarget::buffer() {
+	materialize();
+	return &pixels_[0];
+}
+
+uint32_t *RenderTarget::touch(int x0, int y0, int x1, int y1) {
+	for (int ty=y0/TILE; ty<=y1/TILE; ty++)
+		for (int tx=x0/TILE; tx<=x1/TILE; tx++)
+			if (pending_[tx+ty*tiles_x_]) clear_tile(tx+ty*tiles_x_);
+	return &pixels_[0];
+}
+
+void RenderTarget::clear(TGAColor color) {
+	clear((uint32_t)color.val);
+}
+
+void RenderTarget::clear(uint32_t value) {
+	clear_ = value;
+	std::fill(pending_.begin(), pending_.end(), 1);
+}
+
+void RenderTarget::clear_tile(int t) {
+	int x0 = (t%tiles_x_)*TILE, y0 = (t/tiles_x_)*TILE;
+	int w = std::min(TILE, width_-x0), y1 = std::min(y0+TILE, height_);
+	for (int y=y0; y<y1; y++) std::fill_n(row(y)+x0, w, clear_);
+	pending_[t] = 0;
+}
+
+void RenderTarget::materialize() {
+	if (std::find(pending_.begin(), pending_.end(), 0)==pending_.end()) {
+		stream_fill(&pixels_[0], pixels_.size(), clear_);
+		std::fill(pending_.begin(), pending_.end(), 0);
+		return;
+	}
+	for (size_t t=0; t<pending_.size(); t++)
+		if (pending_[t]) clear_tile((int)t);
+}
+
+template <class P> void RenderTarget::convert_row(int y, P *out) {
+	const uint32_t *src = row(y);
+	const unsigned char *pending = &pending_[(y/TILE)*tiles_x_];
+	P background = P(TGAColor((int)clear_, 4));
+	for (int tx=0; tx<tiles_x_; tx++) {
+		int x0 = tx*TILE, x1 = std::min(x0+TILE, width_);
+		if (pending[tx]) std::fill(out+x0, out+x1, background);
+		else for (int x=x0; x<x1; x++) out[x] = P(TGAColor((int)src[x], 4));
+	}
+}
+
+template <class P> void RenderTarget::resolve_image(TGAImage &image, bool flip) {
+	ImageView<P> view(image);
+	for (int y=0; y<height_; y++) convert_row(y, view.row(flip ? height_-1-y : y));
+}
+
+void RenderTarget::resolve(TGAImage &image, bool flip) {
+	if (image.get_width()!=width_ || image.get_height()!=height_ || !image.buffer())
+		image = TGAImage(width_, height_, TGAImage::RGB);
+	switch (image.get_bytespp()) {
+	case TGAImage::GRAYSCALE: resolve_image<PixelGray>(image, flip); break;
+	case TGAImage::RGB:       resolve_image<PixelRGB>(image, flip); break;
+	default:                  resolve_image<PixelRGBA>(image, flip); break;
+	}
+}
+
+void RenderTarget::resolve_rows(int y0, int y1, unsigned char *out, bool flip) {
+	PixelRGB *dst = (PixelRGB *)out;
+	for (int i=0; i<y1-y0; i++)
+		convert_row(flip ? y1-1-i : y0+i, dst + (size_t)i*width_);
+}
@@ -0,0 +1,58 @@
+#ifndef __RENDERTARGET_H__
+#define __RENDERTARGET_H__
+
+#include <vector>
+#include <stdint.h>
+#include "tgaimage.h"
+
+// Colour buffer the rasterizer shades into: one packed uint32 per pixel,
+// bgra like TGAColor::val and the texels of Texture, so a shaded texel is
+// stored as it comes and a row is plain aligned words. Rows go bottom up
+// like the screen coordinates. It only becomes a TGAImage (and the image
+// format only matters) when resolve() is called for output.
+//
+// Clears are lazy: clear() only remembers the colour and marks every 64x64
+// tile as pending, a tile gets the colour written the first time something
+// touches it, and resolve() writes the clear colour of tiles never touched
+// straight to the output. A frame pays for clearing the tiles it draws to.
+class RenderTarget {
+public:
+	static const int TILE = 64;
+
+	RenderTarget(int width, int height);
+	int get_width() const { return width_; }
+	int get_height() const { return height_; }
+	// all the pixels, pending clears done first
+	uint32_t *buffer();
+	// the pixels as they are, tiles still pending a clear hold stale values
+	uint32_t *row(int y) { return &pixels_[(size_t)y*width_]; }
+	// clears the pending tiles over [x0,x1]x[y0,y1] and returns buffer();
+	// threads may touch different tiles at the same time
+	uint32_t *touch(int x0, int y0, int x1, int y1);
+
+	void clear(TGAColor color);
+	// for targets that hold something other than colours
+	void clear(uint32_t value);
+	// whether the tile of pixel x,y was touched since the last clear
+	bool touched(int x, int y) const { return !pending_[x/TILE + (y/TILE)*tiles_x_]; }
+	// does every pending clear now, one streaming fill if no tile was touched
+	void materialize();
+	// converts into image, reallocated as RGB if its size doesn't match;
+	// flip turns it upside down on the way, for files with the origin at the top
+	void resolve(TGAImage &image, bool flip=false);
+	// rows [y0,y1) as RGB pixels into out, from y1-1 down when flipped
+	void resolve_rows(int y0, int y1, unsigned char *out, bool flip=false);
+
+private:
+	void clear_tile(int t);
+	template <class P> void convert_row(int y, P *out);
+	template <class P> void resolve_image(TGAImage &image, bool flip);
+
+	int width_, height_;
+	int tiles_x_, tiles_y_;
+	uint32_t clear_;
+	std::vector<unsigned char> pending_;
+	std::vector<uint32_t> pixels_;
+};
+
+#endif //__RENDERTARGET_H__
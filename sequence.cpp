@@ -0,0 +1,174 @@
+#include <iostream>
+#include <cstdio>
+#include <cmath>
+#include <cctype>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include "sequence.h"
+#include "model.h"
+#include "texture.h"
+#include "threadpool.h"
+#include "shader.h"
+
+namespace {
+
+// the rows TGAWriter encodes as one band
+const int BAND_ROWS = 64;
+
+// A fixed set of framebuffers passed from the drawing thread to the writers
+// and back. The drawing thread waits here when every one is being written.
+class BufferRing {
+public:
+	BufferRing(int n, int width, int height, ThreadPool *pool) {
+		for (int i=0; i<n; i++) all_.push_back(new FrameBuffer(width, height, pool));
+		free_ = all_;
+	}
+
+	~BufferRing() {
+		for (size_t i=0; i<all_.size(); i++) delete all_[i];
+	}
+
+	FrameBuffer *acquire() {
+		std::unique_lock<std::mutex> guard(lock_);
+		cv_.wait(guard, [this] { return !free_.empty(); });
+		FrameBuffer *frame = free_.back();
+		free_.pop_back();
+		return frame;
+	}
+
+	void release(FrameBuffer *frame) {
+		{
+			std::lock_guard<std::mutex> guard(lock_);
+			free_.push_back(frame);
+		}
+		cv_.notify_one();
+	}
+
+private:
+	BufferRing(const BufferRing &);
+	BufferRing & operator =(const BufferRing &);
+
+	std::vector<FrameBuffer *> all_, free_;
+	std::mutex lock_;
+	std::condition_variable cv_;
+};
+
+std::string frame_name(const std::string &pattern, int i) {
+	std::vector<char> buf(pattern.size()+32);
+	snprintf(&buf[0], buf.size(), pattern.c_str(), i);
+	return &buf[0];
+}
+
+// the whole frame top down, a band per thread of the frame's pool at a time:
+// those are converted to RGB and encoded side by side
+bool write_frame(FrameBuffer &frame, const std::string &name) {
+	int width = frame.get_width(), height = frame.get_height();
+	int rows = BAND_ROWS*std::max(frame.pool()->size(), 1);
+	TGAWriter out;
+	if (!out.open(name.c_str(), width, height, TGAImage::RGB)) return false;
+	bool ok = true;
+	for (int y=height; ok && y>0; y-=rows)
+		ok = frame.write_rows(out, std::max(y-rows, 0), y);
+	return out.close() && ok;
+}
+
+} // namespace
+
+SequenceOptions::SequenceOptions() : model(), texture(), output("frame%04d.tga"), width(1000), height(1000),
+		shading(FORWARD), lod_pixels(LOD_PIXELS), light(0, 0, -1), shadows(0), zprepass(false), samples(1), frames(0), camera(), path(), threads(0), writers(1), buffers(3) {
+}
+
+Camera turntable(const Camera &camera, float angle) {
+	Vec3f k = camera.up;
+	k.normalize();
+	Vec3f v = camera.eye-camera.center;
+	float c = std::cos(angle), s = std::sin(angle);
+	Camera out = camera;
+	out.eye = camera.center + v*c + cross(k, v)*s + k*((k*v)*(1-c));
+	return out;
+}
+
+Camera path_camera(const std::vector<Camera> &path, float t) {
+	int n = (int)path.size();
+	if (n==1) return path[0];
+	float f = std::min(std::max(t, 0.f), 1.f)*(n-1);
+	int i = std::min((int)f, n-2);
+	float a = f-i;
+	const Camera &c0 = path[i], &c1 = path[i+1];
+	Camera out = c0;
+	out.eye = c0.eye*(1-a) + c1.eye*a;
+	out.center = c0.center*(1-a) + c1.center*a;
+	out.up = c0.up*(1-a) + c1.up*a;
+	return out;
+}
+
+bool valid_pattern(const std::string &pattern) {
+	int conversions = 0;
+	for (size_t i=0; i<pattern.size(); i++) {
+		if (pattern[i]!='%') continue;
+		if (++i<pattern.size() && pattern[i]=='%') continue;
+		while (i<pattern.size() && isdigit((unsigned char)pattern[i])) i++;
+		if (i==pattern.size() || pattern[i]!='d') return false;
+		conversions++;
+	}
+	return conversions==1;
+}
+
+int run_sequence(const SequenceOptions &options) {
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	LodModel model(options.model.c_str());
+	if (!model.level(0).nfaces()) {
+		std::cerr << "can't load model " << options.model << "\n";
+		return options.frames;
+	}
+	Texture texture;
+	if (!options.texture.empty()) {
+		TGAImage image;
+		if (!image.read_tga_file(options.texture.c_str())) {
+			std::cerr << "can't load texture " << options.texture << "\n";
+			return options.frames;
+		}
+		texture.build(image);
+	}
+
+	ThreadPool pool(options.threads);
+	// the writers get threads of their own: the drawing thread helps out the
+	// raster pool while it waits, and must not pick up a whole frame to write
+	ThreadPool writers(std::max(options.writers, 1));
+	BufferRing ring(std::max(options.buffers, 2), options.width, options.height, &pool);
+	std::mutex lock;
+	std::atomic<int> failed(0);
+	double drawing = 0;
+
+	for (int i=0; i<options.frames; i++) {
+		Camera camera = options.path.empty()
+			? turntable(options.camera, 2*float(M_PI)*i/options.frames)
+			: path_camera(options.path, options.frames>1 ? float(i)/(options.frames-1) : 0.f);
+		FrameBuffer *frame = ring.acquire();
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		frame->set_shading(options.shading);
+		frame->set_shadows(options.shadows);
+		frame->set_zprepass(options.zprepass);
+		frame->set_samples(options.samples);
+		if (options.texture.empty()) render_untextured(model, camera, options.light, *frame, NULL, options.lod_pixels);
+		else render_model(model, texture, camera, options.light, *frame, NULL, options.lod_pixels);
+		drawing += std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+		std::string name = frame_name(options.output, i);
+		writers.submit([&, frame, name] {
+			bool ok = write_frame(*frame, name);
+			ring.release(frame);
+			if (!ok) failed++;
+			std::lock_guard<std::mutex> guard(lock);
+			std::cout << (ok ? "done " : "failed ") << name << std::endl;
+		});
+	}
+	writers.wait();
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+	std::cerr << "# sequence: " << options.frames << " frames, " << failed << " failed, " << seconds << " s, "
+		<< (seconds>0 ? options.frames/seconds : 0.) << " frames/s, drawing " << drawing << " s" << std::endl;
+	return failed;
+}
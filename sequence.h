@@ -0,0 +1,43 @@
+#ifndef __SEQUENCE_H__
+#define __SEQUENCE_H__
+
+#include <string>
+#include <vector>
+#include "renderer.h"
+
+// Many frames of one model seen from a moving camera: a turntable around the
+// start camera, or a path through camera keyframes.
+struct SequenceOptions {
+	std::string model, texture;
+	std::string output; // printf pattern of the frame number, like frame%04d.tga
+	int width, height;
+	Shading shading;
+	float lod_pixels; // see LodModel::select()
+	Vec3f light;      // the direction it goes
+	int shadows;      // shadow map size, 0 for none
+	bool zprepass;
+	int samples;      // per pixel, 1 for no multisampling
+	int frames;
+	Camera camera;            // the turntable starts here
+	std::vector<Camera> path; // if not empty: keyframes spread evenly over the frames
+	int threads;  // raster workers, 0: one per hardware thread
+	int writers;  // threads encoding and writing finished frames
+	int buffers;  // framebuffers: one being drawn, the others being written out
+
+	SequenceOptions();
+};
+
+// camera turned by angle radians around the up axis through its center
+Camera turntable(const Camera &camera, float angle);
+// the camera at t in [0,1] along path, linear between the keyframes
+Camera path_camera(const std::vector<Camera> &path, float t);
+// true if pattern has one integer conversion and nothing else for printf
+bool valid_pattern(const std::string &pattern);
+
+// Loads the model and texture once and renders every frame. A frame is
+// written out by the writer threads while the next one is drawn, drawing only
+// waits when all the buffers are still being written. Returns the number of
+// frames that failed, all of them if the assets can't be loaded.
+int run_sequence(const SequenceOptions &options);
+
+#endif //__SEQUENCE_H__
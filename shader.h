@@ -0,0 +1,334 @@
+#ifndef __SHADER_H__
+#define __SHADER_H__
+
+#include <algorithm>
+#include <stdint.h>
+#include "geometry.h"
+#include "model.h"
+#include "texture.h"
+#include "raster.h"
+#include "renderer.h"
+#include "profile.h"
+
+// Shaders for render_shaded(). A shader is any class with
+//
+//   enum { VARYINGS = n };  // floats per corner, interpolated over the triangle, n >= 1
+//   // vertex stage: the varyings of the three corners of face, only called
+//   // for faces that survive culling
+//   void vertex(int face, float out[3][VARYINGS]) const;
+//   // fragment stage: the colour of pixel x, y from the interpolated
+//   // varyings, bgra packed like TGAColor::val
+//   uint32_t fragment(int x, int y, const float *in) const;
+//
+// The fragment loop is a template on it, so every shader gets one of its
+// own with both stages inlined and no call or branch per pixel for picking
+// them. The raster kernels themselves are not templates: they are built once
+// per instruction set in translation units of their own flags and picked at
+// runtime, so they reach the fragment loop through one call per 8x8 block,
+// the same for every shader.
+//
+// Varyings are interpolated affinely in screen space like the texture
+// coordinates of render_model(), and go through clipping the same way.
+
+// c times k in [0,1], alpha left as it is
+inline uint32_t scale_color(uint32_t c, float k) {
+	uint32_t b = uint32_t((c&0xff)*k), g = uint32_t(((c>>8)&0xff)*k), r = uint32_t(((c>>16)&0xff)*k);
+	return (c&0xff000000u) | r<<16 | g<<8 | b;
+}
+
+// One colour, one intensity per face from its normal: what render_model()
+// does without the texture.
+struct FlatShader {
+	enum { VARYINGS = 1 };
+	const MeshView &mesh;
+	Vec3f light;
+	uint32_t color;
+
+	FlatShader(const MeshView &mesh, Vec3f light, TGAColor color) : mesh(mesh), light(light.normalize()), color(color.val) {}
+
+	void vertex(int face, float out[3][VARYINGS]) const {
+		const uint32_t *f = mesh.faces+3*face;
+		Vec3f p[3];
+		for (int j=0; j<3; j++) p[j] = Vec3f(mesh.vx[f[j]], mesh.vy[f[j]], mesh.vz[f[j]]);
+		Vec3f normal = cross(p[2]-p[0], p[1]-p[0]).normalize();
+		out[0][0] = out[1][0] = out[2][0] = std::max(normal*light, 0.f);
+	}
+	uint32_t fragment(int, int, const float *in) const {
+		return scale_color(color, in[0]);
+	}
+};
+
+// Intensity at the corners from the vertex normals of the mesh, blended over
+// the face. Needs a mesh with normals.
+struct GouraudShader {
+	enum { VARYINGS = 1 };
+	const MeshView &mesh;
+	Vec3f light;
+	uint32_t color;
+
+	GouraudShader(const MeshView &mesh, Vec3f light, TGAColor color) : mesh(mesh), light(light.normalize()), color(color.val) {}
+
+	void vertex(int face, float out[3][VARYINGS]) const {
+		const uint32_t *fn = mesh.face_norm+3*face;
+		for (int j=0; j<3; j++) {
+			// the normals point out, the light goes in
+			Vec3f n = Vec3f(mesh.nx[fn[j]], mesh.ny[fn[j]], mesh.nz[fn[j]]).normalize();
+			out[j][0] = std::max(-(n*light), 0.f);
+		}
+	}
+	uint32_t fragment(int, int, const float *in) const {
+		return scale_color(color, in[0]);
+	}
+};
+
+// Bilinear texture at lod with the flat intensity of FlatShader. The tuned
+// path with mip mapping, shadows and deferred shading is render_model().
+struct TexturedShader {
+	enum { VARYINGS = 3 }; // u, v, intensity
+	const MeshView &mesh;
+	Vec3f light;
+	const Texture &texture;
+	float lod;
+
+	TexturedShader(const MeshView &mesh, Vec3f light, const Texture &texture, float lod=0)
+		: mesh(mesh), light(light.normalize()), texture(texture), lod(lod) {}
+
+	void vertex(int face, float out[3][VARYINGS]) const {
+		const uint32_t *f = mesh.faces+3*face, *ft = mesh.face_tex+3*face;
+		Vec3f p[3];
+		for (int j=0; j<3; j++) p[j] = Vec3f(mesh.vx[f[j]], mesh.vy[f[j]], mesh.vz[f[j]]);
+		Vec3f normal = cross(p[2]-p[0], p[1]-p[0]).normalize();
+		float intensity = std::max(normal*light, 0.f);
+		for (int j=0; j<3; j++) {
+			out[j][0] = mesh.tu[ft[j]];
+			out[j][1] = mesh.tv[ft[j]];
+			out[j][2] = intensity;
+		}
+	}
+	uint32_t fragment(int, int, const float *in) const {
+		return scale_color(texture.sample(in[0], in[1], lod, Texture::BILINEAR), in[2]);
+	}
+};
+
+// Intensity per pixel from an object space normal map, rgb for xyz in
+// [-1,1], times the diffuse texture.
+struct NormalMappedShader {
+	enum { VARYINGS = 2 }; // u, v
+	const MeshView &mesh;
+	Vec3f light;
+	const Texture &diffuse, &normals;
+
+	NormalMappedShader(const MeshView &mesh, Vec3f light, const Texture &diffuse, const Texture &normals)
+		: mesh(mesh), light(light.normalize()), diffuse(diffuse), normals(normals) {}
+
+	void vertex(int face, float out[3][VARYINGS]) const {
+		const uint32_t *ft = mesh.face_tex+3*face;
+		for (int j=0; j<3; j++) {
+			out[j][0] = mesh.tu[ft[j]];
+			out[j][1] = mesh.tv[ft[j]];
+		}
+	}
+	uint32_t fragment(int, int, const float *in) const {
+		uint32_t c = normals.sample(in[0], in[1], 0, Texture::BILINEAR);
+		Vec3f n(((c>>16)&0xff)/127.5f-1, ((c>>8)&0xff)/127.5f-1, (c&0xff)/127.5f-1);
+		float intensity = std::min(std::max(-(n.normalize()*light), 0.f), 1.f);
+		return scale_color(diffuse.sample(in[0], in[1], 0, Texture::BILINEAR), intensity);
+	}
+};
+
+// Depth and nothing else. flush_shaded() takes it to flush_depth(), the
+// kernels built without any shading.
+struct DepthOnlyShader {
+	enum { VARYINGS = 1 };
+
+	void vertex(int, float out[3][VARYINGS]) const { out[0][0] = out[1][0] = out[2][0] = 0; }
+	uint32_t fragment(int, int, const float *) const { return 0; }
+};
+
+// the fragment callback of the raster kernels, one per shader
+template <class Shader> struct ShaderBlock {
+	const Shader *shader;
+	const float *varyings; // VARYINGS per corner
+	uint32_t *pixels;
+	int width;
+	int origin;       // frame row of row 0 of pixels
+	Profile *profile; // the frame's, NULL for none
+
+	static void shade(void *ctx, const Fragment *frags, int n) {
+		const ShaderBlock &s = *(const ShaderBlock *)ctx;
+		PROFILE_SCOPE(s.profile, STAGE_SHADE);
+		const int N = Shader::VARYINGS;
+		const float *v0 = s.varyings, *v1 = v0+N, *v2 = v1+N;
+		for (int i=0; i<n; i++) {
+			const Fragment &f = frags[i];
+			float in[N];
+			for (int k=0; k<N; k++) in[k] = v0[k]*f.bary[0] + v1[k]*f.bary[1] + v2[k]*f.bary[2];
+			s.pixels[f.x + (size_t)f.y*s.width] = s.shader->fragment(f.x, f.y+s.origin, in);
+		}
+	}
+};
+
+// triangle() for a shader: pts with VARYINGS floats per corner in varyings,
+// only the pixels in [x0,x1]x[y0,y1]; the fragment stage is timed as
+// STAGE_SHADE of profile. origin is the one of triangle_rect().
+template <class Shader> void triangle_shaded(Vec3f *pts, const float *varyings, const Shader &shader, DepthBuffer &zBuffer,
+		RenderTarget &target, int x0, int y0, int x1, int y1, Profile *profile=NULL, int origin=0) {
+	RasterTri t;
+	if (!setup_triangle(pts, x0, y0, x1, y1, t, origin)) return;
+	ShaderBlock<Shader> s = { &shader, varyings, target.touch(t.x0, t.y0-origin, t.x1, t.y1-origin), target.get_width(), origin,
+		profile };
+	raster_triangle(t, zBuffer, ShaderBlock<Shader>::shade, &s);
+}
+
+template <class Shader> void triangle_shaded(Vec3f *pts, const float *varyings, const Shader &shader, DepthBuffer &zBuffer,
+		RenderTarget &target) {
+	triangle_shaded(pts, varyings, shader, zBuffer, target, 0, 0, target.get_width()-1, target.get_height()-1);
+}
+
+template <class Shader> void TiledRasterizer::flush_shaded(DepthBuffer &zBuffer, const Shader &shader, RenderTarget &target,
+		const RowsDone &done) {
+	PROFILE_ADD(profile_, TRIS_RASTERIZED, tris_.size());
+	const int stride = 3*Shader::VARYINGS;
+	for_each_tile(STAGE_RASTER, [&](int t, int x0, int y0, int x1, int y1) {
+		std::vector<int> &bin = bins_[t];
+		for (size_t i=0; i<bin.size(); i++)
+			triangle_shaded(tris_[bin[i]].pts, &varyings_[bin[i]*stride], shader, zBuffer, target, x0, y0+origin_, x1, y1+origin_,
+				profile_, origin_);
+		bin.clear();
+	}, done);
+	tris_.clear();
+	varyings_.clear();
+}
+
+template <> inline void TiledRasterizer::flush_shaded(DepthBuffer &zBuffer, const DepthOnlyShader &, RenderTarget &,
+		const RowsDone &done) {
+	flush_depth(zBuffer);
+	// nothing but depth was drawn, the rows are final all the same
+	if (done) done(0, height_);
+}
+
+// transforms mesh with mvp into the vertices of frame and assembles its
+// faces, submit(pts, varyings) gets every triangle that comes out with the
+// VARYINGS floats of each of its corners
+template <class Shader, class Submit> void assemble_shaded(const MeshView &mesh, const Shader &shader, const Matrix &mvp,
+		FrameBuffer &frame, Submit submit) {
+	VertexBuffer &vb = frame.vertices();
+	{
+		PROFILE_SCOPE(frame.profile(), STAGE_TRANSFORM);
+		transform_vertices(mvp, mesh, vb, frame.pool());
+	}
+
+	PrimitiveAssembler &assembler = frame.assembler();
+	assembler.reset_stats();
+	PROFILE_SCOPE(frame.profile(), STAGE_SETUP);
+	// clipping carries these along like texture coordinates, so every
+	// piece comes out with the barycentrics of its corners in the face
+	Vec2f corners[3] = { Vec2f(0, 0), Vec2f(1, 0), Vec2f(0, 1) };
+	AssembledTri tris[PrimitiveAssembler::MAX_TRIS];
+	const int N = Shader::VARYINGS;
+	for (uint32_t i=0; i<mesh.nfaces; i++) {
+		int n = assembler.assemble(vb, mesh.faces+3*i, corners, tris);
+		if (!n) continue;
+		float in[3][N], varyings[3][N];
+		shader.vertex(i, in);
+		for (int k=0; k<n; k++) {
+			for (int j=0; j<3; j++) {
+				Vec2f b = tris[k].uv[j];
+				for (int v=0; v<N; v++)
+					varyings[j][v] = in[0][v]*(1-b.x-b.y) + in[1][v]*b.x + in[2][v]*b.y;
+			}
+			submit(tris[k].pts, varyings[0]);
+		}
+	}
+}
+
+// render_model() with any shader instead of the texture: clears frame and
+// draws mesh with forward shading, the shadows, samples and shading mode of
+// the frame are not looked at.
+template <class Shader> void render_shaded(const MeshView &mesh, const Shader &shader, const Camera &camera,
+		FrameBuffer &frame, TGAWriter *out=NULL) {
+	frame.color().clear(BACKGROUND);
+	frame.depth().clear();
+	frame.depth().reset_stats();
+	Matrix mvp = camera_matrix(camera, frame.get_width(), frame.get_height());
+
+	TiledRasterizer &raster = frame.raster();
+	assemble_shaded(mesh, shader, mvp, frame, [&](Vec3f *pts, const float *varyings) {
+		raster.submit(pts, varyings, Shader::VARYINGS);
+	});
+	TiledRasterizer::RowsDone rows_done;
+	if (out) rows_done = [&](int y0, int y1) { frame.write_rows(*out, y0, y1); };
+	raster.flush_shaded(frame.depth(), shader, frame.color(), rows_done);
+}
+
+// render_shaded() a strip at a time like render_model_strips(), into the
+// same image render_shaded() draws
+template <class Shader> void render_shaded_strips(const MeshView &mesh, const Shader &shader, const Camera &camera,
+		int height, FrameBuffer &strip, TGAWriter &out) {
+	int width = strip.get_width(), rows = strip.get_height();
+	strip.depth().reset_stats();
+	Matrix mvp = camera_matrix(camera, width, height);
+
+	// every triangle with its varyings, kept with the strips it reaches
+	const int N = Shader::VARYINGS;
+	std::vector<Vec3f> pts;
+	std::vector<float> varyings;
+	int nstrips = (height+rows-1)/rows;
+	std::vector<std::vector<uint32_t> > bins(nstrips);
+	PrimitiveAssembler &assembler = strip.assembler();
+	assembler.set_size(width, height);
+	assemble_shaded(mesh, shader, mvp, strip, [&](Vec3f *p, const float *v) {
+		int k0, k1;
+		if (!strip_span(p, height, rows, k0, k1)) return;
+		for (int k=k0; k<=k1; k++) bins[k].push_back((uint32_t)(pts.size()/3));
+		pts.insert(pts.end(), p, p+3);
+		varyings.insert(varyings.end(), v, v+3*N);
+	});
+	assembler.set_size(width, rows);
+
+	TiledRasterizer &raster = strip.raster();
+	for (int k=nstrips-1; k>=0; k--) {
+		begin_strip(strip, k);
+		{
+			PROFILE_SCOPE(strip.profile(), STAGE_SETUP);
+			for (size_t i=0; i<bins[k].size(); i++) {
+				uint32_t id = bins[k][i];
+				raster.submit(&pts[3*id], &varyings[3*N*(size_t)id], N);
+			}
+		}
+		raster.flush_shaded(strip.depth(), shader, strip.color());
+		write_strip(strip, k, height, out);
+	}
+	raster.set_origin(0);
+}
+
+// false if the obj had no vn at all: every face then points at the one
+// default normal, which is zero
+inline bool has_normals(const MeshView &mesh) {
+	for (uint32_t i=0; i<mesh.nnorm; i++)
+		if (mesh.nx[i]!=0 || mesh.ny[i]!=0 || mesh.nz[i]!=0) return true;
+	return false;
+}
+
+// A model that has no texture: Gouraud shaded in color where it has normals,
+// flat where it doesn't. Picks the level like render_model() and returns it.
+inline int render_untextured(LodModel &model, const Camera &camera, Vec3f light, FrameBuffer &frame,
+		TGAWriter *out=NULL, float lod_pixels=LOD_PIXELS, TGAColor color=TGAColor(255, 255, 255, 255)) {
+	int level = model.select(camera, frame.get_width(), frame.get_height(), lod_pixels);
+	const MeshView &mesh = model.level(level).view();
+	if (has_normals(mesh)) render_shaded(mesh, GouraudShader(mesh, light, color), camera, frame, out);
+	else render_shaded(mesh, FlatShader(mesh, light, color), camera, frame, out);
+	return level;
+}
+
+// render_untextured() a strip at a time, see render_shaded_strips()
+inline int render_untextured_strips(LodModel &model, const Camera &camera, Vec3f light, int height, FrameBuffer &strip,
+		TGAWriter &out, float lod_pixels=LOD_PIXELS, TGAColor color=TGAColor(255, 255, 255, 255)) {
+	int level = model.select(camera, strip.get_width(), height, lod_pixels);
+	const MeshView &mesh = model.level(level).view();
+	if (has_normals(mesh)) render_shaded_strips(mesh, GouraudShader(mesh, light, color), camera, height, strip, out);
+	else render_shaded_strips(mesh, FlatShader(mesh, light, color), camera, height, strip, out);
+	return level;
+}
+
+#endif //__SHADER_H__
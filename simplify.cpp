@@ -0,0 +1,336 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "simplify.h"
+#include "meshopt.h"
+
+namespace {
+
+// borders and seams weigh this much more than the faces they run along
+const double BORDER_WEIGHT = 10;
+// corners of one vertex told apart by a collapse, more and it is not done
+const int MAX_WEDGES = 16;
+
+// squared distance to a set of weighted planes, as a symmetric 4x4 matrix
+struct Quadric {
+	double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+	double w;
+};
+
+void add_plane(Quadric &q, double nx, double ny, double nz, double d, double w) {
+	q.a00 += w*nx*nx; q.a01 += w*nx*ny; q.a02 += w*nx*nz; q.a03 += w*nx*d;
+	q.a11 += w*ny*ny; q.a12 += w*ny*nz; q.a13 += w*ny*d;
+	q.a22 += w*nz*nz; q.a23 += w*nz*d;
+	q.a33 += w*d*d;
+	q.w += w;
+}
+
+void add_quadric(Quadric &q, const Quadric &r) {
+	q.a00 += r.a00; q.a01 += r.a01; q.a02 += r.a02; q.a03 += r.a03;
+	q.a11 += r.a11; q.a12 += r.a12; q.a13 += r.a13;
+	q.a22 += r.a22; q.a23 += r.a23;
+	q.a33 += r.a33;
+	q.w += r.w;
+}
+
+// mean squared distance of p to the planes of q
+double eval(const Quadric &q, double x, double y, double z) {
+	double e = q.a00*x*x + q.a11*y*y + q.a22*z*z + q.a33
+		+ 2*(q.a01*x*y + q.a02*x*z + q.a12*y*z + q.a03*x + q.a13*y + q.a23*z);
+	return q.w>0 ? std::max(e, 0.)/q.w : 0;
+}
+
+// a face or border plane the original surface lies in, unit normal
+struct Plane {
+	float nx, ny, nz, d;
+	float distance(Vec3f p) const { return std::abs(nx*p.x + ny*p.y + nz*p.z + d); }
+};
+
+struct Collapse {
+	float cost;
+	uint32_t from, to;
+	bool operator<(const Collapse &c) const { return cost<c.cost; }
+};
+
+class Simplifier {
+public:
+	explicit Simplifier(const MeshView &in);
+	void run(uint32_t target);
+	void output(ObjMesh &out) const;
+	float error() const { return max_distance_; }
+
+private:
+	Vec3f pos(uint32_t v) const { return Vec3f(in_.vx[v], in_.vy[v], in_.vz[v]); }
+	// attributes of a corner, texture coordinate and normal index in one
+	static uint64_t attr(uint32_t tex, uint32_t norm) { return (uint64_t)tex<<32 | norm; }
+	// the corner after k in its face
+	static size_t next(size_t k) { return k-k%3+(k+1)%3; }
+	void add_constraint(uint32_t u, uint32_t v, size_t face);
+	void build_adjacency();
+	float cost(uint32_t from, uint32_t to) const;
+	// the plane n*p+d=0 of the original surface around the vertices of vs
+	void keep_plane(Vec3f n, float d, const uint32_t *vs, int count);
+	bool collapse(uint32_t from, uint32_t to);
+	void compact();
+
+	const MeshView &in_;
+	std::vector<uint32_t> corners_; // position of every corner, three per face
+	std::vector<uint64_t> attrs_;   // attr() of every corner
+	std::vector<char> alive_;
+	size_t live_;
+	std::vector<Quadric> quadrics_;
+	std::vector<uint32_t> first_, adjacent_; // faces around every vertex
+	std::vector<char> locked_;
+	// the original planes around the vertices collapsed into each vertex, the
+	// own ones included, and the farthest any vertex that stays is from those
+	std::vector<Plane> planes_;
+	std::vector<std::vector<uint32_t> > vertex_planes_;
+	float max_distance_;
+};
+
+Simplifier::Simplifier(const MeshView &in) : in_(in), corners_(in.faces, in.faces+in.nfaces*3),
+		attrs_(in.nfaces*3), alive_(in.nfaces, 1), live_(in.nfaces), quadrics_(in.nverts), first_(), adjacent_(),
+		locked_(), planes_(), vertex_planes_(in.nverts), max_distance_(0) {
+	for (size_t i=0; i<attrs_.size(); i++) attrs_[i] = attr(in.face_tex[i], in.face_norm[i]);
+	// the corners of a welded mesh that share a position are one vertex
+	// here, told apart by their attributes
+	std::vector<uint32_t> remap;
+	position_remap(in, remap);
+	for (size_t i=0; i<corners_.size(); i++) corners_[i] = remap[corners_[i]];
+	for (size_t f=0; f<in.nfaces; f++) {
+		const uint32_t *c = &corners_[3*f];
+		Vec3f p0 = pos(c[0]);
+		Vec3f n = cross(pos(c[1])-p0, pos(c[2])-p0);
+		float area2 = n.norm();
+		if (area2<=0) continue;
+		n = n*(1.f/area2);
+		for (int i=0; i<3; i++) add_plane(quadrics_[c[i]], n.x, n.y, n.z, -(n*p0), area2*.5);
+		keep_plane(n, -(n*p0), c, 3);
+	}
+
+	// borders have one face, seams two that don't agree on the attributes of
+	// their ends; anything else is not a manifold edge and kept like a border,
+	// two faces running the edge the same way (a fold) included
+	struct Edge {
+		uint32_t lo, hi, corner;
+		bool operator<(const Edge &e) const { return lo!=e.lo ? lo<e.lo : hi<e.hi; }
+	};
+	std::vector<Edge> edges(corners_.size());
+	for (size_t k=0; k<corners_.size(); k++) {
+		uint32_t u = corners_[k], v = corners_[next(k)];
+		Edge e = { std::min(u, v), std::max(u, v), (uint32_t)k };
+		edges[k] = e;
+	}
+	std::sort(edges.begin(), edges.end());
+	for (size_t i=0; i<edges.size(); ) {
+		size_t j = i+1;
+		while (j<edges.size() && edges[j].lo==edges[i].lo && edges[j].hi==edges[i].hi) j++;
+		bool keep = j-i!=2;
+		if (!keep) {
+			// the other face has to run along the edge the other way round
+			size_t k0 = edges[i].corner, k1 = edges[i+1].corner;
+			keep = corners_[k0]!=corners_[next(k1)]
+				|| attrs_[k0]!=attrs_[next(k1)] || attrs_[next(k0)]!=attrs_[k1];
+		}
+		for (size_t k=i; keep && k<j; k++) {
+			size_t c = edges[k].corner;
+			add_constraint(corners_[c], corners_[next(c)], c/3);
+		}
+		i = j;
+	}
+}
+
+void Simplifier::add_constraint(uint32_t u, uint32_t v, size_t face) {
+	const uint32_t *c = &corners_[3*face];
+	Vec3f p0 = pos(c[0]);
+	Vec3f n = cross(pos(c[1])-p0, pos(c[2])-p0);
+	Vec3f e = pos(v)-pos(u);
+	// the plane through the edge square to the face
+	Vec3f m = cross(e, n);
+	float len = m.norm();
+	if (len<=0) return;
+	m = m*(1.f/len);
+	double w = BORDER_WEIGHT*(e*e);
+	add_plane(quadrics_[u], m.x, m.y, m.z, -(m*pos(u)), w);
+	add_plane(quadrics_[v], m.x, m.y, m.z, -(m*pos(u)), w);
+	uint32_t ends[2] = { u, v };
+	keep_plane(m, -(m*pos(u)), ends, 2);
+}
+
+void Simplifier::keep_plane(Vec3f n, float d, const uint32_t *vs, int count) {
+	Plane p = { n.x, n.y, n.z, d };
+	for (int i=0; i<count; i++) vertex_planes_[vs[i]].push_back((uint32_t)planes_.size());
+	planes_.push_back(p);
+}
+
+void Simplifier::build_adjacency() {
+	first_.assign(in_.nverts+1, 0);
+	for (size_t k=0; k<corners_.size(); k++) first_[corners_[k]+1]++;
+	for (size_t v=0; v<in_.nverts; v++) first_[v+1] += first_[v];
+	adjacent_.resize(corners_.size());
+	std::vector<uint32_t> fill(first_.begin(), first_.end()-1);
+	for (size_t k=0; k<corners_.size(); k++) adjacent_[fill[corners_[k]]++] = k/3;
+}
+
+float Simplifier::cost(uint32_t from, uint32_t to) const {
+	Vec3f p = pos(to);
+	return (float)eval(quadrics_[from], p.x, p.y, p.z);
+}
+
+bool Simplifier::collapse(uint32_t from, uint32_t to) {
+	// where every corner of from goes: the corner of to in the same face
+	uint64_t wedge_from[MAX_WEDGES], wedge_to[MAX_WEDGES];
+	int wedges = 0;
+	for (uint32_t i=first_[from]; i<first_[from+1]; i++) {
+		uint32_t f = adjacent_[i];
+		if (!alive_[f]) continue;
+		int kf = -1, kt = -1;
+		for (int k=0; k<3; k++) {
+			if (corners_[3*f+k]==from) kf = 3*f+k;
+			if (corners_[3*f+k]==to) kt = 3*f+k;
+		}
+		if (kt<0) continue;
+		int w = 0;
+		while (w<wedges && wedge_from[w]!=attrs_[kf]) w++;
+		if (w<wedges) {
+			if (wedge_to[w]!=attrs_[kt]) return false;
+			continue;
+		}
+		if (wedges==MAX_WEDGES) return false;
+		wedge_from[wedges] = attrs_[kf];
+		wedge_to[wedges++] = attrs_[kt];
+	}
+	if (!wedges) return false;
+
+	// the faces that stay must keep their attributes and not turn over
+	Vec3f pt = pos(to);
+	for (uint32_t i=first_[from]; i<first_[from+1]; i++) {
+		uint32_t f = adjacent_[i];
+		if (!alive_[f]) continue;
+		const uint32_t *c = &corners_[3*f];
+		if (c[0]==to || c[1]==to || c[2]==to) continue;
+		int k = c[0]==from ? 0 : c[1]==from ? 1 : 2;
+		int w = 0;
+		while (w<wedges && wedge_from[w]!=attrs_[3*f+k]) w++;
+		if (w==wedges) return false;
+		Vec3f p1 = pos(c[(k+1)%3]), p2 = pos(c[(k+2)%3]);
+		Vec3f before = cross(p1-pos(from), p2-pos(from));
+		Vec3f after = cross(p1-pt, p2-pt);
+		if (before*after<=0) return false;
+	}
+
+	for (uint32_t i=first_[from]; i<first_[from+1]; i++) {
+		uint32_t f = adjacent_[i];
+		if (!alive_[f]) continue;
+		uint32_t *c = &corners_[3*f];
+		if (c[0]==to || c[1]==to || c[2]==to) {
+			alive_[f] = 0;
+			live_--;
+			continue;
+		}
+		int k = c[0]==from ? 0 : c[1]==from ? 1 : 2;
+		int w = 0;
+		while (wedge_from[w]!=attrs_[3*f+k]) w++;
+		c[k] = to;
+		attrs_[3*f+k] = wedge_to[w];
+		// whatever shares a face with the moved vertex waits for the next pass
+		for (int j=0; j<3; j++) locked_[c[j]] = 1;
+	}
+	locked_[from] = locked_[to] = 1;
+	add_quadric(quadrics_[to], quadrics_[from]);
+	// to stays where it is, the planes of from now lean on it
+	std::vector<uint32_t> &planes = vertex_planes_[to], &moved = vertex_planes_[from];
+	for (size_t i=0; i<moved.size(); i++) max_distance_ = std::max(max_distance_, planes_[moved[i]].distance(pt));
+	planes.insert(planes.end(), moved.begin(), moved.end());
+	std::sort(planes.begin(), planes.end());
+	planes.erase(std::unique(planes.begin(), planes.end()), planes.end());
+	std::vector<uint32_t>().swap(moved);
+	return true;
+}
+
+void Simplifier::compact() {
+	size_t n = 0;
+	for (size_t f=0; f<alive_.size(); f++) {
+		if (!alive_[f]) continue;
+		for (int k=0; k<3; k++) {
+			corners_[3*n+k] = corners_[3*f+k];
+			attrs_[3*n+k] = attrs_[3*f+k];
+		}
+		n++;
+	}
+	corners_.resize(3*n);
+	attrs_.resize(3*n);
+	alive_.assign(n, 1);
+}
+
+void Simplifier::run(uint32_t target) {
+	std::vector<Collapse> candidates;
+	while (live_>target) {
+		build_adjacency();
+		candidates.clear();
+		for (size_t k=0; k<corners_.size(); k++) {
+			uint32_t u = corners_[k], v = corners_[next(k)];
+			Collapse a = { cost(u, v), u, v }, b = { cost(v, u), v, u };
+			candidates.push_back(a);
+			candidates.push_back(b);
+		}
+		std::sort(candidates.begin(), candidates.end());
+		// cheapest first; a collapse locks its neighbourhood for the rest of
+		// the pass, so the costs the others were sorted by stay true. Only
+		// the cheapest quarter gets a go, which keeps the passes short enough
+		// for the order to stay close to the best one; twice as many when
+		// none of those can be done
+		locked_.assign(in_.nverts, 0);
+		size_t before = live_;
+		size_t window = std::max(candidates.size()/4, (size_t)1);
+		for (size_t i=0; i<candidates.size() && live_>target; i++) {
+			if (i==window) {
+				if (live_<before) break;
+				window *= 2;
+			}
+			const Collapse &c = candidates[i];
+			if (locked_[c.from] || locked_[c.to]) continue;
+			collapse(c.from, c.to);
+		}
+		if (live_==before) break;
+		compact();
+	}
+}
+
+void Simplifier::output(ObjMesh &out) const {
+	out = ObjMesh();
+	const uint32_t NONE = 0xffffffff;
+	std::vector<uint32_t> vmap(in_.nverts, NONE), tmap(in_.ntex, NONE), nmap(in_.nnorm, NONE);
+	for (size_t k=0; k<corners_.size(); k++) {
+		uint32_t v = corners_[k], t = attrs_[k]>>32, n = (uint32_t)attrs_[k];
+		if (vmap[v]==NONE) {
+			vmap[v] = out.vx.size();
+			out.vx.push_back(in_.vx[v]);
+			out.vy.push_back(in_.vy[v]);
+			out.vz.push_back(in_.vz[v]);
+		}
+		if (tmap[t]==NONE) {
+			tmap[t] = out.tu.size();
+			out.tu.push_back(in_.tu[t]);
+			out.tv.push_back(in_.tv[t]);
+		}
+		if (nmap[n]==NONE) {
+			nmap[n] = out.nx.size();
+			out.nx.push_back(in_.nx[n]);
+			out.ny.push_back(in_.ny[n]);
+			out.nz.push_back(in_.nz[n]);
+		}
+		out.faces.push_back(vmap[v]);
+		out.face_tex.push_back(tmap[t]);
+		out.face_norm.push_back(nmap[n]);
+	}
+}
+
+} // namespace
+
+void simplify_mesh(const MeshView &in, uint32_t target, ObjMesh &out, float &error) {
+	Simplifier s(in);
+	s.run(target);
+	s.output(out);
+	error = s.error();
+}
@@ -0,0 +1,24 @@
+#ifndef __SIMPLIFY_H__
+#define __SIMPLIFY_H__
+
+#include <stdint.h>
+#include "model.h"
+
+// Quadric error metric simplification by half edge collapses: a vertex is
+// only ever moved onto one of its neighbours, so no new positions or texture
+// coordinates are made and every face keeps indexing the original ones.
+//
+// A corner's texture coordinate and normal index go along with it. A
+// collapse is only done if every corner of the vertex that goes away has a
+// counterpart across the collapsed edge, which keeps uv and normal seams
+// where they are: seam vertices only slide along their seam. Borders and
+// seams also weigh extra in the quadrics, so they keep their shape.
+//
+// Collapses until the mesh has at most target faces or none is left that
+// doesn't flip a face. error bounds how far the surface moved, in model
+// units: the largest distance of a vertex that stays to the plane of any
+// original face or border around the vertices collapsed into it.
+// out gets only the attributes the faces still use.
+void simplify_mesh(const MeshView &in, uint32_t target, ObjMesh &out, float &error);
+
+#endif //__SIMPLIFY_H__
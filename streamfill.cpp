@@ -0,0 +1,21 @@
+#include <emmintrin.h>
+#include "streamfill.h"
+
+void stream_fill(uint32_t *p, size_t n, uint32_t value) {
+	// plain stores up to the first 16-byte boundary and after the last one
+	while (n && ((uintptr_t)p & 15)) {
+		*p++ = value;
+		n--;
+	}
+	__m128i v = _mm_set1_epi32((int)value);
+	for (; n>=16; n-=16, p+=16) {
+		_mm_stream_si128((__m128i *)p,      v);
+		_mm_stream_si128((__m128i *)(p+4),  v);
+		_mm_stream_si128((__m128i *)(p+8),  v);
+		_mm_stream_si128((__m128i *)(p+12), v);
+	}
+	for (; n>=4; n-=4, p+=4) _mm_stream_si128((__m128i *)p, v);
+	while (n--) *p++ = value;
+	// the streamed lines have to be visible before anyone reads them
+	_mm_sfence();
+}
@@ -0,0 +1,12 @@
+#ifndef __STREAMFILL_H__
+#define __STREAMFILL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Sets n words from p to value with non-temporal stores. For filling whole
+// buffers bigger than the cache: the lines are not read in just to be
+// overwritten, and what is in the cache stays there.
+void stream_fill(uint32_t *p, size_t n, uint32_t value);
+
+#endif //__STREAMFILL_H__
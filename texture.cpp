@@ -0,0 +1,136 @@
+#include <cmath>
+#include <algorithm>
+#include "texture.h"
+
+Texture::Texture() : levels_() {
+}
+
+Texture::Texture(TGAImage &img) : levels_() {
+	build(img);
+}
+
+void Texture::build(TGAImage &img) {
+	levels_.clear();
+	int w = img.get_width(), h = img.get_height();
+	if (w<=0 || h<=0 || !img.buffer()) return;
+	for (;;) {
+		Level l;
+		l.w = w;
+		l.h = h;
+		l.bw = (w+3)/4;
+		l.fw = w;
+		l.fh = h;
+		l.texels.resize(l.bw*((h+3)/4)*16);
+		levels_.push_back(l);
+		if (w==1 && h==1) break;
+		w = std::max(1, w/2);
+		h = std::max(1, h/2);
+	}
+
+	// level 0 straight from the image, everything as bgra
+	Level &base = levels_[0];
+	int bpp = img.get_bytespp();
+	for (int y=0; y<base.h; y++) {
+		for (int x=0; x<base.w; x++) {
+			TGAColor c = img.get(x, y);
+			if (bpp==TGAImage::GRAYSCALE) c = TGAColor(c.raw[0], c.raw[0], c.raw[0], 255);
+			else if (bpp==TGAImage::RGB) c.a = 255;
+			base.texels[(y>>2)*base.bw*16 + (x>>2)*16 + (y&3)*4 + (x&3)] = c.val;
+		}
+	}
+
+	// every other level is the 2x2 box filtered previous one
+	for (size_t i=1; i<levels_.size(); i++) {
+		const Level &src = levels_[i-1];
+		Level &dst = levels_[i];
+		for (int y=0; y<dst.h; y++) {
+			for (int x=0; x<dst.w; x++) {
+				int x0 = std::min(2*x, src.w-1), x1 = std::min(2*x+1, src.w-1);
+				int y0 = std::min(2*y, src.h-1), y1 = std::min(2*y+1, src.h-1);
+				uint32_t t[4] = { texel(src, x0, y0), texel(src, x1, y0), texel(src, x0, y1), texel(src, x1, y1) };
+				uint32_t out = 0;
+				for (int c=0; c<32; c+=8) {
+					uint32_t sum = 2;
+					for (int k=0; k<4; k++) sum += (t[k]>>c) & 255;
+					out |= (sum>>2)<<c;
+				}
+				dst.texels[(y>>2)*dst.bw*16 + (x>>2)*16 + (y&3)*4 + (x&3)] = out;
+			}
+		}
+	}
+}
+
+int Texture::get_width() const {
+	return levels_.empty() ? 0 : levels_[0].w;
+}
+
+int Texture::get_height() const {
+	return levels_.empty() ? 0 : levels_[0].h;
+}
+
+int Texture::levels() const {
+	return (int)levels_.size();
+}
+
+uint32_t Texture::texel(const Level &l, int x, int y) const {
+	return l.texels[(y>>2)*l.bw*16 + (x>>2)*16 + (y&3)*4 + (x&3)];
+}
+
+float Texture::lod(float dudx, float dvdx, float dudy, float dvdy) const {
+	if (levels_.empty()) return 0;
+	float w = levels_[0].fw, h = levels_[0].fh;
+	float rx = (dudx*w)*(dudx*w) + (dvdx*h)*(dvdx*h);
+	float ry = (dudy*w)*(dudy*w) + (dvdy*h)*(dvdy*h);
+	float rho2 = std::max(rx, ry);
+	// log2(sqrt(rho2)), and magnification stays on level 0
+	return rho2>1.f ? .5f*std::log2(rho2) : 0.f;
+}
+
+uint32_t Texture::nearest(const Level &l, float u, float v) const {
+	int x = std::min(std::max(int(u*l.fw), 0), l.w-1);
+	int y = std::min(std::max(int(v*l.fh), 0), l.h-1);
+	return texel(l, x, y);
+}
+
+uint32_t Texture::bilinear(const Level &l, float u, float v) const {
+	float fx = u*l.fw - .5f, fy = v*l.fh - .5f;
+	float flx = std::floor(fx), fly = std::floor(fy);
+	int wx = int((fx-flx)*256), wy = int((fy-fly)*256);
+	int x0 = int(flx), y0 = int(fly);
+	int x1 = std::min(std::max(x0+1, 0), l.w-1), y1 = std::min(std::max(y0+1, 0), l.h-1);
+	x0 = std::min(std::max(x0, 0), l.w-1);
+	y0 = std::min(std::max(y0, 0), l.h-1);
+	uint32_t t00 = texel(l, x0, y0), t10 = texel(l, x1, y0);
+	uint32_t t01 = texel(l, x0, y1), t11 = texel(l, x1, y1);
+	uint32_t out = 0;
+	for (int c=0; c<32; c+=8) {
+		uint32_t top = ((t00>>c)&255)*(256-wx) + ((t10>>c)&255)*wx;
+		uint32_t bot = ((t01>>c)&255)*(256-wx) + ((t11>>c)&255)*wx;
+		out |= ((top*(256-wy) + bot*wy + 32768)>>16)<<c;
+	}
+	return out;
+}
+
+uint32_t Texture::sample(float u, float v, float lod, Filter filter) const {
+	if (levels_.empty()) return 0;
+	int last = (int)levels_.size()-1;
+	if (filter==NEAREST) return nearest(levels_[0], u, v);
+	if (filter==BILINEAR) {
+		int l = std::min(std::max(int(lod+.5f), 0), last);
+		return bilinear(levels_[l], u, v);
+	}
+	lod = std::min(std::max(lod, 0.f), (float)last);
+	int l0 = int(lod);
+	int w = int((lod-l0)*256);
+	uint32_t a = bilinear(levels_[l0], u, v);
+	if (!w || l0==last) return a;
+	uint32_t b = bilinear(levels_[l0+1], u, v);
+	uint32_t out = 0;
+	for (int c=0; c<32; c+=8)
+		out |= ((((a>>c)&255)*(256-w) + ((b>>c)&255)*w + 128)>>8)<<c;
+	return out;
+}
+
+TGAColor Texture::sample_color(float u, float v, float lod, Filter filter) const {
+	return TGAColor((int)sample(u, v, lod, filter), 4);
+}
@@ -0,0 +1,48 @@
+#ifndef __TEXTURE_H__
+#define __TEXTURE_H__
+
+#include <vector>
+#include <stdint.h>
+#include "tgaimage.h"
+
+// Read-only texture built from a TGAImage: a full mip chain, each level stored
+// as 4x4 blocks of packed bgra texels, so one block is one 64-byte cache line
+// and a bilinear footprint touches one or two lines instead of two rows.
+// Texel (0,0) is the first pixel of the image, coordinates are clamped.
+class Texture {
+public:
+	enum Filter {
+		NEAREST, BILINEAR, TRILINEAR
+	};
+
+	Texture();
+	explicit Texture(TGAImage &img);
+	void build(TGAImage &img);
+	int get_width() const;
+	int get_height() const;
+	int levels() const;
+
+	// level of detail for the given uv derivatives along screen x and y
+	float lod(float dudx, float dvdx, float dudy, float dvdy) const;
+	// bgra packed like TGAColor::val. BILINEAR samples the mip level nearest
+	// to lod, TRILINEAR blends the two around it, NEAREST ignores lod and
+	// always samples level 0
+	uint32_t sample(float u, float v, float lod, Filter filter) const;
+	TGAColor sample_color(float u, float v, float lod, Filter filter) const;
+
+private:
+	struct Level {
+		int w, h;
+		int bw; // blocks per row
+		float fw, fh;
+		std::vector<uint32_t> texels;
+	};
+
+	uint32_t texel(const Level &l, int x, int y) const;
+	uint32_t nearest(const Level &l, float u, float v) const;
+	uint32_t bilinear(const Level &l, float u, float v) const;
+
+	std::vector<Level> levels_;
+};
+
+#endif //__TEXTURE_H__
@@ -3,7 +3,13 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "tgaimage.h"
+#include "threadpool.h"
 
 TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
 }
@@ -40,20 +46,168 @@ TGAImage & TGAImage::operator =(const TGAImage &img) {
 	return *this;
 }
 
+namespace {
+
+const unsigned char FOOTER[26] = {
+	0, 0, 0, 0, // developer area
+	0, 0, 0, 0, // extension area
+	'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'
+};
+const int MAX_PACKET = 128;
+const int BAND_ROWS = 64;
+const size_t WRITE_BUFFER = 1<<20;
+
+// a pixel as one word, so two pixels compare in one go whatever their size
+template <int BPP> inline uint32_t pixel(const unsigned char *p) {
+	uint32_t v = 0;
+	memcpy(&v, p, BPP);
+	return v;
+}
+
+// How many of the n pixels from p are equal to the first one. Pixel k equals
+// pixel k-1 when its bytes equal the ones BPP bytes before, so the whole run
+// is one overlapping compare of the bytes against themselves shifted by a
+// pixel, eight bytes at a time; the lowest differing byte gives the pixel.
+template <int BPP> int run_length(const unsigned char *p, int n) {
+	size_t len = (size_t)(n-1)*BPP;
+	size_t i = 0;
+	for (; i+8<=len; i+=8) {
+		uint64_t a, b;
+		memcpy(&a, p+i, 8);
+		memcpy(&b, p+i+BPP, 8);
+		if (a!=b) return (int)((i + (__builtin_ctzll(a^b)>>3))/BPP) + 1;
+	}
+	for (; i<len; i++)
+		if (p[i]!=p[i+BPP]) return (int)(i/BPP) + 1;
+	return n;
+}
+
+// How many of the n pixels from p go in a raw packet: up to the next equal
+// pixels that are cheaper as a run. Two of them in a run packet save BPP-1
+// bytes and the raw packet after them costs a header byte, so one byte pixels
+// only break the raw packet for three.
+template <int BPP> int raw_length(const unsigned char *p, int n) {
+	uint32_t a = pixel<BPP>(p+BPP);
+	for (int i=1; i+1<n; i++) {
+		uint32_t b = pixel<BPP>(p+(i+1)*BPP);
+		if (a==b && (BPP>1 || (i+2<n && pixel<BPP>(p+(i+2)*BPP)==b))) return i;
+		a = b;
+	}
+	return n;
+}
+
+// rle encodes n rows of w pixels into out, which has room for encoded_size()
+template <int BPP> size_t encode_rows(const unsigned char *rows, int w, int n, unsigned char *out) {
+	unsigned char *dst = out;
+	for (int j=0; j<n; j++) {
+		const unsigned char *p = rows + (size_t)j*w*BPP;
+		for (int x=0; x<w; ) {
+			int left = std::min(MAX_PACKET, w-x);
+			int run = run_length<BPP>(p, left);
+			if (run>1) {
+				*dst++ = (unsigned char)(127+run);
+				memcpy(dst, p, BPP);
+				dst += BPP;
+			} else {
+				run = raw_length<BPP>(p, left);
+				*dst++ = (unsigned char)(run-1);
+				memcpy(dst, p, (size_t)run*BPP);
+				dst += (size_t)run*BPP;
+			}
+			p += (size_t)run*BPP;
+			x += run;
+		}
+	}
+	return dst-out;
+}
+
+// every packet covers at least one pixel and costs at most one header byte more
+size_t encoded_size(int w, int n, int bpp) {
+	return (size_t)w*n*(bpp+1);
+}
+
+size_t encode_rows(const unsigned char *rows, int w, int n, int bpp, unsigned char *out) {
+	switch (bpp) {
+	case TGAImage::GRAYSCALE: return encode_rows<1>(rows, w, n, out);
+	case TGAImage::RGB:       return encode_rows<3>(rows, w, n, out);
+	default:                  return encode_rows<4>(rows, w, n, out);
+	}
+}
+
+// decodes npixels pixels of rle data from [in,end) into out, packets may cross scanlines
+template <int BPP> bool decode_rle(const unsigned char *in, const unsigned char *end, unsigned char *out, size_t npixels) {
+	unsigned char *dst = out, *dst_end = out + npixels*BPP;
+	while (dst<dst_end) {
+		if (in>=end) return false;
+		size_t count = (*in & 127) + 1;
+		bool run = *in++ & 128;
+		size_t bytes = count*BPP;
+		if (bytes>(size_t)(dst_end-dst)) {
+			std::cerr << "Too many pixels read\n";
+			return false;
+		}
+		if ((size_t)(end-in)<(run ? BPP : bytes)) return false;
+		if (!run) {
+			memcpy(dst, in, bytes);
+			in += bytes;
+		} else {
+			for (size_t i=0; i<count; i++) memcpy(dst+i*BPP, in, BPP);
+			in += BPP;
+		}
+		dst += bytes;
+	}
+	return true;
+}
+
+bool decode_rle(const unsigned char *in, const unsigned char *end, unsigned char *out, size_t npixels, int bpp) {
+	switch (bpp) {
+	case TGAImage::GRAYSCALE: return decode_rle<1>(in, end, out, npixels);
+	case TGAImage::RGB:       return decode_rle<3>(in, end, out, npixels);
+	default:                  return decode_rle<4>(in, end, out, npixels);
+	}
+}
+
+// read(2) until n bytes are in
+bool read_all(int fd, unsigned char *p, size_t n) {
+	while (n) {
+		ssize_t k = read(fd, p, n);
+		if (k<0 && errno==EINTR) continue;
+		if (k<=0) return false;
+		p += k;
+		n -= k;
+	}
+	return true;
+}
+
+// write(2) until all of it is out
+bool write_all(int fd, const unsigned char *p, size_t n) {
+	while (n) {
+		ssize_t k = write(fd, p, n);
+		if (k<0 && errno==EINTR) continue;
+		if (k<=0) return false;
+		p += k;
+		n -= k;
+	}
+	return true;
+}
+
+} // namespace
+
 bool TGAImage::read_tga_file(const char *filename) {
 	if (data) delete [] data;
 	data = NULL;
-	std::ifstream in;
-	in.open (filename, std::ios::binary);
-	if (!in.is_open()) {
+	// raw pixels are read straight into place, rle data in one go and decoded
+	// in memory, no stream calls per pixel
+	int fd = open(filename, O_RDONLY);
+	if (fd<0) {
 		std::cerr << "can't open file " << filename << "\n";
-		in.close();
 		return false;
 	}
+	struct stat st;
 	TGA_Header header;
-	in.read((char *)&header, sizeof(header));
-	if (!in.good()) {
-		in.close();
+	if (fstat(fd, &st)<0 || !read_all(fd, (unsigned char *)&header, sizeof(header))
+			|| lseek(fd, (unsigned char)header.idlength, SEEK_CUR)<0) {
+		close(fd);
 		std::cerr << "an error occured while reading the header\n";
 		return false;
 	}
@@ -61,30 +215,34 @@ bool TGAImage::read_tga_file(const char *filename) {
 	height  = header.height;
 	bytespp = header.bitsperpixel>>3;
 	if (width<=0 || height<=0 || (bytespp!=GRAYSCALE && bytespp!=RGB && bytespp!=RGBA)) {
-		in.close();
+		close(fd);
 		std::cerr << "bad bpp (or width/height) value\n";
 		return false;
 	}
-	unsigned long nbytes = bytespp*width*height;
-	data = new unsigned char[nbytes];
+	size_t npixels = (size_t)width*height;
+	bool ok = true;
+	data = new unsigned char[npixels*bytespp];
 	if (3==header.datatypecode || 2==header.datatypecode) {
-		in.read((char *)data, nbytes);
-		if (!in.good()) {
-			in.close();
-			std::cerr << "an error occured while reading the data\n";
-			return false;
-		}
+		ok = read_all(fd, data, npixels*bytespp);
 	} else if (10==header.datatypecode||11==header.datatypecode) {
-		if (!load_rle_data(in)) {
-			in.close();
-			std::cerr << "an error occured while reading the data\n";
-			return false;
-		}
+		off_t start = sizeof(header) + (unsigned char)header.idlength;
+		std::vector<unsigned char> packed(st.st_size>start ? st.st_size-start : 0);
+		ok = !packed.empty() && read_all(fd, &packed[0], packed.size())
+			&& decode_rle(&packed[0], &packed[0]+packed.size(), data, npixels, bytespp);
 	} else {
-		in.close();
+		close(fd);
+		delete [] data;
+		data = NULL;
 		std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
 		return false;
 	}
+	close(fd);
+	if (!ok) {
+		delete [] data;
+		data = NULL;
+		std::cerr << "an error occured while reading the data\n";
+		return false;
+	}
 	if (!(header.imagedescriptor & 0x20)) {
 		flip_vertically();
 	}
@@ -92,162 +250,111 @@ bool TGAImage::read_tga_file(const char *filename) {
 		flip_horizontally();
 	}
 	std::cerr << width << "x" << height << "/" << bytespp*8 << "\n";
-	in.close();
 	return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream &in) {
-	unsigned long pixelcount = width*height;
-	unsigned long currentpixel = 0;
-	unsigned long currentbyte  = 0;
-	TGAColor colorbuffer;
-	do {
-		unsigned char chunkheader = 0;
-		chunkheader = in.get();
-		if (!in.good()) {
-			std::cerr << "an error occured while reading the data\n";
-			return false;
-		}
-		if (chunkheader<128) {
-			chunkheader++;
-			for (int i=0; i<chunkheader; i++) {
-				in.read((char *)colorbuffer.raw, bytespp);
-				if (!in.good()) {
-					std::cerr << "an error occured while reading the header\n";
-					return false;
-				}
-				for (int t=0; t<bytespp; t++)
-					data[currentbyte++] = colorbuffer.raw[t];
-				currentpixel++;
-				if (currentpixel>pixelcount) {
-					std::cerr << "Too many pixels read\n";
-					return false;
-				}
-			}
-		} else {
-			chunkheader -= 127;
-			in.read((char *)colorbuffer.raw, bytespp);
-			if (!in.good()) {
-				std::cerr << "an error occured while reading the header\n";
-				return false;
-			}
-			for (int i=0; i<chunkheader; i++) {
-				for (int t=0; t<bytespp; t++)
-					data[currentbyte++] = colorbuffer.raw[t];
-				currentpixel++;
-				if (currentpixel>pixelcount) {
-					std::cerr << "Too many pixels read\n";
-					return false;
-				}
-			}
-		}
-	} while (currentpixel < pixelcount);
-	return true;
+bool TGAImage::write_tga_file(const char *filename, bool rle, ThreadPool *pool) {
+	TGAWriter out;
+	if (!out.open(filename, width, height, bytespp, rle)) return false;
+	out.write_rows(data, height, pool);
+	return out.close();
+}
+
+TGAWriter::TGAWriter() : fd_(-1), width_(0), height_(0), bytespp_(0), rle_(false), rows_(0), ok_(false),
+		buffer_(), used_(0), bands_() {
 }
 
-bool TGAImage::write_tga_file(const char *filename, bool rle) {
-	unsigned char developer_area_ref[4] = {0, 0, 0, 0};
-	unsigned char extension_area_ref[4] = {0, 0, 0, 0};
-	unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
-	std::ofstream out;
-	out.open (filename, std::ios::binary);
-	if (!out.is_open()) {
+TGAWriter::~TGAWriter() {
+	if (fd_>=0) close();
+}
+
+bool TGAWriter::open(const char *filename, int width, int height, int bytespp, bool rle) {
+	if (fd_>=0) close();
+	fd_ = ::open(filename, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+	if (fd_<0) {
 		std::cerr << "can't open file " << filename << "\n";
-		out.close();
 		return false;
 	}
+	width_ = width;
+	height_ = height;
+	bytespp_ = bytespp;
+	rle_ = rle;
+	rows_ = 0;
+	ok_ = true;
+	buffer_.resize(std::max(WRITE_BUFFER, encoded_size(width, 1, bytespp)));
+	used_ = 0;
 	TGA_Header header;
 	memset((void *)&header, 0, sizeof(header));
 	header.bitsperpixel = bytespp<<3;
 	header.width  = width;
 	header.height = height;
-	header.datatypecode = (bytespp==GRAYSCALE?(rle?11:3):(rle?10:2));
+	header.datatypecode = (bytespp==TGAImage::GRAYSCALE?(rle?11:3):(rle?10:2));
 	header.imagedescriptor = 0x20; // top-left origin
-	out.write((char *)&header, sizeof(header));
-	if (!out.good()) {
-		out.close();
-		std::cerr << "can't dump the tga file\n";
-		return false;
-	}
-	if (!rle) {
-		out.write((char *)data, width*height*bytespp);
-		if (!out.good()) {
-			std::cerr << "can't unload raw data\n";
-			out.close();
-			return false;
-		}
-	} else {
-		if (!unload_rle_data(out)) {
-			out.close();
-			std::cerr << "can't unload rle data\n";
-			return false;
-		}
-	}
-	out.write((char *)developer_area_ref, sizeof(developer_area_ref));
-	if (!out.good()) {
-		std::cerr << "can't dump the tga file\n";
-		out.close();
-		return false;
+	return put((const unsigned char *)&header, sizeof(header));
+}
+
+bool TGAWriter::write_rows(const unsigned char *rows, int n, ThreadPool *pool) {
+	if (fd_<0 || !ok_) return false;
+	n = std::min(n, height_-rows_);
+	rows_ += n;
+	size_t line = (size_t)width_*bytespp_;
+	if (!rle_) return put(rows, line*n);
+	int nbands = (n+BAND_ROWS-1)/BAND_ROWS;
+	if (pool && nbands>1) {
+		// bands encoded side by side, then written out in order
+		if ((int)bands_.size()<nbands) bands_.resize(nbands);
+		pool->parallel_for(nbands, [&](int i) {
+			int rows_in_band = std::min(BAND_ROWS, n-i*BAND_ROWS);
+			std::vector<unsigned char> &band = bands_[i];
+			band.resize(encoded_size(width_, rows_in_band, bytespp_));
+			band.resize(encode_rows(rows+i*BAND_ROWS*line, width_, rows_in_band, bytespp_, &band[0]));
+		});
+		for (int i=0; i<nbands && ok_; i++) put(&bands_[i][0], bands_[i].size());
+		return ok_;
 	}
-	out.write((char *)extension_area_ref, sizeof(extension_area_ref));
-	if (!out.good()) {
-		std::cerr << "can't dump the tga file\n";
-		out.close();
-		return false;
+	// encoded a row at a time right into the output buffer
+	size_t worst = encoded_size(width_, 1, bytespp_);
+	for (int j=0; j<n && ok_; j++) {
+		if (used_+worst>buffer_.size()) flush();
+		used_ += encode_rows(rows+j*line, width_, 1, bytespp_, &buffer_[used_]);
 	}
-	out.write((char *)footer, sizeof(footer));
-	if (!out.good()) {
-		std::cerr << "can't dump the tga file\n";
-		out.close();
-		return false;
+	return ok_;
+}
+
+bool TGAWriter::close() {
+	if (fd_<0) return false;
+	if (ok_ && rows_<height_) {
+		std::cerr << "can't dump the tga file, " << height_-rows_ << " rows missing\n";
+		ok_ = false;
 	}
-	out.close();
-	return true;
+	if (ok_) put(FOOTER, sizeof(FOOTER));
+	if (ok_) flush();
+	if (::close(fd_)<0) ok_ = false;
+	fd_ = -1;
+	return ok_;
 }
 
-// TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
-bool TGAImage::unload_rle_data(std::ofstream &out) {
-	const unsigned char max_chunk_length = 128;
-	unsigned long npixels = width*height;
-	unsigned long curpix = 0;
-	while (curpix<npixels) {
-		unsigned long chunkstart = curpix*bytespp;
-		unsigned long curbyte = curpix*bytespp;
-		unsigned char run_length = 1;
-		bool raw = true;
-		while (curpix+run_length<npixels && run_length<max_chunk_length) {
-			bool succ_eq = true;
-			for (int t=0; succ_eq && t<bytespp; t++) {
-				succ_eq = (data[curbyte+t]==data[curbyte+t+bytespp]);
-			}
-			curbyte += bytespp;
-			if (1==run_length) {
-				raw = !succ_eq;
-			}
-			if (raw && succ_eq) {
-				run_length--;
-				break;
-			}
-			if (!raw && !succ_eq) {
-				break;
-			}
-			run_length++;
-		}
-		curpix += run_length;
-		out.put(raw?run_length-1:run_length+127);
-		if (!out.good()) {
-			std::cerr << "can't dump the tga file\n";
-			return false;
-		}
-		out.write((char *)(data+chunkstart), (raw?run_length*bytespp:bytespp));
-		if (!out.good()) {
-			std::cerr << "can't dump the tga file\n";
-			return false;
-		}
+bool TGAWriter::put(const unsigned char *p, size_t n) {
+	if (!ok_) return false;
+	if (used_+n>buffer_.size() && !flush()) return false;
+	if (n>=buffer_.size()) {
+		// big enough not to be worth copying
+		ok_ = write_all(fd_, p, n);
+		if (!ok_) std::cerr << "can't dump the tga file\n";
+		return ok_;
 	}
+	memcpy(&buffer_[used_], p, n);
+	used_ += n;
 	return true;
 }
 
+bool TGAWriter::flush() {
+	if (ok_ && used_) ok_ = write_all(fd_, &buffer_[0], used_);
+	used_ = 0;
+	if (!ok_) std::cerr << "can't dump the tga file\n";
+	return ok_;
+}
+
 TGAColor TGAImage::get(int x, int y) {
 	if (!data || x<0 || y<0 || x>=width || y>=height) {
 		return TGAColor();
@@ -276,17 +383,10 @@ int TGAImage::get_height() {
 }
 
 bool TGAImage::flip_horizontally() {
-	if (!data) return false;
-	int half = width>>1;
-	for (int i=0; i<half; i++) {
-		for (int j=0; j<height; j++) {
-			TGAColor c1 = get(i, j);
-			TGAColor c2 = get(width-1-i, j);
-			set(i, j, c2);
-			set(width-1-i, j, c1);
-		}
-	}
-	return true;
+	return with_view(*this, [](auto view) {
+		for (int j=0; j<view.get_height(); j++)
+			std::reverse(view.row(j), view.row(j)+view.get_width());
+	});
 }
 
 bool TGAImage::flip_vertically() {
@@ -2,6 +2,12 @@
 #define __IMAGE_H__
 
 #include <fstream>
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+
+class ThreadPool;
 
 #pragma pack(push,1)
 struct TGA_Header {
@@ -66,9 +72,6 @@ protected:
 	int width;
 	int height;
 	int bytespp;
-
-	bool   load_rle_data(std::ifstream &in);
-	bool unload_rle_data(std::ofstream &out);
 public:
 	enum Format {
 		GRAYSCALE=1, RGB=3, RGBA=4
@@ -78,7 +81,8 @@ public:
 	TGAImage(int w, int h, int bpp);
 	TGAImage(const TGAImage &img);
 	bool read_tga_file(const char *filename);
-	bool write_tga_file(const char *filename, bool rle=true);
+	// with a pool, rle encoding is split into bands of rows encoded in parallel
+	bool write_tga_file(const char *filename, bool rle=true, ThreadPool *pool=NULL);
 	bool flip_horizontally();
 	bool flip_vertically();
 	bool scale(int w, int h);
@@ -93,4 +97,154 @@ public:
 	void clear();
 };
 
+// Writes a tga file a few rows at a time, top row first, so a frame can be
+// handed over in bands as they are finished instead of all at the end. Rows
+// are encoded straight into one output buffer that goes out in large writes.
+// rle packets never cross a scanline, which is what lets bands be encoded
+// independently of each other.
+class TGAWriter {
+public:
+	TGAWriter();
+	~TGAWriter();
+	bool open(const char *filename, int width, int height, int bytespp, bool rle=true);
+	// the next n rows, width*bytespp bytes each
+	bool write_rows(const unsigned char *rows, int n, ThreadPool *pool=NULL);
+	// writes the footer, false if anything went wrong since open()
+	bool close();
+	bool is_open() const { return fd_>=0; }
+
+private:
+	TGAWriter(const TGAWriter &);
+	TGAWriter & operator =(const TGAWriter &);
+
+	bool put(const unsigned char *p, size_t n);
+	bool flush();
+
+	int fd_;
+	int width_, height_, bytespp_;
+	bool rle_;
+	int rows_;
+	bool ok_;
+	std::vector<unsigned char> buffer_;
+	size_t used_;
+	std::vector<std::vector<unsigned char> > bands_;
+};
+
+// Pixel layouts of the three formats, in file byte order
+struct PixelGray {
+	unsigned char v;
+	PixelGray() : v(0) {}
+	explicit PixelGray(unsigned char V) : v(V) {}
+	explicit PixelGray(const TGAColor &c) : v(c.raw[0]) {}
+};
+
+struct PixelRGB {
+	unsigned char b, g, r;
+	PixelRGB() : b(0), g(0), r(0) {}
+	PixelRGB(unsigned char R, unsigned char G, unsigned char B) : b(B), g(G), r(R) {}
+	explicit PixelRGB(const TGAColor &c) : b(c.b), g(c.g), r(c.r) {}
+};
+
+struct PixelRGBA {
+	unsigned char b, g, r, a;
+	PixelRGBA() : b(0), g(0), r(0), a(0) {}
+	PixelRGBA(unsigned char R, unsigned char G, unsigned char B, unsigned char A) : b(B), g(G), r(R), a(A) {}
+	explicit PixelRGBA(const TGAColor &c) : b(c.b), g(c.g), r(c.r), a(c.a) {}
+};
+
+// Typed view of the pixels of a TGAImage whose format is known: no bounds
+// checks, no TGAColor, no runtime pixel size, so loops over it inline and
+// vectorize. The rectangle operations clip once, not per pixel. The view
+// does not own anything and is invalidated by anything that reallocates
+// the image (read_tga_file, scale, assignment).
+template <class P> class ImageView {
+	P *data_;
+	int width_, height_;
+public:
+	explicit ImageView(TGAImage &img) : data_((P *)img.buffer()), width_(img.get_width()), height_(img.get_height()) {
+		assert(img.get_bytespp()==(int)sizeof(P));
+	}
+	int get_width() const { return width_; }
+	int get_height() const { return height_; }
+	P *row(int y) const { return data_ + (size_t)y*width_; }
+	P &at(int x, int y) const { return data_[x + (size_t)y*width_]; }
+	void set(int x, int y, const P &p) const { data_[x + (size_t)y*width_] = p; }
+
+	void fill(const P &p) const {
+		fill_rect(0, 0, width_, height_, p);
+	}
+
+	void fill_rect(int x, int y, int w, int h, const P &p) const {
+		if (!clip(x, y, w, h)) return;
+		P *first = row(y)+x;
+		std::fill(first, first+w, p);
+		for (int j=1; j<h; j++) memcpy(row(y+j)+x, first, w*sizeof(P));
+	}
+
+	// src may be this same image with the rectangles overlapping
+	void copy_rect(const ImageView<P> &src, int sx, int sy, int w, int h, int dx, int dy) const {
+		if (!clip_pair(src, sx, sy, w, h, dx, dy)) return;
+		// rows moving to higher y are copied from the last one back, so none is
+		// overwritten before it is read
+		if (dy>sy) {
+			for (int j=h-1; j>=0; j--) memmove(row(dy+j)+dx, src.row(sy+j)+sx, w*sizeof(P));
+		} else {
+			for (int j=0; j<h; j++) memmove(row(dy+j)+dx, src.row(sy+j)+sx, w*sizeof(P));
+		}
+	}
+
+	// dst = src*alpha + dst*(1-alpha), alpha in 0..255, every channel alike
+	void blend_rect(const ImageView<P> &src, int sx, int sy, int w, int h, int dx, int dy, unsigned char alpha) const {
+		if (!clip_pair(src, sx, sy, w, h, dx, dy)) return;
+		int n = w*sizeof(P);
+		unsigned a = alpha, ia = 255-alpha;
+		for (int j=0; j<h; j++) {
+			const unsigned char *s = (const unsigned char *)(src.row(sy+j)+sx);
+			unsigned char *d = (unsigned char *)(row(dy+j)+dx);
+			for (int i=0; i<n; i++) d[i] = (s[i]*a + d[i]*ia + 127)/255;
+		}
+	}
+
+	void blend(int x, int y, const P &p, unsigned char alpha) const {
+		const unsigned char *s = (const unsigned char *)&p;
+		unsigned char *d = (unsigned char *)&at(x, y);
+		for (int i=0; i<(int)sizeof(P); i++) d[i] = (s[i]*alpha + d[i]*(255-alpha) + 127)/255;
+	}
+
+private:
+	bool clip(int &x, int &y, int &w, int &h) const {
+		if (x<0) { w += x; x = 0; }
+		if (y<0) { h += y; y = 0; }
+		w = std::min(w, width_-x);
+		h = std::min(h, height_-y);
+		return w>0 && h>0;
+	}
+
+	bool clip_pair(const ImageView<P> &src, int &sx, int &sy, int &w, int &h, int &dx, int &dy) const {
+		if (sx<0) { w += sx; dx -= sx; sx = 0; }
+		if (sy<0) { h += sy; dy -= sy; sy = 0; }
+		if (dx<0) { w += dx; sx -= dx; dx = 0; }
+		if (dy<0) { h += dy; sy -= dy; dy = 0; }
+		w = std::min(w, std::min(width_-dx, src.width_-sx));
+		h = std::min(h, std::min(height_-dy, src.height_-sy));
+		return w>0 && h>0;
+	}
+};
+
+typedef ImageView<PixelGray> GrayView;
+typedef ImageView<PixelRGB>  RGBView;
+typedef ImageView<PixelRGBA> RGBAView;
+
+// Calls f with the view matching the format of img, so the format is looked at
+// once and whatever f does per pixel is compiled for each format separately.
+template <class F> bool with_view(TGAImage &img, F f) {
+	if (!img.buffer()) return false;
+	switch (img.get_bytespp()) {
+	case TGAImage::GRAYSCALE: f(GrayView(img)); return true;
+	case TGAImage::RGB:       f(RGBView(img));  return true;
+	case TGAImage::RGBA:      f(RGBAView(img)); return true;
+	}
+	return false;
+}
+
 #endif //__IMAGE_H__
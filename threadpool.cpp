@@ -0,0 +1,112 @@
+#include "threadpool.h"
+
+// lets a task that submits more work push onto its own worker's deque
+static thread_local ThreadPool *tls_pool = NULL;
+static thread_local int tls_self = -1;
+
+ThreadPool::ThreadPool(int nthreads) : pending_(0), inflight_(0), next_(0), stop_(false) {
+	if (nthreads<=0) nthreads = (int)std::thread::hardware_concurrency();
+	if (nthreads<=0) nthreads = 1;
+	for (int i=0; i<nthreads; i++) queues_.push_back(new Queue());
+	for (int i=0; i<nthreads; i++) workers_.push_back(std::thread(&ThreadPool::worker_loop, this, i));
+}
+
+ThreadPool::~ThreadPool() {
+	wait();
+	{
+		std::lock_guard<std::mutex> guard(mtx_);
+		stop_ = true;
+	}
+	cv_.notify_all();
+	for (size_t i=0; i<workers_.size(); i++) workers_[i].join();
+	for (size_t i=0; i<queues_.size(); i++) delete queues_[i];
+}
+
+int ThreadPool::size() const {
+	return (int)workers_.size();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+	int n = (int)queues_.size();
+	int q = (tls_pool==this && tls_self>=0) ? tls_self : (int)(next_++ % n);
+	inflight_++;
+	{
+		std::lock_guard<std::mutex> guard(queues_[q]->lock);
+		queues_[q]->tasks.push_back(std::move(task));
+	}
+	{
+		std::lock_guard<std::mutex> guard(mtx_);
+		pending_++;
+	}
+	cv_.notify_one();
+}
+
+bool ThreadPool::try_run(int self) {
+	int n = (int)queues_.size();
+	std::function<void()> task;
+	bool found = false;
+	if (self>=0) {
+		Queue *q = queues_[self];
+		std::lock_guard<std::mutex> guard(q->lock);
+		if (!q->tasks.empty()) {
+			task = std::move(q->tasks.back());
+			q->tasks.pop_back();
+			found = true;
+		}
+	}
+	// nothing local, steal the oldest task of somebody else
+	for (int i=1; !found && i<=n; i++) {
+		int victim = ((self<0 ? 0 : self)+i) % n;
+		if (victim==self) continue;
+		Queue *q = queues_[victim];
+		std::lock_guard<std::mutex> guard(q->lock);
+		if (!q->tasks.empty()) {
+			task = std::move(q->tasks.front());
+			q->tasks.pop_front();
+			found = true;
+		}
+	}
+	if (!found) return false;
+	pending_--;
+	task();
+	if (--inflight_==0) {
+		std::lock_guard<std::mutex> guard(mtx_);
+		idle_cv_.notify_all();
+	}
+	return true;
+}
+
+void ThreadPool::worker_loop(int self) {
+	tls_pool = this;
+	tls_self = self;
+	for (;;) {
+		if (try_run(self)) continue;
+		std::unique_lock<std::mutex> guard(mtx_);
+		cv_.wait(guard, [this] { return stop_ || pending_>0; });
+		if (stop_ && pending_<=0) return;
+	}
+}
+
+void ThreadPool::parallel_for(int n, const std::function<void(int)> &fn) {
+	if (n<=0) return;
+	std::atomic<int> remaining(n);
+	for (int i=0; i<n; i++) {
+		submit([&fn, &remaining, i] {
+			fn(i);
+			remaining--;
+		});
+	}
+	int self = tls_pool==this ? tls_self : -1;
+	while (remaining>0) {
+		if (!try_run(self)) std::this_thread::yield();
+	}
+}
+
+void ThreadPool::wait() {
+	int self = tls_pool==this ? tls_self : -1;
+	while (inflight_>0) {
+		if (try_run(self)) continue;
+		std::unique_lock<std::mutex> guard(mtx_);
+		idle_cv_.wait(guard, [this] { return inflight_<=0 || pending_>0; });
+	}
+}
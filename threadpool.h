@@ -0,0 +1,47 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of workers, each with its own task deque. A worker pops from the
+// back of its own deque and steals from the front of the others when it runs dry.
+class ThreadPool {
+public:
+	explicit ThreadPool(int nthreads=0); // 0 means one worker per hardware thread
+	~ThreadPool();
+
+	int size() const;
+	void submit(std::function<void()> task);
+	// runs fn(0..n-1) on the pool and returns once all of them are done;
+	// the calling thread helps out instead of sleeping
+	void parallel_for(int n, const std::function<void(int)> &fn);
+	// blocks until every submitted task has finished
+	void wait();
+
+private:
+	struct Queue {
+		std::mutex lock;
+		std::deque<std::function<void()> > tasks;
+	};
+
+	bool try_run(int self);
+	void worker_loop(int self);
+
+	std::vector<std::thread> workers_;
+	std::vector<Queue *> queues_;
+	std::mutex mtx_;
+	std::condition_variable cv_;
+	std::condition_variable idle_cv_;
+	std::atomic<int> pending_;  // queued, not yet picked up
+	std::atomic<int> inflight_; // queued or running
+	std::atomic<unsigned> next_;
+	bool stop_;
+};
+
+#endif //__THREADPOOL_H__
@@ -0,0 +1,52 @@
+// Builds or checks the binary caches of obj files.
+//   objcache file.obj...          (re)writes file.obj.mcache
+//   objcache -o out.mcache file.obj
+//   objcache --check file.obj...  tells whether the caches are fresh and
+//                                 whether the source checksum still matches
+#include <iostream>
+#include <cstring>
+#include "model.h"
+#include "meshcache.h"
+
+static int check(const char *source) {
+	std::string path = mesh_cache_path(source);
+	MeshCacheHeader header;
+	if (!read_mesh_cache_header(path.c_str(), header)) {
+		std::cout << source << ": no usable cache\n";
+		return 1;
+	}
+	uint64_t sum = 0;
+	bool fresh = mesh_cache_fresh(header, source);
+	bool same = file_checksum(source, sum) && sum==header.src_checksum;
+	std::cout << source << ": " << (fresh ? "fresh" : "stale") << ", checksum " << (same ? "matches" : "differs")
+		<< ", v# " << header.nverts << " f# " << header.nfaces << " m# " << header.nmeshlets << "\n";
+	return fresh && same ? 0 : 1;
+}
+
+static int build(const char *source, const char *path) {
+	Model model(source, false);
+	if (!model.nfaces()) {
+		std::cerr << source << ": nothing to cache\n";
+		return 1;
+	}
+	return write_mesh_cache(path, model.view(), source) ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+	if (argc<2) {
+		std::cerr << "usage: " << argv[0] << " [--check] file.obj... | -o out.mcache file.obj\n";
+		return 2;
+	}
+	int ret = 0;
+	if (!strcmp(argv[1], "-o")) {
+		if (argc!=4) {
+			std::cerr << "-o takes one output and one source\n";
+			return 2;
+		}
+		return build(argv[3], argv[2]);
+	}
+	bool checking = !strcmp(argv[1], "--check");
+	for (int i=checking ? 2 : 1; i<argc; i++)
+		ret |= checking ? check(argv[i]) : build(argv[i], mesh_cache_path(argv[i]).c_str());
+	return ret;
+}
@@ -0,0 +1,42 @@
+#include <algorithm>
+#include "transform.h"
+#include "threadpool.h"
+
+namespace {
+
+const size_t BLOCK = 256;   // vertices per pass, the clip coordinates stay in L1 for the divide
+const size_t CHUNK = 1<<14; // vertices per task
+
+void transform_range(const Matrix &m, const MeshView &mesh, VertexBuffer &out, size_t begin, size_t end) {
+	for (size_t i=begin; i<end; i+=BLOCK) {
+		size_t n = std::min(BLOCK, end-i);
+		transform_points(m, mesh.vx+i, mesh.vy+i, mesh.vz+i, n, &out.x[i], &out.y[i], &out.z[i], &out.w[i]);
+		project_points(&out.x[i], &out.y[i], &out.z[i], &out.w[i], n, &out.sx[i], &out.sy[i], &out.sz[i]);
+	}
+}
+
+} // namespace
+
+void VertexBuffer::resize(size_t n) {
+	x.resize(n);
+	y.resize(n);
+	z.resize(n);
+	w.resize(n);
+	sx.resize(n);
+	sy.resize(n);
+	sz.resize(n);
+}
+
+void transform_vertices(const Matrix &m, const MeshView &mesh, VertexBuffer &out, ThreadPool *pool) {
+	size_t n = mesh.nverts;
+	if (out.size()<n) out.resize(n);
+	size_t chunks = (n+CHUNK-1)/CHUNK;
+	if (!pool || chunks<2) {
+		transform_range(m, mesh, out, 0, n);
+		return;
+	}
+	pool->parallel_for((int)chunks, [&](int c) {
+		size_t begin = c*CHUNK;
+		transform_range(m, mesh, out, begin, std::min(begin+CHUNK, n));
+	});
+}
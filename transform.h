@@ -0,0 +1,27 @@
+#ifndef __TRANSFORM_H__
+#define __TRANSFORM_H__
+
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+
+class ThreadPool;
+
+// Output of the vertex stage, one entry per mesh vertex in SoA: the clip
+// space x, y, z, w that clipping needs, and sx, sy, sz after the perspective
+// divide (pixels and depth when the matrix ends with a viewport), which is all
+// the triangles that need no clipping look at. w is <= 0 behind the eye.
+struct VertexBuffer {
+	std::vector<float> x, y, z, w;
+	std::vector<float> sx, sy, sz;
+
+	void resize(size_t n);
+	size_t size() const { return w.size(); }
+};
+
+// Runs every vertex of mesh through m once with the SoA helpers of
+// geometry.h, split over the pool when the mesh is big enough.
+// out only grows, so a buffer kept from frame to frame stops allocating.
+void transform_vertices(const Matrix &m, const MeshView &mesh, VertexBuffer &out, ThreadPool *pool=NULL);
+
+#endif //__TRANSFORM_H__
@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <cstring>
+#include "zbuffer.h"
+#include "streamfill.h"
+
+DepthBuffer::DepthBuffer(int w, int h) : z_((size_t)w*h), min8_(), max8_(), min64_(), max64_(), dirty64_(), pending_(), clear_(0), stats_() {
+	int bw = (w+BLOCK-1)/BLOCK, bh = (h+BLOCK-1)/BLOCK;
+	int tw = (w+TILE-1)/TILE,   th = (h+TILE-1)/TILE;
+	min8_.resize(bw*bh);
+	max8_.resize(bw*bh);
+	min64_.resize(tw*th);
+	max64_.resize(tw*th);
+	dirty64_.resize(tw*th);
+	pending_.resize(tw*th);
+	stats_.resize(tw*th);
+
+	target_.z = &z_[0];
+	target_.width = w;
+	target_.height = h;
+	target_.min8 = &min8_[0];
+	target_.max8 = &max8_[0];
+	target_.bw = bw;
+	target_.min64 = &min64_[0];
+	target_.max64 = &max64_[0];
+	target_.dirty64 = &dirty64_[0];
+	target_.tw = tw;
+	target_.stats = &stats_[0];
+	clear();
+	reset_stats();
+}
+
+void DepthBuffer::clear(float value) {
+	clear_ = value;
+	std::fill(min64_.begin(), min64_.end(), value);
+	std::fill(max64_.begin(), max64_.end(), value);
+	std::fill(dirty64_.begin(), dirty64_.end(), 0);
+	std::fill(pending_.begin(), pending_.end(), 1);
+}
+
+void DepthBuffer::clear_tile(int t) {
+	int w = target_.width, h = target_.height, tw = target_.tw, bw = target_.bw;
+	int x0 = (t%tw)*TILE, y0 = (t/tw)*TILE;
+	int x1 = std::min(x0+TILE, w), y1 = std::min(y0+TILE, h);
+	for (int y=y0; y<y1; y++) {
+		float *row = &z_[(size_t)y*w];
+		std::fill(row+x0, row+x1, clear_);
+	}
+	for (int by=y0/BLOCK; by<(y1+BLOCK-1)/BLOCK; by++) {
+		int b0 = by*bw + x0/BLOCK, b1 = by*bw + (x1+BLOCK-1)/BLOCK;
+		std::fill(&min8_[0]+b0, &min8_[0]+b1, clear_);
+		std::fill(&max8_[0]+b0, &max8_[0]+b1, clear_);
+	}
+	pending_[t] = 0;
+}
+
+void DepthBuffer::materialize() {
+	if (std::find(pending_.begin(), pending_.end(), 0)==pending_.end()) {
+		uint32_t bits;
+		memcpy(&bits, &clear_, sizeof(bits));
+		stream_fill((uint32_t *)&z_[0], z_.size(), bits);
+		std::fill(min8_.begin(), min8_.end(), clear_);
+		std::fill(max8_.begin(), max8_.end(), clear_);
+		std::fill(pending_.begin(), pending_.end(), 0);
+		return;
+	}
+	for (size_t t=0; t<pending_.size(); t++)
+		if (pending_[t]) clear_tile((int)t);
+}
+
+DepthTarget &DepthBuffer::touch(int x0, int y0, int x1, int y1) {
+	int tw = target_.tw;
+	for (int ty=y0/TILE; ty<=y1/TILE; ty++)
+		for (int tx=x0/TILE; tx<=x1/TILE; tx++)
+			if (pending_[tx+ty*tw]) clear_tile(tx+ty*tw);
+	return target_;
+}
+
+float *DepthBuffer::buffer() {
+	materialize();
+	return &z_[0];
+}
+
+int DepthBuffer::get_width() {
+	return target_.width;
+}
+
+int DepthBuffer::get_height() {
+	return target_.height;
+}
+
+DepthTarget &DepthBuffer::target() {
+	return target_;
+}
+
+HiZStats DepthBuffer::stats() {
+	HiZStats sum;
+	memset(&sum, 0, sizeof(sum));
+	for (size_t i=0; i<stats_.size(); i++) {
+		sum.tile_rejects     += stats_[i].tile_rejects;
+		sum.tile_pixels      += stats_[i].tile_pixels;
+		sum.block_rejects    += stats_[i].block_rejects;
+		sum.block_pixels     += stats_[i].block_pixels;
+		sum.fragments_tested += stats_[i].fragments_tested;
+		sum.fragments_failed += stats_[i].fragments_failed;
+	}
+	return sum;
+}
+
+void DepthBuffer::reset_stats() {
+	memset(&stats_[0], 0, stats_.size()*sizeof(HiZStats));
+}
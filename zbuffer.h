@@ -0,0 +1,51 @@
+#ifndef __ZBUFFER_H__
+#define __ZBUFFER_H__
+
+#include <vector>
+#include <limits>
+#include "rasterkernel.h"
+
+// Depth buffer plus two coarse levels: min/max depth per 8x8 block and per
+// 64x64 tile. The kernels keep the coarse levels up to date as they write.
+// Clears are lazy like the ones of RenderTarget: clear() sets the tile levels
+// and marks the tiles pending, depths and block levels of a tile are written
+// when it is first touched.
+class DepthBuffer {
+public:
+	static const int BLOCK = 8;
+	static const int TILE = 64;
+
+	DepthBuffer(int w, int h);
+	void clear(float value=-std::numeric_limits<float>::max());
+	// does every pending clear now, one streaming fill if no tile was touched
+	void materialize();
+	// all the depths, pending clears done first
+	float *buffer();
+	// clears the pending tiles over [x0,x1]x[y0,y1] and returns target();
+	// threads may touch different tiles at the same time
+	DepthTarget &touch(int x0, int y0, int x1, int y1);
+	int get_width();
+	int get_height();
+	// the kernels' view, tiles still pending a clear hold stale values
+	DepthTarget &target();
+
+	HiZStats stats();
+	void reset_stats();
+
+private:
+	DepthBuffer(const DepthBuffer &);
+	DepthBuffer & operator =(const DepthBuffer &);
+
+	void clear_tile(int t);
+
+	std::vector<float> z_;
+	std::vector<float> min8_, max8_;
+	std::vector<float> min64_, max64_;
+	std::vector<unsigned char> dirty64_;
+	std::vector<unsigned char> pending_;
+	float clear_;
+	std::vector<HiZStats> stats_;
+	DepthTarget target_;
+};
+
+#endif //__ZBUFFER_H__